@@ -0,0 +1,175 @@
+/*
+ * arena.c
+ *
+ * Functions that implement a bump allocator whose
+ * allocations are all released at once. Allocations
+ * are carved from blocks; those larger than half a
+ * block get a block of their own.
+ *
+ *  @since 2026-10-18
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include "arena.h"
+
+/** alignment of arena allocations */
+#define ARENA_ALIGN (_Alignof(max_align_t))
+
+/** Definition of a block of arena storage */
+typedef struct ArenaBlock {
+	struct ArenaBlock *next;	/** next block in arena */
+	size_t size;				/** size of block storage */
+	size_t used;				/** bytes of storage in use */
+	_Alignas(max_align_t) char bytes[];	/** block storage */
+} ArenaBlock;
+
+/** Definition of an arena */
+struct Arena {
+	ArenaBlock *current;	/** block for small allocations */
+	ArenaBlock *first;		/** first block, allocated with arena */
+	size_t blockSize;		/** storage size of new blocks */
+	void *last;				/** most recent allocation in current block */
+};
+
+/**
+ * Round size up to the arena alignment.
+ *
+ * @param size the size
+ * @return the aligned size
+ */
+static size_t alignSize(size_t size) {
+	return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+/**
+ * Create a new arena. The first block is allocated with
+ * the arena and is kept when the arena is reset.
+ *
+ * @param blockSize the size of arena blocks
+ * @return the new arena or NULL if no space
+ */
+Arena *newArena(size_t blockSize) {
+	blockSize = alignSize(blockSize);
+	size_t arenaSize = alignSize(sizeof(Arena));
+	Arena *arena = malloc(arenaSize + sizeof(ArenaBlock) + blockSize);
+	if (arena == NULL) {
+		return NULL;
+	}
+	ArenaBlock *first = (ArenaBlock*)((char*)arena + arenaSize);
+	*first = (ArenaBlock){.next = NULL, .size = blockSize, .used = 0};
+	*arena = (Arena){.current = first, .first = first, .blockSize = blockSize, .last = NULL};
+	return arena;
+}
+
+/**
+ * Delete an arena and all of its allocations.
+ *
+ * @param arena the arena
+ */
+void deleteArena(Arena *arena) {
+	resetArena(arena);
+	free(arena);
+}
+
+/**
+ * Release all allocations of an arena, keeping
+ * its first block for reuse.
+ *
+ * @param arena the arena
+ */
+void resetArena(Arena *arena) {
+	// first block is the last in the list
+	for (ArenaBlock *block = arena->current; block != arena->first; ) {
+		ArenaBlock *next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->first->used = 0;
+	arena->current = arena->first;
+	arena->last = NULL;
+}
+
+/**
+ * Allocate storage from an arena. Storage is aligned
+ * for any type and lives until the arena is reset.
+ *
+ * @param arena the arena
+ * @param size the size of the storage
+ * @return the storage or NULL if no space
+ */
+void *allocArena(Arena *arena, size_t size) {
+	size = alignSize(size);
+	ArenaBlock *current = arena->current;
+	if (size <= current->size - current->used) {
+		void *ptr = current->bytes + current->used;
+		current->used += size;
+		arena->last = ptr;
+		return ptr;
+	}
+
+	// large allocations get their own block behind the current one
+	bool large = (size > arena->blockSize/2);
+	size_t blockSize = large ? size : arena->blockSize;
+	ArenaBlock *block = malloc(sizeof(ArenaBlock) + blockSize);
+	if (block == NULL) {
+		return NULL;
+	}
+	*block = (ArenaBlock){.size = blockSize, .used = size};
+	if (large && (current != arena->first)) {
+		block->next = current->next;
+		current->next = block;
+	} else {
+		block->next = current;
+		arena->current = block;
+		arena->last = block->bytes;
+	}
+	return block->bytes;
+}
+
+/**
+ * Resize storage allocated from an arena. The most recent
+ * allocation grows in place if its block has room.
+ *
+ * @param arena the arena
+ * @param ptr the storage or NULL
+ * @param oldSize the current size of the storage
+ * @param newSize the new size of the storage
+ * @return the storage or NULL if no space
+ */
+void *reallocArena(Arena *arena, void *ptr, size_t oldSize, size_t newSize) {
+	if ((ptr != NULL) && (ptr == arena->last)) {
+		ArenaBlock *current = arena->current;
+		size_t offset = (char*)ptr - current->bytes;
+		if (alignSize(newSize) <= current->size - offset) {
+			current->used = offset + alignSize(newSize);
+			return ptr;
+		}
+	}
+	if (newSize <= oldSize) {
+		return ptr;
+	}
+	void *newPtr = allocArena(arena, newSize);
+	if ((newPtr != NULL) && (ptr != NULL)) {
+		memcpy(newPtr, ptr, oldSize);
+	}
+	return newPtr;
+}
+
+/**
+ * Duplicate a string in an arena.
+ *
+ * @param arena the arena
+ * @param s the string
+ * @return the duplicate or NULL if no space
+ */
+char *strdupArena(Arena *arena, const char *s) {
+	size_t len = strlen(s) + 1;
+	char *dup = allocArena(arena, len);
+	if (dup != NULL) {
+		memcpy(dup, s, len);
+	}
+	return dup;
+}
@@ -0,0 +1,73 @@
+/*
+ * arena.h
+ *
+ * Functions that implement a bump allocator whose
+ * allocations are all released at once.
+ *
+ *  @since 2026-10-18
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+
+/** Declaration of Arena as opaque type */
+typedef struct Arena Arena;
+
+/**
+ * Create a new arena. The first block is allocated with
+ * the arena and is kept when the arena is reset.
+ *
+ * @param blockSize the size of arena blocks
+ * @return the new arena or NULL if no space
+ */
+Arena *newArena(size_t blockSize);
+
+/**
+ * Delete an arena and all of its allocations.
+ *
+ * @param arena the arena
+ */
+void deleteArena(Arena *arena);
+
+/**
+ * Release all allocations of an arena, keeping
+ * its first block for reuse.
+ *
+ * @param arena the arena
+ */
+void resetArena(Arena *arena);
+
+/**
+ * Allocate storage from an arena. Storage is aligned
+ * for any type and lives until the arena is reset.
+ *
+ * @param arena the arena
+ * @param size the size of the storage
+ * @return the storage or NULL if no space
+ */
+void *allocArena(Arena *arena, size_t size);
+
+/**
+ * Resize storage allocated from an arena. The most recent
+ * allocation grows in place if its block has room.
+ *
+ * @param arena the arena
+ * @param ptr the storage or NULL
+ * @param oldSize the current size of the storage
+ * @param newSize the new size of the storage
+ * @return the storage or NULL if no space
+ */
+void *reallocArena(Arena *arena, void *ptr, size_t oldSize, size_t newSize);
+
+/**
+ * Duplicate a string in an arena.
+ *
+ * @param arena the arena
+ * @param s the string
+ * @return the duplicate or NULL if no space
+ */
+char *strdupArena(Arena *arena, const char *s);
+
+#endif /* ARENA_H_ */
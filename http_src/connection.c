@@ -0,0 +1,288 @@
+/*
+ * connection.c
+ *
+ * Functions that implement client connections whose
+ * objects and I/O buffers are allocated from pools.
+ *
+ * A connection holds a receive and a send buffer only
+ * while it has bytes to read or send. An idle keep-alive
+ * connection returns both to their pools, so it costs
+ * just its connection object.
+ *
+ *  @since 2026-10-18
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "connection.h"
+#include "coroutine.h"
+#include "network_util.h"
+#include "pool.h"
+
+/** pool of connection objects */
+static Pool *connPool = NULL;
+
+/** pool of receive buffers */
+static Pool *rbufPool = NULL;
+
+/** pool of send buffers */
+static Pool *wbufPool = NULL;
+
+/** guards creating the pools */
+static pthread_once_t poolsOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Create the pools of connections and their buffers.
+ */
+static void initPools(void) {
+	connPool = newPool(sizeof(Connection), 64);
+	rbufPool = newPool(CONN_RBUF_SIZE, 16);
+	wbufPool = newPool(CONN_WBUF_SIZE, 4);
+}
+
+/**
+ * Send bytes on a connection socket, waiting while it would block.
+ * @param conn the connection
+ * @param buf the bytes
+ * @param size the number of bytes
+ * @return true if sent, false if error
+ */
+static bool sendAll(Connection *conn, const char *buf, size_t size) {
+	while (size > 0) {
+		ssize_t n = send(conn->sock_fd, buf, size, MSG_NOSIGNAL);
+		if (n >= 0) {
+			buf += n;
+			size -= n;
+		} else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+			if (!coWaitFd(conn->sock_fd, POLLOUT)) {
+				return false;
+			}
+		} else if (errno != EINTR) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Receive bytes from a connection socket, waiting while it would block.
+ * @param conn the connection
+ * @param buf the buffer
+ * @param size the buffer size
+ * @return number of bytes received, 0 at end, -1 if error
+ */
+static ssize_t recvSome(Connection *conn, char *buf, size_t size) {
+	for (;;) {
+		ssize_t n = recv(conn->sock_fd, buf, size, 0);
+		if (n >= 0) {
+			return n;
+		}
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+			if (!coWaitFd(conn->sock_fd, POLLIN)) {
+				return -1;
+			}
+		} else if (errno != EINTR) {
+			return -1;
+		}
+	}
+}
+
+/**
+ * Read from a connection stream.
+ * @param cookie the connection
+ * @param buf the buffer
+ * @param size the buffer size
+ * @return number of bytes read, 0 at end, -1 if error
+ */
+static ssize_t readConnection(void *cookie, char *buf, size_t size) {
+	return receiveConnection(cookie, buf, size);
+}
+
+/**
+ * Write to a connection stream. Small writes collect in
+ * the send buffer; writes of at least a buffer are sent
+ * directly.
+ * @param cookie the connection
+ * @param buf the bytes
+ * @param size the number of bytes
+ * @return number of bytes written, or -1 if error
+ */
+static ssize_t writeConnection(void *cookie, const char *buf, size_t size) {
+	Connection *conn = cookie;
+	if (conn->wlen + size > CONN_WBUF_SIZE) {
+		if (!flushConnection(conn)) {
+			return -1;
+		}
+	}
+	if ((size < CONN_WBUF_SIZE) && (conn->wbuf == NULL)) {
+		conn->wbuf = allocPool(wbufPool);
+	}
+	if ((size >= CONN_WBUF_SIZE) || (conn->wbuf == NULL)) {
+		return sendAll(conn, buf, size) ? (ssize_t)size : -1;
+	}
+	memcpy(conn->wbuf + conn->wlen, buf, size);
+	conn->wlen += size;
+	return size;
+}
+
+/**
+ * Close a connection stream, sending unsent bytes
+ * and closing the socket.
+ * @param cookie the connection
+ * @return 0 if successful
+ */
+static int closeConnection(void *cookie) {
+	Connection *conn = cookie;
+	flushConnection(conn);
+	return close(conn->sock_fd);
+}
+
+/**
+ * Create a connection for a socket. Reads and writes
+ * through its stream are buffered by the connection,
+ * and wait with coWaitFd() if the socket would block.
+ *
+ * @param sock_fd the socket descriptor
+ * @return the connection or NULL if no space
+ */
+Connection *newConnection(int sock_fd) {
+	pthread_once(&poolsOnce, initPools);
+	Connection *conn = allocPool(connPool);
+	if (conn == NULL) {
+		return NULL;
+	}
+	*conn = (Connection){.sock_fd = sock_fd, .client = get_peer_address(sock_fd)};
+
+#if defined(__linux__)
+	cookie_io_functions_t funcs = {
+		.read = readConnection,
+		.write = writeConnection,
+		.close = closeConnection
+	};
+	conn->stream = fopencookie(conn, "r+", funcs);
+#else
+	conn->stream = funopen(conn,
+			(int (*)(void *, char *, int))readConnection,
+			(int (*)(void *, const char *, int))writeConnection,
+			NULL, closeConnection);
+#endif
+	if (conn->stream == NULL) {
+		freePool(connPool, conn);
+		return NULL;
+	}
+	// the connection buffers, so the stream does not
+	setvbuf(conn->stream, NULL, _IONBF, 0);
+	return conn;
+}
+
+/**
+ * Delete a connection, sending unsent bytes and
+ * closing its socket.
+ *
+ * @param conn the connection
+ */
+void deleteConnection(Connection *conn) {
+	fclose(conn->stream);
+	conn->rpos = conn->rlen = conn->wlen = 0;
+	releaseConnectionBuffers(conn);
+	freePool(connPool, conn);
+}
+
+/**
+ * Receive bytes from a connection, waiting until at least
+ * one is available. Small reads are served from the receive
+ * buffer; reads of at least a buffer go directly to the caller.
+ *
+ * @param conn the connection
+ * @param buf the buffer
+ * @param size the buffer size
+ * @return number of bytes received, 0 at end, -1 if error
+ */
+ssize_t receiveConnection(Connection *conn, void *buf, size_t size) {
+	if (conn->rpos == conn->rlen) {
+		// the client may be waiting for a response before
+		// it sends more, as with 100-continue
+		if (!flushConnection(conn)) {
+			return -1;
+		}
+		if ((size < CONN_RBUF_SIZE) && (conn->rbuf == NULL)) {
+			conn->rbuf = allocPool(rbufPool);
+		}
+		if ((size >= CONN_RBUF_SIZE) || (conn->rbuf == NULL)) {
+			return recvSome(conn, buf, size);
+		}
+		ssize_t n = recvSome(conn, conn->rbuf, CONN_RBUF_SIZE);
+		if (n <= 0) {
+			return n;
+		}
+		conn->rpos = 0;
+		conn->rlen = n;
+	}
+
+	size_t n = conn->rlen - conn->rpos;
+	if (n > size) {
+		n = size;
+	}
+	memcpy(buf, conn->rbuf + conn->rpos, n);
+	conn->rpos += n;
+	return n;
+}
+
+/**
+ * Send the unsent bytes of a connection.
+ *
+ * @param conn the connection
+ * @return true if sent, false if error
+ */
+bool flushConnection(Connection *conn) {
+	if (conn->wlen == 0) {
+		return true;
+	}
+	bool status = sendAll(conn, conn->wbuf, conn->wlen);
+	conn->wlen = 0;
+	return status;
+}
+
+/**
+ * Return the buffers of a connection to their pools
+ * if they hold no unread or unsent bytes. The next
+ * read or write allocates them again.
+ *
+ * @param conn the connection
+ */
+void releaseConnectionBuffers(Connection *conn) {
+	if ((conn->rbuf != NULL) && (conn->rpos == conn->rlen)) {
+		freePool(rbufPool, conn->rbuf);
+		conn->rbuf = NULL;
+		conn->rpos = conn->rlen = 0;
+	}
+	if ((conn->wbuf != NULL) && (conn->wlen == 0)) {
+		freePool(wbufPool, conn->wbuf);
+		conn->wbuf = NULL;
+	}
+}
+
+/**
+ * Wait for the next request on an idle connection.
+ * Unsent bytes are sent, and the buffers are released
+ * while waiting.
+ *
+ * @param conn the connection
+ * @param timeoutMs the timeout in milliseconds, or -1 for none
+ * @return true if bytes can be read, false if timed out or error
+ */
+bool waitConnection(Connection *conn, int timeoutMs) {
+	if (!flushConnection(conn)) {
+		return false;
+	}
+	// a pipelined request may already be buffered
+	if (conn->rpos < conn->rlen) {
+		return true;
+	}
+	releaseConnectionBuffers(conn);
+	return coPollFd(conn->sock_fd, POLLIN, timeoutMs) > 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * connection.h
+ *
+ * Functions that implement client connections whose
+ * objects and I/O buffers are allocated from pools.
+ *
+ *  @since 2026-10-18
+ */
+
+#ifndef CONNECTION_H_
+#define CONNECTION_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/** size of a connection receive buffer */
+#define CONN_RBUF_SIZE (4*1024)
+
+/** size of a connection send buffer */
+#define CONN_WBUF_SIZE (16*1024)
+
+/** A client connection and its buffers */
+typedef struct Connection {
+	int sock_fd;                 /** the socket descriptor */
+	unsigned long client;        /** the client address key */
+	FILE *stream;                /** the socket stream */
+	char *rbuf;                  /** receive buffer or NULL if released */
+	size_t rpos;                 /** position of unread received bytes */
+	size_t rlen;                 /** end of received bytes */
+	char *wbuf;                  /** send buffer or NULL if released */
+	size_t wlen;                 /** number of unsent bytes */
+} Connection;
+
+/**
+ * Create a connection for a socket. Reads and writes
+ * through its stream are buffered by the connection,
+ * and wait with coWaitFd() if the socket would block.
+ *
+ * @param sock_fd the socket descriptor
+ * @return the connection or NULL if no space
+ */
+Connection *newConnection(int sock_fd);
+
+/**
+ * Delete a connection, sending unsent bytes and
+ * closing its socket.
+ *
+ * @param conn the connection
+ */
+void deleteConnection(Connection *conn);
+
+/**
+ * Receive bytes from a connection, waiting until at least
+ * one is available. Reads through the stream of the
+ * connection and direct reads can be mixed, since the
+ * stream itself is unbuffered.
+ *
+ * @param conn the connection
+ * @param buf the buffer
+ * @param size the buffer size
+ * @return number of bytes received, 0 at end, -1 if error
+ */
+ssize_t receiveConnection(Connection *conn, void *buf, size_t size);
+
+/**
+ * Send the unsent bytes of a connection.
+ *
+ * @param conn the connection
+ * @return true if sent, false if error
+ */
+bool flushConnection(Connection *conn);
+
+/**
+ * Return the buffers of a connection to their pools
+ * if they hold no unread or unsent bytes. The next
+ * read or write allocates them again.
+ *
+ * @param conn the connection
+ */
+void releaseConnectionBuffers(Connection *conn);
+
+/**
+ * Wait for the next request on an idle connection.
+ * Unsent bytes are sent, and the buffers are released
+ * while waiting.
+ *
+ * @param conn the connection
+ * @param timeoutMs the timeout in milliseconds, or -1 for none
+ * @return true if bytes can be read, false if timed out or error
+ */
+bool waitConnection(Connection *conn, int timeoutMs);
+
+#endif /* CONNECTION_H_ */
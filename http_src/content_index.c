@@ -0,0 +1,627 @@
+/*
+ * content_index.c
+ *
+ * Functions that index the files of the content tree in
+ * memory, so requests find them without resolving paths.
+ *
+ * If ContentIndex is true, the paths reported by the content
+ * watcher are kept in a radix tree keyed by path under the
+ * content base, each edge labeled with the bytes its paths
+ * share, along with the type, size, time and media type of
+ * each file. A path is found by walking the tree. It is
+ * missing if the nearest directory found above it is
+ * watched, since every entry of a watched directory is in
+ * the tree. Paths through symbolic links are not indexed,
+ * so they are resolved as before.
+ *
+ * Each change is applied from the current status of its
+ * path, so a change reported both by a request and by the
+ * watcher leaves the tree as the disk is.
+ *
+ * Files are opened with openat() relative to a descriptor
+ * of their directory, kept for up to ContentIndexDirFds
+ * recently used directories, so only the last component
+ * of a path is resolved.
+ *
+ * Other paths, and the directories themselves, are opened
+ * beneath the content base with openBeneath(), so a path
+ * that leaves the content tree is refused.
+ *
+ *  @since 2026-10-18
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include "content_index.h"
+#include "content_watch.h"
+#include "file_util.h"
+#include "http_server.h"
+#include "http_util.h"
+#include "media_util.h"
+
+/** A node of the index for the paths that start with its key */
+typedef struct IndexNode {
+	struct IndexNode **children;  /** children by first byte of label */
+	uint16_t childCount;          /** number of children */
+	bool hasEntry;                /** a file exists at the key */
+	bool watched;                 /** all entries of the directory are indexed */
+	int dirSlot;                  /** descriptor slot of the directory, or -1 */
+	mode_t mode;                  /** file type and permissions */
+	off_t size;                   /** file size */
+	struct timespec mtime;        /** modification time */
+	const char *mediaType;        /** media type of the file */
+	uint32_t labelLen;            /** length of the label */
+	char label[];                 /** the bytes of the key from the parent */
+} IndexNode;
+
+/** A descriptor kept for a directory */
+typedef struct DirSlot {
+	int fd;                       /** the descriptor, or -1 if free */
+	int refs;                     /** opens using the descriptor */
+	bool recent;                  /** used since the clock hand passed */
+	IndexNode *owner;             /** the directory, or NULL once removed */
+} DirSlot;
+
+/** the root of the index, for the content base */
+static IndexNode *root = NULL;
+
+/** guards the index */
+static pthread_rwlock_t indexLock = PTHREAD_RWLOCK_INITIALIZER;
+
+/** the directory descriptor slots */
+static DirSlot *dirSlots = NULL;
+
+/** number of directory descriptor slots */
+static long slotCount = 0;
+
+/** next slot the clock hand passes */
+static long clockHand = 0;
+
+/** guards the slots and dirSlot of nodes */
+static pthread_mutex_t slotMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Create a node with no entry or children.
+ * @param label the label
+ * @param len the length of the label
+ * @return the node, or NULL if no space
+ */
+static IndexNode *newNode(const char *label, size_t len) {
+	IndexNode *node = calloc(1, sizeof(IndexNode) + len);
+	if (node != NULL) {
+		node->dirSlot = -1;
+		node->labelLen = len;
+		memcpy(node->label, label, len);
+	}
+	return node;
+}
+
+/**
+ * Returns the index of the child whose label starts with
+ * a byte, or where it would be inserted.
+ * @param node the node
+ * @param c the byte
+ * @return the index if found, or -1 less the insertion point
+ */
+static int childIndex(const IndexNode *node, unsigned char c) {
+	int lo = 0, hi = node->childCount - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		unsigned char m = (unsigned char)node->children[mid]->label[0];
+		if (m == c) {
+			return mid;
+		} else if (m < c) {
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return -lo - 1;
+}
+
+/**
+ * Insert a child of a node.
+ * @param node the node
+ * @param at the index of the child
+ * @param child the child
+ * @return true if successful, false if no space
+ */
+static bool insertChild(IndexNode *node, int at, IndexNode *child) {
+	IndexNode **children = realloc(node->children, (node->childCount+1) * sizeof(IndexNode*));
+	if (children == NULL) {
+		return false;
+	}
+	memmove(children+at+1, children+at, (node->childCount-at) * sizeof(IndexNode*));
+	children[at] = child;
+	node->children = children;
+	node->childCount++;
+	return true;
+}
+
+/**
+ * Remove a child of a node, without freeing it.
+ * @param node the node
+ * @param at the index of the child
+ */
+static void removeChild(IndexNode *node, int at) {
+	memmove(node->children+at, node->children+at+1, (node->childCount-at-1) * sizeof(IndexNode*));
+	if (--node->childCount == 0) {
+		free(node->children);
+		node->children = NULL;
+	}
+}
+
+/**
+ * Release the directory descriptor of a node, closing it
+ * once no open uses it.
+ * @param node the node
+ */
+static void releaseNodeSlot(IndexNode *node) {
+	pthread_mutex_lock(&slotMutex);
+	if (node->dirSlot >= 0) {
+		DirSlot *slot = &dirSlots[node->dirSlot];
+		slot->owner = NULL;
+		if (slot->refs == 0) {
+			close(slot->fd);
+			slot->fd = -1;
+		}
+		node->dirSlot = -1;
+	}
+	pthread_mutex_unlock(&slotMutex);
+}
+
+/**
+ * Free a node and its descendants.
+ * @param node the node
+ */
+static void freeTree(IndexNode *node) {
+	for (int i = 0; i < node->childCount; i++) {
+		freeTree(node->children[i]);
+	}
+	releaseNodeSlot(node);
+	free(node->children);
+	free(node);
+}
+
+/**
+ * Remove the entries under the directory of a node, which
+ * are all under its child whose label starts with '/'.
+ * @param node the node
+ */
+static void removeSubtree(IndexNode *node) {
+	if (node == root) {
+		while (node->childCount > 0) {
+			freeTree(node->children[node->childCount-1]);
+			removeChild(node, node->childCount-1);
+		}
+	} else {
+		int i = childIndex(node, '/');
+		if (i >= 0) {
+			freeTree(node->children[i]);
+			removeChild(node, i);
+		}
+	}
+	node->watched = false;
+}
+
+/**
+ * Remove a child of a node with no entry, or merge it with
+ * its only child, so every node without an entry branches.
+ * @param node the node
+ * @param i the index of the child
+ */
+static void compactChild(IndexNode *node, int i) {
+	IndexNode *child = node->children[i];
+	if (child->hasEntry) {
+		return;
+	}
+	if (child->childCount == 0) {
+		removeChild(node, i);
+		free(child);
+	} else if (child->childCount == 1) {
+		IndexNode *grand = child->children[0];
+		IndexNode *merged = malloc(sizeof(IndexNode) + child->labelLen + grand->labelLen);
+		if (merged == NULL) {
+			return;  // left as it is
+		}
+		*merged = *grand;
+		memcpy(merged->label, child->label, child->labelLen);
+		memcpy(merged->label + child->labelLen, grand->label, grand->labelLen);
+		merged->labelLen = child->labelLen + grand->labelLen;
+		pthread_mutex_lock(&slotMutex);
+		if (merged->dirSlot >= 0) {
+			dirSlots[merged->dirSlot].owner = merged;
+		}
+		pthread_mutex_unlock(&slotMutex);
+		node->children[i] = merged;
+		free(child->children);
+		free(child);
+		free(grand);
+	}
+}
+
+/**
+ * Find the node of a key.
+ * @param s the key
+ * @param rest the length of the key
+ * @return the node, or NULL if none
+ */
+static IndexNode *findNode(const char *s, size_t rest) {
+	IndexNode *node = root;
+	while (rest > 0) {
+		int i = childIndex(node, s[0]);
+		if (i < 0) {
+			return NULL;
+		}
+		IndexNode *child = node->children[i];
+		if ((child->labelLen > rest) || (memcmp(child->label, s, child->labelLen) != 0)) {
+			return NULL;
+		}
+		s += child->labelLen;
+		rest -= child->labelLen;
+		node = child;
+	}
+	return node;
+}
+
+/**
+ * Find or add the node of a key, splitting the label of
+ * a child that the key leaves part way.
+ * @param s the key
+ * @param rest the length of the key
+ * @return the node, or NULL if no space
+ */
+static IndexNode *insertKey(const char *s, size_t rest) {
+	IndexNode *node = root;
+	while (rest > 0) {
+		int i = childIndex(node, s[0]);
+		if (i < 0) {
+			IndexNode *leaf = newNode(s, rest);
+			if ((leaf == NULL) || !insertChild(node, -i-1, leaf)) {
+				free(leaf);
+				return NULL;
+			}
+			return leaf;
+		}
+		IndexNode *child = node->children[i];
+		size_t k = 1;
+		while ((k < child->labelLen) && (k < rest) && (child->label[k] == s[k])) {
+			k++;
+		}
+		if (k < child->labelLen) {
+			IndexNode *mid = newNode(s, k);
+			if ((mid == NULL) || !insertChild(mid, 0, child)) {
+				free(mid);
+				return NULL;
+			}
+			memmove(child->label, child->label+k, child->labelLen-k);
+			child->labelLen -= k;
+			node->children[i] = mid;
+			child = mid;
+		}
+		s += k;
+		rest -= k;
+		node = child;
+	}
+	return node;
+}
+
+/**
+ * Remove the entry of a key, and those under it if it is
+ * a directory.
+ * @param node the node to start from
+ * @param s the key from the node
+ * @param rest the length of the key
+ * @return true if found
+ */
+static bool removeKey(IndexNode *node, const char *s, size_t rest) {
+	if (rest == 0) {
+		removeSubtree(node);
+		if (node != root) {
+			node->hasEntry = false;
+			releaseNodeSlot(node);
+		}
+		return true;
+	}
+	int i = childIndex(node, s[0]);
+	if (i < 0) {
+		return false;
+	}
+	IndexNode *child = node->children[i];
+	if ((child->labelLen > rest) || (memcmp(child->label, s, child->labelLen) != 0)) {
+		return false;
+	}
+	if (!removeKey(child, s + child->labelLen, rest - child->labelLen)) {
+		return false;
+	}
+	compactChild(node, i);
+	return true;
+}
+
+/**
+ * Set the entry of a node from the status of its path.
+ * @param node the node
+ * @param path the file path
+ * @param sb the status of the path
+ */
+static void setEntry(IndexNode *node, const char *path, const struct stat *sb) {
+	if (node->hasEntry && S_ISDIR(node->mode) && !S_ISDIR(sb->st_mode)) {
+		removeSubtree(node);
+		releaseNodeSlot(node);
+	}
+	node->hasEntry = true;
+	node->mode = sb->st_mode;
+	node->size = sb->st_size;
+	node->mtime = sb->st_mtim;
+	node->mediaType = lookupMediaType(path);
+}
+
+/**
+ * Listener to changes to the content tree.
+ * @param event the change
+ * @param path the file path, or NULL if ContentEvent_Lost
+ * @param isDir true if the path is of a directory
+ * @param sb the status of the path, or NULL if not known
+ */
+static void contentChanged(enum ContentEvent event, const char *path, bool isDir, const struct stat *sb) {
+	if (event == ContentEvent_Lost) {
+		pthread_rwlock_wrlock(&indexLock);
+		removeKey(root, "", 0);
+		pthread_rwlock_unlock(&indexLock);
+		return;
+	}
+	size_t len = (path == NULL) ? 0 : contentPathLen(path);
+	if (len == 0) {
+		return;
+	}
+	const char *key = path + server.content_base_len;
+	size_t keyLen = len - server.content_base_len;
+	if (keyLen > 0) {  // skip the '/' after the base
+		key++;
+		keyLen--;
+	}
+	if (event == ContentEvent_Watched) {
+		pthread_rwlock_wrlock(&indexLock);
+		IndexNode *node = findNode(key, keyLen);
+		if ((node != NULL) && node->hasEntry && S_ISDIR(node->mode)) {
+			node->watched = true;
+		}
+		pthread_rwlock_unlock(&indexLock);
+		return;
+	}
+
+	// apply the current status of the path
+	struct stat status;
+	if ((sb == NULL) || (event == ContentEvent_Removed)) {
+		sb = (lstat(path, &status) == 0) ? &status : NULL;
+	}
+	pthread_rwlock_wrlock(&indexLock);
+	if (isDir && (event != ContentEvent_Changed)) {
+		// entries of a directory moved in or out are not known yet
+		IndexNode *node = findNode(key, keyLen);
+		if ((node != NULL) && (node != root)) {
+			removeSubtree(node);
+		}
+	}
+	if (sb == NULL) {
+		removeKey(root, key, keyLen);
+	} else {
+		// the parents of the path exist too
+		for (size_t i = 1; i < keyLen; i++) {
+			IndexNode *node = (key[i] == '/') ? insertKey(key, i) : NULL;
+			if ((node != NULL) && !node->hasEntry) {
+				node->hasEntry = true;
+				node->mode = S_IFDIR;
+			}
+		}
+		IndexNode *node = insertKey(key, keyLen);
+		if (node != NULL) {
+			setEntry(node, path, sb);
+		}
+	}
+	pthread_rwlock_unlock(&indexLock);
+}
+
+/**
+ * Start indexing the content tree if configured, from the
+ * changes reported by the content watcher.
+ *
+ * @return true if successful, false with errno set if error
+ */
+bool initContentIndex(void) {
+	if (!server.content_index) {
+		return true;
+	}
+	root = newNode("", 0);
+	slotCount = server.content_index_dir_fds;
+	dirSlots = calloc(MAX(slotCount, 1), sizeof(DirSlot));
+	if ((root == NULL) || (dirSlots == NULL)) {
+		return false;
+	}
+	root->hasEntry = true;
+	root->mode = S_IFDIR;
+	for (long i = 0; i < slotCount; i++) {
+		dirSlots[i].fd = -1;
+	}
+	if (!addContentListener(contentChanged)) {
+		errno = ENOSPC;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Look up a path in the index.
+ *
+ * @param filePath the file path
+ * @param info what the index knows of the file if found
+ * @return the result
+ */
+enum ContentLookup lookupContent(const char *filePath, ContentInfo *info) {
+	size_t len = (root == NULL) ? 0 : contentPathLen(filePath);
+	if (len == 0) {
+		return ContentLookup_Unknown;
+	}
+	const char *s = filePath + server.content_base_len;
+	size_t rest = len - server.content_base_len;
+	if (rest > 0) {
+		s++;
+		rest--;
+	}
+
+	enum ContentLookup result = ContentLookup_Unknown;
+	pthread_rwlock_rdlock(&indexLock);
+	IndexNode *node = root;
+	bool known = root->watched;  // the nearest directory found above is watched
+	while (rest > 0) {
+		int i = childIndex(node, s[0]);
+		IndexNode *child = (i < 0) ? NULL : node->children[i];
+		if ((child == NULL) || (child->labelLen > rest) || (memcmp(child->label, s, child->labelLen) != 0)) {
+			node = NULL;
+			break;
+		}
+		s += child->labelLen;
+		rest -= child->labelLen;
+		node = child;
+		if (node->hasEntry && ((rest == 0) || (*s == '/'))) {
+			if (S_ISLNK(node->mode)) {  // resolved by the file system
+				known = false;
+				node = NULL;
+				break;
+			} else if ((rest > 0) && !S_ISDIR(node->mode)) {  // a file above it
+				known = true;
+				node = NULL;
+				break;
+			} else if (rest > 0) {
+				known = node->watched;
+			}
+		}
+	}
+	if ((node != NULL) && node->hasEntry) {
+		result = ContentLookup_Found;
+		info->mode = node->mode;
+		info->size = node->size;
+		info->mtime = node->mtime;
+		info->mediaType = node->mediaType;
+	} else if (known) {
+		result = ContentLookup_Missing;
+	}
+	pthread_rwlock_unlock(&indexLock);
+	return result;
+}
+
+/**
+ * Returns the slot of the descriptor of a directory, opening
+ * one in place of one not used recently if it has none. The
+ * index must be locked.
+ * @param dir the directory node
+ * @param dirPath the directory path
+ * @param dirLen the length of the directory path
+ * @return the slot, or -1 if none
+ */
+static int acquireDirSlot(IndexNode *dir, const char *dirPath, size_t dirLen) {
+	pthread_mutex_lock(&slotMutex);
+	int at = dir->dirSlot;
+	// the clock hand passes slots in use or used since it last passed
+	for (long n = 0; (at < 0) && (n < 2*slotCount); n++) {
+		DirSlot *slot = &dirSlots[clockHand];
+		long hand = clockHand;
+		clockHand = (clockHand + 1) % slotCount;
+		if (slot->refs > 0) {
+			continue;
+		} else if (slot->recent) {
+			slot->recent = false;
+			continue;
+		}
+		if (slot->fd >= 0) {
+			close(slot->fd);
+			if (slot->owner != NULL) {
+				slot->owner->dirSlot = -1;
+			}
+		}
+		char path[MAXPATHLEN];
+		memcpy(path, dirPath, dirLen);
+		path[dirLen] = '\0';
+		slot->fd = openBeneath(path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+		slot->owner = (slot->fd < 0) ? NULL : dir;
+		if (slot->fd >= 0) {
+			dir->dirSlot = at = hand;
+		}
+		break;
+	}
+	if (at >= 0) {
+		dirSlots[at].refs++;
+		dirSlots[at].recent = true;
+	}
+	pthread_mutex_unlock(&slotMutex);
+	return at;
+}
+
+/**
+ * Release a slot from acquireDirSlot(), closing its
+ * descriptor if its directory was removed meanwhile.
+ * @param at the slot
+ */
+static void releaseDirSlot(int at) {
+	pthread_mutex_lock(&slotMutex);
+	DirSlot *slot = &dirSlots[at];
+	if ((--slot->refs == 0) && (slot->owner == NULL)) {
+		close(slot->fd);
+		slot->fd = -1;
+	}
+	pthread_mutex_unlock(&slotMutex);
+}
+
+/**
+ * Open a path in the content tree, relative to a descriptor
+ * of its directory kept by the index if it can, or else to
+ * the content base, refusing a path that leaves the tree.
+ *
+ * @param filePath the file path
+ * @param flags the open() flags
+ * @return the file descriptor, or -1 with errno set if error
+ */
+int openContent(const char *filePath, int flags) {
+	size_t len = ((root == NULL) || (slotCount == 0)) ? 0 : contentPathLen(filePath);
+	if (len <= server.content_base_len) {
+		return openBeneath(filePath, flags);
+	}
+	size_t slash = len;
+	while (filePath[slash-1] != '/') {
+		slash--;
+	}
+	slash--;
+	char name[MAXPATHLEN];
+	memcpy(name, filePath+slash+1, len-slash-1);
+	name[len-slash-1] = '\0';
+	if (filePath[len] == '/') {  // only a directory, as open() would
+		flags |= O_DIRECTORY;
+	}
+
+	const char *dirKey = filePath + server.content_base_len;
+	size_t dirKeyLen = slash - server.content_base_len;
+	if (dirKeyLen > 0) {
+		dirKey++;
+		dirKeyLen--;
+	}
+	int at = -1;
+	pthread_rwlock_rdlock(&indexLock);
+	IndexNode *dir = findNode(dirKey, dirKeyLen);
+	if ((dir != NULL) && dir->hasEntry && S_ISDIR(dir->mode)) {
+		at = acquireDirSlot(dir, filePath, slash);
+	}
+	pthread_rwlock_unlock(&indexLock);
+	if (at < 0) {
+		return openBeneath(filePath, flags);
+	}
+	// a symbolic link is resolved from the content base
+	int fd = openat(dirSlots[at].fd, name, flags|O_NOFOLLOW);
+	releaseDirSlot(at);
+	return ((fd < 0) && (errno == ELOOP)) ? openBeneath(filePath, flags) : fd;
+}
@@ -0,0 +1,60 @@
+/*
+ * content_index.h
+ *
+ * Functions that index the files of the content tree in
+ * memory, so requests find them without resolving paths.
+ *
+ *  @since 2026-10-18
+ */
+
+#ifndef CONTENT_INDEX_H_
+#define CONTENT_INDEX_H_
+
+#include <stdbool.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/** Results of looking up a path in the index */
+enum ContentLookup {
+	ContentLookup_Unknown = 0,  //!< not indexed, so the path must be resolved
+	ContentLookup_Missing,      //!< nothing exists at the path
+	ContentLookup_Found         //!< a file or directory exists at the path
+};
+
+/** What the index knows of a file */
+typedef struct ContentInfo {
+	mode_t mode;                /** file type and permissions */
+	off_t size;                 /** file size */
+	struct timespec mtime;      /** modification time */
+	const char *mediaType;      /** media type of the file */
+} ContentInfo;
+
+/**
+ * Start indexing the content tree if configured, from the
+ * changes reported by the content watcher.
+ *
+ * @return true if successful, false with errno set if error
+ */
+bool initContentIndex(void);
+
+/**
+ * Look up a path in the index.
+ *
+ * @param filePath the file path
+ * @param info what the index knows of the file if found
+ * @return the result
+ */
+enum ContentLookup lookupContent(const char *filePath, ContentInfo *info);
+
+/**
+ * Open a path in the content tree, relative to a descriptor
+ * of its directory kept by the index if it can, or else to
+ * the content base, refusing a path that leaves the tree.
+ *
+ * @param filePath the file path
+ * @param flags the open() flags
+ * @return the file descriptor, or -1 with errno set if error
+ */
+int openContent(const char *filePath, int flags);
+
+#endif /* CONTENT_INDEX_H_ */
@@ -0,0 +1,358 @@
+/*
+ * content_watch.c
+ *
+ * Functions that report files and directories created in
+ * and removed from the content tree to listeners, from a
+ * scan of the tree and then as it changes.
+ *
+ * A thread adds an inotify watch to each directory of the
+ * tree, reports its entries, and then reads the changes
+ * the watches report. A directory is reported watched
+ * only once its watch is added and its entries are all
+ * reported, so a listener that knows a directory is
+ * watched knows every entry of it. A directory created or
+ * moved into the tree is scanned the same way, and the
+ * watches of one moved out are removed. If the kernel
+ * queue overflows, listeners forget what was reported and
+ * the tree is scanned again. Files written or whose
+ * attributes change are reported changed, with their new
+ * status. Requests report their own changes as they make
+ * them, so they are seen at once.
+ *
+ *  @since 2026-10-18
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+#include "content_watch.h"
+#include "http_server.h"
+
+/** the listeners to changes */
+static ContentListener listeners[CONTENT_MAX_LISTENERS];
+
+/** number of listeners */
+static int listenerCount = 0;
+
+/**
+ * Add a listener to changes to the content tree. Listeners
+ * are added before the watching starts.
+ *
+ * @param listener the listener
+ * @return true if added, false if too many listeners
+ */
+bool addContentListener(ContentListener listener) {
+	if (listenerCount == CONTENT_MAX_LISTENERS) {
+		return false;
+	}
+	listeners[listenerCount++] = listener;
+	return true;
+}
+
+/**
+ * Report a change to the content tree made by a request,
+ * before the request is answered. The change is reported
+ * again by the watching thread once it is seen.
+ *
+ * @param event ContentEvent_Created or ContentEvent_Removed
+ * @param path the file path
+ * @param isDir true if the path is of a directory
+ */
+void reportContentChange(enum ContentEvent event, const char *path, bool isDir) {
+	for (int i = 0; i < listenerCount; i++) {
+		listeners[i](event, path, isDir, NULL);
+	}
+}
+
+/**
+ * Returns the length of a path in the content tree without
+ * a trailing '/', if it has no empty, "." or ".." segments.
+ * Only such paths match the paths reported to listeners.
+ *
+ * @param path the path
+ * @return the length, or 0 if not such a path
+ */
+size_t contentPathLen(const char *path) {
+	size_t baseLen = server.content_base_len;
+	if (   (strncmp(path, server.content_base, baseLen) != 0)
+		|| ((path[baseLen] != '\0') && (path[baseLen] != '/'))) {
+		return 0;
+	}
+	const char *p = path + baseLen;
+	while (*p == '/') {
+		const char *seg = p+1;
+		const char *end = strchr(seg, '/');
+		if (end == NULL) {
+			end = seg + strlen(seg);
+		}
+		size_t segLen = end - seg;
+		if (segLen == 0) {  // only a trailing '/' may be empty
+			return (*end == '\0') ? (size_t)(p - path) : 0;
+		}
+		if ((seg[0] == '.') && ((segLen == 1) || ((segLen == 2) && (seg[1] == '.')))) {
+			return 0;
+		}
+		p = end;
+	}
+	return p - path;
+}
+
+#if defined(__linux__)
+
+/** changes reported by a directory watch */
+#define WATCH_EVENTS (  IN_CREATE|IN_MOVED_TO|IN_DELETE|IN_MOVED_FROM|IN_CLOSE_WRITE|IN_ATTRIB \
+					  | IN_ONLYDIR|IN_DONT_FOLLOW|IN_EXCL_UNLINK)
+
+/** size of the buffer for reading changes */
+#define WATCH_READ_SIZE (64*1024)
+
+/** the inotify descriptor */
+static int watchFd = -1;
+
+/** the directory path of each watch descriptor, or NULL */
+static char **watchPaths = NULL;
+
+/** number of elements of watchPaths */
+static int watchCap = 0;
+
+/** the content base path without a trailing '/' */
+static char rootPath[MAXPATHLEN];
+
+/**
+ * Report a change seen by the watching thread.
+ * @param event the change
+ * @param path the file path, or NULL if ContentEvent_Lost
+ * @param isDir true if the path is of a directory
+ * @param sb the status of the path, or NULL if not known
+ */
+static void reportWatchedChange(enum ContentEvent event, const char *path, bool isDir, const struct stat *sb) {
+	for (int i = 0; i < listenerCount; i++) {
+		listeners[i](event, path, isDir, sb);
+	}
+}
+
+/**
+ * Record the directory path of a watch descriptor.
+ * @param wd the watch descriptor
+ * @param dirPath the directory path
+ * @return true if successful, false if no space
+ */
+static bool setWatchPath(int wd, const char *dirPath) {
+	if (wd >= watchCap) {
+		int cap = MAX(2*watchCap, wd+64);
+		char **paths = realloc(watchPaths, cap*sizeof(char*));
+		if (paths == NULL) {
+			return false;
+		}
+		memset(paths+watchCap, 0, (cap-watchCap)*sizeof(char*));
+		watchPaths = paths;
+		watchCap = cap;
+	}
+	char *copy = strdup(dirPath);
+	if (copy == NULL) {
+		return false;
+	}
+	free(watchPaths[wd]);
+	watchPaths[wd] = copy;
+	return true;
+}
+
+/**
+ * Watch a directory and the directories under it, reporting
+ * their entries, and then each directory as watched.
+ * @param path buffer of MAXPATHLEN with the directory path,
+ *   used for the paths of its entries
+ * @param len the length of the directory path
+ * @param events the changes to watch, following a symbolic
+ *   link only for the root of the tree
+ */
+static void watchTree(char *path, size_t len, uint32_t events) {
+	int wd = inotify_add_watch(watchFd, path, events);
+	bool watched = (wd >= 0) && setWatchPath(wd, path);
+	if ((wd >= 0) && !watched) {
+		inotify_rm_watch(watchFd, wd);
+	}
+	DIR *dir = opendir(path);
+	if (dir == NULL) {  // removed since it was seen
+		return;
+	}
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		const char *name = entry->d_name;
+		size_t nameLen = strlen(name);
+		if ((strcmp(name, ".") == 0) || (strcmp(name, "..") == 0) || (len + nameLen + 2 > MAXPATHLEN)) {
+			continue;
+		}
+		struct stat sb;
+		if (fstatat(dirfd(dir), name, &sb, AT_SYMLINK_NOFOLLOW) != 0) {
+			continue;  // removed since it was read
+		}
+		path[len] = '/';
+		memcpy(path+len+1, name, nameLen+1);
+		bool isDir = S_ISDIR(sb.st_mode);
+		reportWatchedChange(ContentEvent_Created, path, isDir, &sb);
+		if (isDir) {
+			watchTree(path, len+1+nameLen, WATCH_EVENTS);
+		}
+		path[len] = '\0';
+	}
+	closedir(dir);
+	if (watched) {
+		reportWatchedChange(ContentEvent_Watched, path, true, NULL);
+	}
+}
+
+/**
+ * Remove the watches of a directory and the directories
+ * under it, once it is moved out of the tree.
+ * @param dirPath the directory path
+ */
+static void unwatchTree(const char *dirPath) {
+	size_t len = strlen(dirPath);
+	for (int wd = 0; wd < watchCap; wd++) {
+		char *p = watchPaths[wd];
+		if ((p != NULL) && (strncmp(p, dirPath, len) == 0) && ((p[len] == '\0') || (p[len] == '/'))) {
+			inotify_rm_watch(watchFd, wd);
+			free(p);
+			watchPaths[wd] = NULL;
+		}
+	}
+}
+
+/**
+ * Report a change read from a watch.
+ * @param event the change
+ * @param path buffer of MAXPATHLEN for the path
+ */
+static void handleEvent(const struct inotify_event *event, char *path) {
+	if (event->mask & IN_Q_OVERFLOW) {
+		// forget and scan the tree again
+		reportWatchedChange(ContentEvent_Lost, NULL, false, NULL);
+		strcpy(path, rootPath);
+		watchTree(path, strlen(path), WATCH_EVENTS & ~IN_DONT_FOLLOW);
+		return;
+	}
+	if ((event->wd < 0) || (event->wd >= watchCap) || (watchPaths[event->wd] == NULL)) {
+		return;
+	}
+	if (event->mask & IN_IGNORED) {  // the watch is gone
+		free(watchPaths[event->wd]);
+		watchPaths[event->wd] = NULL;
+		return;
+	}
+	if (event->len == 0) {
+		return;
+	}
+	int len = snprintf(path, MAXPATHLEN, "%s/%s", watchPaths[event->wd], event->name);
+	if (len >= MAXPATHLEN) {
+		return;
+	}
+	bool isDir = (event->mask & IN_ISDIR) != 0;
+	struct stat sb;
+	if (event->mask & (IN_CREATE|IN_MOVED_TO)) {
+		bool found = (lstat(path, &sb) == 0);
+		reportWatchedChange(ContentEvent_Created, path, isDir, found ? &sb : NULL);
+		if (isDir) {
+			watchTree(path, len, WATCH_EVENTS);
+		}
+	} else if (event->mask & (IN_DELETE|IN_MOVED_FROM)) {
+		if (isDir) {
+			unwatchTree(path);
+		}
+		reportWatchedChange(ContentEvent_Removed, path, isDir, NULL);
+	} else if ((event->mask & (IN_CLOSE_WRITE|IN_ATTRIB)) && (lstat(path, &sb) == 0)) {
+		reportWatchedChange(ContentEvent_Changed, path, isDir, &sb);
+	}
+}
+
+/**
+ * Thread that scans the content tree and then reports
+ * its changes.
+ * @param arg not used
+ * @return NULL when done
+ */
+static void *watchContent(void *arg) {
+	(void)arg;
+	char path[MAXPATHLEN];
+	strcpy(path, rootPath);
+	watchTree(path, strlen(path), WATCH_EVENTS & ~IN_DONT_FOLLOW);
+
+	static char buf[WATCH_READ_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+	for (;;) {
+		ssize_t n = read(watchFd, buf, sizeof(buf));
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("watchContent");
+			reportWatchedChange(ContentEvent_Lost, NULL, false, NULL);
+			break;
+		}
+		for (char *p = buf; p < buf + n; ) {
+			const struct inotify_event *event = (const struct inotify_event*)p;
+			handleEvent(event, path);
+			p += sizeof(struct inotify_event) + event->len;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Start watching the content tree if there are listeners.
+ * A thread scans the tree, reporting its entries, and then
+ * reports changes until the server stops. Changes are only
+ * reported while the operating system can watch the tree.
+ *
+ * @return true if successful, false with errno set if error
+ */
+bool startContentWatch(void) {
+	if (listenerCount == 0) {
+		return true;
+	}
+	size_t len = server.content_base_len;
+	if (len >= MAXPATHLEN) {
+		errno = ENAMETOOLONG;
+		return false;
+	}
+	memcpy(rootPath, server.content_base, len);
+	rootPath[len] = '\0';
+
+	watchFd = inotify_init1(IN_CLOEXEC);
+	if (watchFd < 0) {
+		return false;
+	}
+	pthread_t thread;
+	int err = pthread_create(&thread, NULL, watchContent, NULL);
+	if (err != 0) {
+		errno = err;
+		return false;
+	}
+	pthread_detach(thread);
+	return true;
+}
+
+#else
+
+/**
+ * Start watching the content tree if there are listeners.
+ * Without inotify, only changes made by requests are
+ * reported.
+ *
+ * @return true if successful, false with errno set if error
+ */
+bool startContentWatch(void) {
+	return true;
+}
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * content_watch.h
+ *
+ * Functions that report files and directories created in
+ * and removed from the content tree to listeners, from a
+ * scan of the tree and then as it changes.
+ *
+ *  @since 2026-10-18
+ */
+
+#ifndef CONTENT_WATCH_H_
+#define CONTENT_WATCH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+/** most listeners that can be added */
+#define CONTENT_MAX_LISTENERS 4
+
+/** Changes to the content tree reported to listeners */
+enum ContentEvent {
+	ContentEvent_Created = 0,  //!< a file or directory exists at path, as do its parents
+	ContentEvent_Removed,      //!< nothing exists at path, or under it if a directory
+	ContentEvent_Changed,      //!< the file at path was written or its attributes changed
+	ContentEvent_Watched,      //!< all entries of directory path are reported, and changes will be
+	ContentEvent_Lost          //!< changes may have been missed, so all reported are forgotten
+};
+
+/**
+ * Listener to changes to the content tree. It is called by
+ * the watching thread and by request threads, so it must be
+ * thread-safe.
+ *
+ * @param event the change
+ * @param path the file path, or NULL if ContentEvent_Lost
+ * @param isDir true if the path is of a directory
+ * @param sb the status of the path, not following a symbolic
+ *   link, or NULL if not known
+ */
+typedef void (*ContentListener)(enum ContentEvent event, const char *path, bool isDir, const struct stat *sb);
+
+/**
+ * Add a listener to changes to the content tree. Listeners
+ * are added before the watching starts.
+ *
+ * @param listener the listener
+ * @return true if added, false if too many listeners
+ */
+bool addContentListener(ContentListener listener);
+
+/**
+ * Start watching the content tree if there are listeners.
+ * A thread scans the tree, reporting its entries, and then
+ * reports changes until the server stops. Changes are only
+ * reported while the operating system can watch the tree.
+ *
+ * @return true if successful, false with errno set if error
+ */
+bool startContentWatch(void);
+
+/**
+ * Returns the length of a path in the content tree without
+ * a trailing '/', if it has no empty, "." or ".." segments.
+ * Only such paths match the paths reported to listeners.
+ *
+ * @param path the path
+ * @return the length, or 0 if not such a path
+ */
+size_t contentPathLen(const char *path);
+
+/**
+ * Report a change to the content tree made by a request,
+ * before the request is answered. The change is reported
+ * again by the watching thread once it is seen.
+ *
+ * @param event ContentEvent_Created or ContentEvent_Removed
+ * @param path the file path
+ * @param isDir true if the path is of a directory
+ */
+void reportContentChange(enum ContentEvent event, const char *path, bool isDir);
+
+#endif /* CONTENT_WATCH_H_ */
@@ -0,0 +1,486 @@
+/*
+ * coroutine.c
+ *
+ * Functions that implement stackful coroutines multiplexed
+ * over an event loop, one scheduler per thread.
+ *
+ * Each coroutine runs on a small mmap'd stack with a guard
+ * page below it, so a stack overflow faults instead of
+ * corrupting a neighbor. Only touched stack pages are
+ * resident, and stacks of finished coroutines are reused.
+ *
+ *  @since 2026-10-18
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "coroutine.h"
+
+#if defined(__linux__)
+#include <ucontext.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+
+/** maximum events handled per epoll_wait() */
+#define CO_MAX_EVENTS 64
+
+/** A coroutine and its stack */
+typedef struct Coroutine {
+	ucontext_t context;         /** saved registers and stack */
+	void *stack;                /** stack mapping, guard page first */
+	size_t mapSize;             /** size of the stack mapping */
+	void (*fn)(void *);         /** coroutine function */
+	void *arg;                  /** argument to the function */
+	struct Coroutine *next;     /** next in ready or free list */
+	int waitFd;                 /** descriptor awaited with a timeout or -1 */
+	bool timedOut;              /** true if the wait timed out */
+	long long deadline;         /** time the wait times out in ms */
+	struct Coroutine *timerPrev;/** previous in timer list */
+	struct Coroutine *timerNext;/** next in timer list */
+} Coroutine;
+
+/** A coroutine scheduler */
+struct CoScheduler {
+	int epoll_fd;               /** readiness of awaited descriptors */
+	ucontext_t loopContext;     /** context of coRun() */
+	Coroutine *current;         /** running coroutine */
+	Coroutine *readyFront;      /** first coroutine ready to run */
+	Coroutine *readyRear;       /** last coroutine ready to run */
+	Coroutine *freeList;        /** finished coroutines for reuse */
+	Coroutine *finished;        /** coroutine that just returned */
+	Coroutine *timerFront;      /** wait with the earliest deadline */
+	Coroutine *timerRear;       /** wait with the latest deadline */
+	size_t stackSize;           /** usable stack size */
+	size_t count;               /** live coroutines */
+	threadpool pool;            /** pool for coOffload() */
+	thpool_reactor reactor;     /** completions of coOffload() */
+};
+
+/** scheduler running on this thread */
+static __thread CoScheduler *currentScheduler = NULL;
+
+/**
+ * Append a coroutine to the ready list.
+ * @param sched the scheduler
+ * @param co the coroutine
+ */
+static void makeReady(CoScheduler *sched, Coroutine *co) {
+	co->next = NULL;
+	if (sched->readyRear == NULL) {
+		sched->readyFront = co;
+	} else {
+		sched->readyRear->next = co;
+	}
+	sched->readyRear = co;
+}
+
+/**
+ * Returns the monotonic time in milliseconds.
+ * @return the time
+ */
+static long long nowMillis(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000LL + ts.tv_nsec/1000000;
+}
+
+/**
+ * Add a waiting coroutine to the timer list, which is
+ * kept in deadline order. Waits mostly share a timeout,
+ * so the search starts from the latest deadline.
+ * @param sched the scheduler
+ * @param co the coroutine
+ */
+static void addTimer(CoScheduler *sched, Coroutine *co) {
+	Coroutine *prev = sched->timerRear;
+	while ((prev != NULL) && (prev->deadline > co->deadline)) {
+		prev = prev->timerPrev;
+	}
+	co->timerPrev = prev;
+	co->timerNext = (prev == NULL) ? sched->timerFront : prev->timerNext;
+	if (co->timerNext == NULL) {
+		sched->timerRear = co;
+	} else {
+		co->timerNext->timerPrev = co;
+	}
+	if (prev == NULL) {
+		sched->timerFront = co;
+	} else {
+		prev->timerNext = co;
+	}
+}
+
+/**
+ * Remove a coroutine from the timer list.
+ * @param sched the scheduler
+ * @param co the coroutine
+ */
+static void removeTimer(CoScheduler *sched, Coroutine *co) {
+	if (co->timerPrev == NULL) {
+		sched->timerFront = co->timerNext;
+	} else {
+		co->timerPrev->timerNext = co->timerNext;
+	}
+	if (co->timerNext == NULL) {
+		sched->timerRear = co->timerPrev;
+	} else {
+		co->timerNext->timerPrev = co->timerPrev;
+	}
+	co->timerPrev = co->timerNext = NULL;
+	co->waitFd = -1;
+}
+
+/**
+ * Switch from the running coroutine back to the loop.
+ * @param sched the scheduler
+ */
+static void suspend(CoScheduler *sched) {
+	swapcontext(&sched->current->context, &sched->loopContext);
+}
+
+/**
+ * Entry point of coroutines: runs the function, then
+ * returns to the loop through the context link.
+ */
+static void trampoline(void) {
+	CoScheduler *sched = currentScheduler;
+	Coroutine *co = sched->current;
+	co->fn(co->arg);
+	sched->finished = co;
+}
+
+/**
+ * Create a coroutine scheduler for the calling thread.
+ *
+ * @param stackSize the stack size of its coroutines
+ * @param pool thread pool for coOffload(), or NULL
+ * @return the scheduler or NULL if unavailable
+ */
+CoScheduler *newCoScheduler(size_t stackSize, threadpool pool) {
+	CoScheduler *sched = calloc(1, sizeof(CoScheduler));
+	if (sched == NULL) {
+		return NULL;
+	}
+	long pageSize = sysconf(_SC_PAGESIZE);
+	sched->stackSize = (stackSize + pageSize-1) / pageSize * pageSize;
+	sched->pool = pool;
+
+	sched->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (sched->epoll_fd < 0) {
+		free(sched);
+		return NULL;
+	}
+
+	// completions of offloaded calls wake the loop
+	if (pool != NULL) {
+		sched->reactor = thpool_reactor_init();
+		struct epoll_event ev = {.events = EPOLLIN, .data.ptr = sched->reactor};
+		if (   (sched->reactor == NULL)
+			|| (epoll_ctl(sched->epoll_fd, EPOLL_CTL_ADD, thpool_reactor_fd(sched->reactor), &ev) != 0)) {
+			deleteCoScheduler(sched);
+			return NULL;
+		}
+	}
+	return sched;
+}
+
+/**
+ * Delete a coroutine scheduler without coroutines.
+ *
+ * @param sched the scheduler
+ */
+void deleteCoScheduler(CoScheduler *sched) {
+	while (sched->freeList != NULL) {
+		Coroutine *co = sched->freeList;
+		sched->freeList = co->next;
+		munmap(co->stack, co->mapSize);
+		free(co);
+	}
+	thpool_reactor_destroy(sched->reactor);
+	close(sched->epoll_fd);
+	free(sched);
+}
+
+/**
+ * Start a coroutine. It first runs when the scheduler
+ * next runs ready coroutines.
+ *
+ * @param sched the scheduler
+ * @param fn the coroutine function
+ * @param arg the argument to the function
+ * @return true if started, false if no stack is available
+ */
+bool coSpawn(CoScheduler *sched, void (*fn)(void *), void *arg) {
+	Coroutine *co = sched->freeList;
+	if (co != NULL) {
+		sched->freeList = co->next;
+	} else {
+		co = malloc(sizeof(Coroutine));
+		if (co == NULL) {
+			return false;
+		}
+		// stack grows down: guard page at the low end
+		long pageSize = sysconf(_SC_PAGESIZE);
+		co->mapSize = sched->stackSize + pageSize;
+		co->stack = mmap(NULL, co->mapSize, PROT_READ|PROT_WRITE,
+						 MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+		if (co->stack == MAP_FAILED) {
+			free(co);
+			return false;
+		}
+		mprotect(co->stack, pageSize, PROT_NONE);
+	}
+
+	getcontext(&co->context);
+	co->context.uc_stack.ss_sp = co->stack;
+	co->context.uc_stack.ss_size = co->mapSize;
+	co->context.uc_link = &sched->loopContext;
+	makecontext(&co->context, trampoline, 0);
+	co->fn = fn;
+	co->arg = arg;
+	co->waitFd = -1;
+	co->timerPrev = co->timerNext = NULL;
+
+	sched->count++;
+	makeReady(sched, co);
+	return true;
+}
+
+/**
+ * Run coroutines of a scheduler on the calling thread.
+ * Returns once no coroutines are left.
+ *
+ * @param sched the scheduler
+ */
+void coRun(CoScheduler *sched) {
+	currentScheduler = sched;
+	struct epoll_event events[CO_MAX_EVENTS];
+
+	while (sched->count > 0) {
+		// run coroutines until all wait
+		while (sched->readyFront != NULL) {
+			Coroutine *co = sched->readyFront;
+			sched->readyFront = co->next;
+			if (sched->readyFront == NULL) {
+				sched->readyRear = NULL;
+			}
+
+			sched->current = co;
+			swapcontext(&sched->loopContext, &co->context);
+			sched->current = NULL;
+
+			// keep stack of finished coroutine for reuse
+			if (sched->finished != NULL) {
+				sched->finished->next = sched->freeList;
+				sched->freeList = sched->finished;
+				sched->finished = NULL;
+				sched->count--;
+			}
+		}
+		if (sched->count == 0) {
+			break;
+		}
+
+		// wake coroutines whose descriptors are ready
+		int timeout = -1;
+		if (sched->timerFront != NULL) {
+			long long wait = sched->timerFront->deadline - nowMillis();
+			timeout = (wait < 0) ? 0 : (int)wait;
+		}
+		int nevents = epoll_wait(sched->epoll_fd, events, CO_MAX_EVENTS, timeout);
+		for (int i = 0; i < nevents; i++) {
+			if (events[i].data.ptr == sched->reactor) {
+				thpool_reactor_dispatch(sched->reactor);
+			} else {
+				Coroutine *co = events[i].data.ptr;
+				if (co->waitFd >= 0) {
+					removeTimer(sched, co);
+				}
+				makeReady(sched, co);
+			}
+		}
+
+		// wake coroutines whose waits timed out; removing the
+		// descriptor keeps a later event from waking them again
+		long long now = nowMillis();
+		while ((sched->timerFront != NULL) && (sched->timerFront->deadline <= now)) {
+			Coroutine *co = sched->timerFront;
+			epoll_ctl(sched->epoll_fd, EPOLL_CTL_DEL, co->waitFd, NULL);
+			removeTimer(sched, co);
+			co->timedOut = true;
+			makeReady(sched, co);
+		}
+	}
+	currentScheduler = NULL;
+}
+
+/**
+ * Returns the scheduler running on the calling thread.
+ *
+ * @return the scheduler or NULL if none
+ */
+CoScheduler *currentCoScheduler(void) {
+	return currentScheduler;
+}
+
+/**
+ * Returns true if called from a coroutine.
+ *
+ * @return true if in a coroutine
+ */
+bool inCoroutine(void) {
+	return (currentScheduler != NULL) && (currentScheduler->current != NULL);
+}
+
+/**
+ * Wait until a descriptor is ready for poll events or
+ * a timeout expires. A coroutine yields to others while
+ * waiting; outside a coroutine the thread blocks in poll().
+ *
+ * @param fd the descriptor
+ * @param events POLLIN and/or POLLOUT
+ * @param timeoutMs the timeout in milliseconds, or -1 for none
+ * @return 1 if ready, 0 if timed out, -1 if error
+ */
+int coPollFd(int fd, short events, int timeoutMs) {
+	if (!inCoroutine()) {
+		struct pollfd pfd = {.fd = fd, .events = events};
+		int n;
+		while ((n = poll(&pfd, 1, timeoutMs)) < 0) {
+			if (errno != EINTR) {
+				return -1;
+			}
+		}
+		return (n > 0) ? 1 : 0;
+	}
+
+	// one-shot registration: the coroutine is woken once
+	CoScheduler *sched = currentScheduler;
+	Coroutine *co = sched->current;
+	struct epoll_event ev = {.events = events|EPOLLONESHOT, .data.ptr = co};
+	if (epoll_ctl(sched->epoll_fd, EPOLL_CTL_MOD, fd, &ev) != 0) {
+		if (   (errno != ENOENT)
+			|| (epoll_ctl(sched->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)) {
+			return -1;
+		}
+	}
+	co->timedOut = false;
+	if (timeoutMs >= 0) {
+		co->waitFd = fd;
+		co->deadline = nowMillis() + timeoutMs;
+		addTimer(sched, co);
+	}
+	suspend(sched);
+	return co->timedOut ? 0 : 1;
+}
+
+/**
+ * Wait until a descriptor is ready for poll events. A
+ * coroutine yields to others while waiting; outside a
+ * coroutine the thread blocks in poll().
+ *
+ * @param fd the descriptor
+ * @param events POLLIN and/or POLLOUT
+ * @return true if ready, false if error
+ */
+bool coWaitFd(int fd, short events) {
+	return coPollFd(fd, events, -1) > 0;
+}
+
+/** An offloaded call and the coroutine waiting for it */
+typedef struct Offload {
+	void *(*fn)(void *);        /** the blocking function */
+	void *arg;                  /** argument to the function */
+	void *result;               /** result of the function */
+	CoScheduler *sched;         /** scheduler of the coroutine */
+	Coroutine *co;              /** the waiting coroutine */
+} Offload;
+
+/**
+ * Run an offloaded call on a pool thread.
+ * @param arg the offload
+ * @return the result of the call
+ */
+static void *runOffload(void *arg) {
+	Offload *offload = arg;
+	return offload->fn(offload->arg);
+}
+
+/**
+ * Resume the coroutine of a completed offload
+ * on the thread of its scheduler.
+ * @param result the result of the call
+ * @param arg the offload
+ */
+static void completeOffload(void *result, void *arg) {
+	Offload *offload = arg;
+	offload->result = result;
+	makeReady(offload->sched, offload->co);
+}
+
+/**
+ * Run a blocking function on the scheduler's thread pool,
+ * yielding to other coroutines until it returns. Outside a
+ * coroutine, or without a pool, the function runs directly.
+ *
+ * @param fn the function
+ * @param arg the argument to the function
+ * @return the result of the function
+ */
+void *coOffload(void *(*fn)(void *), void *arg) {
+	if (!inCoroutine() || (currentScheduler->pool == NULL)) {
+		return fn(arg);
+	}
+
+	CoScheduler *sched = currentScheduler;
+	Offload offload = {.fn = fn, .arg = arg, .sched = sched, .co = sched->current};
+	thpool_future future = thpool_submit(sched->pool, runOffload, &offload,
+										 sched->reactor, completeOffload);
+	if (future == NULL) {
+		return fn(arg);
+	}
+	thpool_future_free(future);
+	suspend(sched);
+	return offload.result;
+}
+
+#else /* !__linux__ */
+
+CoScheduler *newCoScheduler(size_t stackSize, threadpool pool) {
+	return NULL;  // needs epoll
+}
+
+void deleteCoScheduler(CoScheduler *sched) {}
+
+bool coSpawn(CoScheduler *sched, void (*fn)(void *), void *arg) {
+	return false;
+}
+
+void coRun(CoScheduler *sched) {}
+
+CoScheduler *currentCoScheduler(void) {
+	return NULL;
+}
+
+bool inCoroutine(void) {
+	return false;
+}
+
+int coPollFd(int fd, short events, int timeoutMs) {
+	struct pollfd pfd = {.fd = fd, .events = events};
+	int n = poll(&pfd, 1, timeoutMs);
+	return (n < 0) ? -1 : (n > 0);
+}
+
+bool coWaitFd(int fd, short events) {
+	return coPollFd(fd, events, -1) > 0;
+}
+
+void *coOffload(void *(*fn)(void *), void *arg) {
+	return fn(arg);
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,108 @@
+/*
+ * coroutine.h
+ *
+ * Functions that implement stackful coroutines multiplexed
+ * over an event loop, one scheduler per thread.
+ *
+ *  @since 2026-10-18
+ */
+
+#ifndef COROUTINE_H_
+#define COROUTINE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <poll.h>
+#include "thpool.h"
+
+/** default and smallest stack size of a coroutine; serving a
+ *  PUT of ranges alone uses over 32K of stack */
+#define CO_STACK_SIZE (64*1024)
+
+/** Declaration of CoScheduler as opaque type */
+typedef struct CoScheduler CoScheduler;
+
+/**
+ * Create a coroutine scheduler for the calling thread.
+ *
+ * @param stackSize the stack size of its coroutines
+ * @param pool thread pool for coOffload(), or NULL
+ * @return the scheduler or NULL if unavailable
+ */
+CoScheduler *newCoScheduler(size_t stackSize, threadpool pool);
+
+/**
+ * Delete a coroutine scheduler without coroutines.
+ *
+ * @param sched the scheduler
+ */
+void deleteCoScheduler(CoScheduler *sched);
+
+/**
+ * Start a coroutine. It first runs when the scheduler
+ * next runs ready coroutines.
+ *
+ * @param sched the scheduler
+ * @param fn the coroutine function
+ * @param arg the argument to the function
+ * @return true if started, false if no stack is available
+ */
+bool coSpawn(CoScheduler *sched, void (*fn)(void *), void *arg);
+
+/**
+ * Run coroutines of a scheduler on the calling thread.
+ * Returns once no coroutines are left.
+ *
+ * @param sched the scheduler
+ */
+void coRun(CoScheduler *sched);
+
+/**
+ * Returns the scheduler running on the calling thread.
+ *
+ * @return the scheduler or NULL if none
+ */
+CoScheduler *currentCoScheduler(void);
+
+/**
+ * Returns true if called from a coroutine.
+ *
+ * @return true if in a coroutine
+ */
+bool inCoroutine(void);
+
+/**
+ * Wait until a descriptor is ready for poll events or
+ * a timeout expires. A coroutine yields to others while
+ * waiting; outside a coroutine the thread blocks in poll().
+ *
+ * @param fd the descriptor
+ * @param events POLLIN and/or POLLOUT
+ * @param timeoutMs the timeout in milliseconds, or -1 for none
+ * @return 1 if ready, 0 if timed out, -1 if error
+ */
+int coPollFd(int fd, short events, int timeoutMs);
+
+/**
+ * Wait until a descriptor is ready for poll events. A
+ * coroutine yields to others while waiting; outside a
+ * coroutine the thread blocks in poll().
+ *
+ * @param fd the descriptor
+ * @param events POLLIN and/or POLLOUT
+ * @return true if ready, false if error
+ */
+bool coWaitFd(int fd, short events);
+
+/**
+ * Run a blocking function on the scheduler's thread pool,
+ * yielding to other coroutines until it returns. Outside a
+ * coroutine, or without a pool, the function runs directly.
+ *
+ * @param fn the function
+ * @param arg the argument to the function
+ * @return the result of the function
+ */
+void *coOffload(void *(*fn)(void *), void *arg);
+
+#endif /* COROUTINE_H_ */
@@ -0,0 +1,646 @@
+/*
+ * dir_listing.c
+ *
+ * Functions that render HTML and JSON listings of
+ * directories and cache them until their directories change.
+ *
+ * Entries are read in large batches with getdents64() and
+ * each is examined with fstatat() relative to the open
+ * directory, so no paths are built or resolved per entry.
+ * A listing is rendered once into a growing buffer, and
+ * kept with its gzip encoding for reuse by later requests
+ * while the inode and modification time of the directory
+ * stay the same. The entries are kept with it too, and
+ * each order of them for JSON listings is sorted once
+ * when first asked for, so a page is a slice of an index.
+ * Changes to the files in a directory do not change the
+ * directory, so sizes and times shown for entries may be
+ * as old as the listing.
+ *
+ *  @since 2026-10-18
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/param.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#include <zlib.h>
+#include "dir_listing.h"
+#include "file_util.h"
+#include "http_server.h"
+#include "http_util.h"
+#include "string_util.h"
+#include "time_util.h"
+
+/** size of the buffer for reading directory entries */
+#define DIR_READ_SIZE (32*1024)
+
+/** number of entries rendered between flushes */
+#define DIR_RENDER_BATCH 256
+
+/** size of the blocks of the arena for entry names */
+#define DIR_NAMES_BLOCK_SIZE (64*1024)
+
+/** A listing rendered for a directory */
+struct DirListing {
+	char *path;                 /** the directory path */
+	dev_t dev;                  /** device of the directory */
+	ino_t ino;                  /** inode of the directory */
+	struct timespec mtime;      /** modification time of the directory */
+	char *html;                 /** the rendered listing */
+	size_t htmlLen;             /** length of the listing */
+	char *gzip;                 /** gzip encoding of the listing, or NULL */
+	size_t gzipLen;             /** length of the gzip encoding */
+	Arena *names;               /** names of the entries */
+	VArray *entries;            /** the entries */
+	const DirEntry **sorted[DirSort_Count];  /** entries in each order, or NULL */
+	size_t slot;                /** cache slot of the directory */
+	int refs;                   /** references, including the cache */
+};
+
+#if defined(__linux__)
+/** Entry returned by getdents64() */
+struct linux_dirent64 {
+	uint64_t d_ino;             /** inode number */
+	int64_t d_off;              /** offset of the next entry */
+	unsigned short d_reclen;    /** length of this entry */
+	unsigned char d_type;       /** file type */
+	char d_name[];              /** file name */
+};
+#endif
+
+/** Reads the entries of an open directory */
+struct DirReader {
+	int fd;                     /** the directory descriptor */
+	bool failed;                /** reading the entries failed */
+#if defined(__linux__)
+	size_t pos;                 /** position of the next entry in buf */
+	size_t len;                 /** length of the entries in buf */
+	char buf[DIR_READ_SIZE] __attribute__((aligned(8)));  /** the entries read */
+#else
+	DIR *dir;                   /** the directory stream */
+#endif
+};
+
+/** the cached listings by directory path hash */
+static struct {
+	pthread_mutex_t mutex;      /** guards the slot and references */
+	DirListing *listing;        /** the listing, or NULL */
+} slots[DIR_CACHE_SLOTS];
+
+/** guards creating the cache */
+static pthread_once_t slotsOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Create the locks of the cache.
+ */
+static void initSlots(void) {
+	for (int i = 0; i < DIR_CACHE_SLOTS; i++) {
+		pthread_mutex_init(&slots[i].mutex, NULL);
+	}
+}
+
+/**
+ * Returns the cache slot of a directory from the FNV-1a
+ * hash of its path.
+ * @param dirPath the directory path
+ * @return the slot
+ */
+static size_t pathSlot(const char *dirPath) {
+	pthread_once(&slotsOnce, initSlots);
+	return strhash(dirPath, SIZE_MAX, false) % DIR_CACHE_SLOTS;
+}
+
+/**
+ * Free a listing with no more references.
+ * @param listing the listing
+ */
+static void freeDirListing(DirListing *listing) {
+	free(listing->path);
+	free(listing->html);
+	free(listing->gzip);
+	for (int sort = 0; sort < DirSort_Count; sort++) {
+		free(listing->sorted[sort]);
+	}
+	deleteVArray(listing->entries);
+	deleteArena(listing->names);
+	free(listing);
+}
+
+/**
+ * Find the cached listing of a directory that has not
+ * changed since it was rendered.
+ *
+ * @param dirPath the directory path
+ * @param sb the current status of the directory
+ * @return the listing, or NULL if none; release it with
+ *   releaseDirListing()
+ */
+DirListing *findDirListing(const char *dirPath, const struct stat *sb) {
+	size_t slot = pathSlot(dirPath);
+	pthread_mutex_lock(&slots[slot].mutex);
+	DirListing *listing = slots[slot].listing;
+	if (   (listing != NULL) && (strcmp(listing->path, dirPath) == 0)
+		&& (listing->dev == sb->st_dev) && (listing->ino == sb->st_ino)
+		&& (listing->mtime.tv_sec == sb->st_mtim.tv_sec)
+		&& (listing->mtime.tv_nsec == sb->st_mtim.tv_nsec)) {
+		listing->refs++;
+	} else {
+		listing = NULL;
+	}
+	pthread_mutex_unlock(&slots[slot].mutex);
+	return listing;
+}
+
+/**
+ * Release a listing found or rendered.
+ *
+ * @param listing the listing
+ */
+void releaseDirListing(DirListing *listing) {
+	pthread_mutex_lock(&slots[listing->slot].mutex);
+	bool unused = (--listing->refs == 0);
+	pthread_mutex_unlock(&slots[listing->slot].mutex);
+	if (unused) {
+		freeDirListing(listing);
+	}
+}
+
+/**
+ * Returns the HTML of a listing.
+ *
+ * @param listing the listing
+ * @param len the length of the HTML
+ * @return the HTML
+ */
+const char *getDirListingHtml(DirListing *listing, size_t *len) {
+	*len = listing->htmlLen;
+	return listing->html;
+}
+
+/**
+ * Compress some bytes in gzip format.
+ * @param data the bytes
+ * @param len the number of bytes
+ * @param gzipLen the length of the gzip encoding
+ * @return the gzip encoding, or NULL if error
+ */
+static char *gzipBytes(const char *data, size_t len, size_t *gzipLen) {
+	z_stream zs = {0};
+	// window bits over 15 select the gzip format
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		return NULL;
+	}
+	size_t bound = deflateBound(&zs, len);
+	char *gzip = malloc(bound);
+	zs.next_in = (Bytef*)data;
+	zs.avail_in = len;
+	zs.next_out = (Bytef*)gzip;
+	zs.avail_out = bound;
+	if ((gzip == NULL) || (deflate(&zs, Z_FINISH) != Z_STREAM_END)) {
+		free(gzip);
+		gzip = NULL;
+	}
+	*gzipLen = zs.total_out;
+	deflateEnd(&zs);
+	return gzip;
+}
+
+/**
+ * Returns the gzip encoding of the HTML of a listing,
+ * compressing it the first time.
+ *
+ * @param listing the listing
+ * @param len the length of the encoding
+ * @return the encoding, or NULL if not available
+ */
+const char *getDirListingGzip(DirListing *listing, size_t *len) {
+	pthread_mutex_t *mutex = &slots[listing->slot].mutex;
+	pthread_mutex_lock(mutex);
+	char *gzip = listing->gzip;
+	pthread_mutex_unlock(mutex);
+	if (gzip == NULL) {
+		// the HTML does not change, so it is compressed unlocked
+		size_t gzipLen;
+		if ((gzip = gzipBytes(listing->html, listing->htmlLen, &gzipLen)) == NULL) {
+			return NULL;
+		}
+		pthread_mutex_lock(mutex);
+		if (listing->gzip == NULL) {
+			listing->gzip = gzip;
+			listing->gzipLen = gzipLen;
+		} else {  // compressed meanwhile by another request
+			free(gzip);
+			gzip = listing->gzip;
+		}
+		pthread_mutex_unlock(mutex);
+	}
+	*len = listing->gzipLen;
+	return gzip;
+}
+
+/**
+ * Compare entries by name.
+ * @param a pointer to an entry
+ * @param b pointer to another entry
+ * @return negative, zero, or positive by order
+ */
+static int compareNames(const void *a, const void *b) {
+	const DirEntry *e1 = *(const DirEntry**)a, *e2 = *(const DirEntry**)b;
+	return strcmp(e1->name, e2->name);
+}
+
+/**
+ * Compare entries by modification time, then name.
+ * @param a pointer to an entry
+ * @param b pointer to another entry
+ * @return negative, zero, or positive by order
+ */
+static int compareMtimes(const void *a, const void *b) {
+	const DirEntry *e1 = *(const DirEntry**)a, *e2 = *(const DirEntry**)b;
+	if (e1->mtime.tv_sec != e2->mtime.tv_sec) {
+		return (e1->mtime.tv_sec < e2->mtime.tv_sec) ? -1 : 1;
+	}
+	if (e1->mtime.tv_nsec != e2->mtime.tv_nsec) {
+		return (e1->mtime.tv_nsec < e2->mtime.tv_nsec) ? -1 : 1;
+	}
+	return strcmp(e1->name, e2->name);
+}
+
+/**
+ * Compare entries by size, then name.
+ * @param a pointer to an entry
+ * @param b pointer to another entry
+ * @return negative, zero, or positive by order
+ */
+static int compareSizes(const void *a, const void *b) {
+	const DirEntry *e1 = *(const DirEntry**)a, *e2 = *(const DirEntry**)b;
+	if (e1->size != e2->size) {
+		return (e1->size < e2->size) ? -1 : 1;
+	}
+	return strcmp(e1->name, e2->name);
+}
+
+/**
+ * Returns the entries of a listing in an order. The order
+ * is sorted the first time, and kept with the listing.
+ *
+ * @param listing the listing
+ * @param sort the order
+ * @param count the number of entries
+ * @return the entries in order, or NULL if no space
+ */
+const DirEntry **getDirListingEntries(DirListing *listing, enum DirSort sort, size_t *count) {
+	static int (*const compares[DirSort_Count])(const void*, const void*) = {
+		compareNames, compareMtimes, compareSizes
+	};
+	*count = sizeVArray(listing->entries);
+	pthread_mutex_t *mutex = &slots[listing->slot].mutex;
+	pthread_mutex_lock(mutex);
+	const DirEntry **sorted = listing->sorted[sort];
+	pthread_mutex_unlock(mutex);
+	if (sorted == NULL) {
+		// the entries do not change, so they are sorted unlocked
+		if ((sorted = malloc((*count + 1) * sizeof(DirEntry*))) == NULL) {
+			return NULL;
+		}
+		for (size_t i = 0; i < *count; i++) {
+			sorted[i] = elementAtVArray(listing->entries, i);
+		}
+		qsort(sorted, *count, sizeof(DirEntry*), compares[sort]);
+		pthread_mutex_lock(mutex);
+		if (listing->sorted[sort] == NULL) {
+			listing->sorted[sort] = sorted;
+		} else {  // sorted meanwhile by another request
+			free(sorted);
+			sorted = listing->sorted[sort];
+		}
+		pthread_mutex_unlock(mutex);
+	}
+	return sorted;
+}
+
+/**
+ * Returns the name of the next entry of a directory.
+ * @param reader the reader
+ * @return the entry name, or NULL if no more or error
+ */
+static const char *nextDirEntry(DirReader *reader) {
+#if defined(__linux__)
+	if (reader->pos >= reader->len) {
+		long n = syscall(SYS_getdents64, reader->fd, reader->buf, sizeof(reader->buf));
+		if (n <= 0) {
+			reader->failed = (n < 0);
+			return NULL;
+		}
+		reader->pos = 0;
+		reader->len = n;
+	}
+	struct linux_dirent64 *entry = (struct linux_dirent64*)(reader->buf + reader->pos);
+	reader->pos += entry->d_reclen;
+	return entry->d_name;
+#else
+	struct dirent *entry = readdir(reader->dir);
+	return (entry == NULL) ? NULL : entry->d_name;
+#endif
+}
+
+/**
+ * Write a file name to a stream escaped for a URI path.
+ * @param ostream the stream
+ * @param name the file name
+ */
+static void writeHref(FILE *ostream, const char *name) {
+	static const char hex[] = "0123456789ABCDEF";
+	for (const unsigned char *p = (const unsigned char*)name; *p != '\0'; p++) {
+		if (   ((*p >= 'a') && (*p <= 'z')) || ((*p >= 'A') && (*p <= 'Z'))
+			|| ((*p >= '0') && (*p <= '9')) || (strchr("-._~", *p) != NULL)) {
+			fputc(*p, ostream);
+		} else {
+			fputc('%', ostream);
+			fputc(hex[*p >> 4], ostream);
+			fputc(hex[*p & 0xF], ostream);
+		}
+	}
+}
+
+/**
+ * Start rendering the listing of a directory.
+ *
+ * @param render the rendering
+ * @param dirFd descriptor of the open directory, owned by the rendering
+ * @param uri URI of the directory
+ * @return true if successful, false if error
+ */
+bool startDirRender(DirRender *render, int dirFd, const char *uri) {
+	*render = (DirRender){.uri = uri};
+	render->reader = malloc(sizeof(DirReader));
+	if (render->reader == NULL) {
+		close(dirFd);
+		return false;
+	}
+	*render->reader = (DirReader){.fd = dirFd};
+#if !defined(__linux__)
+	if ((render->reader->dir = fdopendir(dirFd)) == NULL) {
+		close(dirFd);
+		free(render->reader);
+		return false;
+	}
+#endif
+	render->names = newArena(DIR_NAMES_BLOCK_SIZE);
+	render->entries = newVArray(sizeof(DirEntry), DIR_RENDER_BATCH);
+	render->out = open_memstream(&render->html, &render->htmlLen);
+	if ((render->names == NULL) || (render->entries == NULL) || (render->out == NULL)) {
+		endDirRender(render, NULL, NULL);
+		return false;
+	}
+
+	FILE *out = render->out;
+	fputs("<html>\n"
+		  "<head>\n"
+		  "  <title>index of ", out);
+	writeHtml(out, uri);
+	fputs("</title>\n"
+		  "</head>\n"
+		  "<body>\n"
+		  "  <h1>Index of ", out);
+	writeHtml(out, uri);
+	fputs("</h1>\n"
+		  "  <table>\n"
+		  "  <tr>\n"
+		  "    <th valign=\"top\"></th>\n"
+		  "    <th>Name</th>\n"
+		  "    <th>Last modified</th>\n"
+		  "    <th>Size</th>\n"
+		  "    <th>Description</th>\n"
+		  "  </tr>\n"
+		  "  <tr>\n"
+		  "    <td colspan=\"5\"><hr></td>\n"
+		  "  </tr>\n", out);
+	return fflush(out) == 0;
+}
+
+/**
+ * Render the next entries of a listing, adding them to
+ * render->html.
+ *
+ * @param render the rendering
+ * @return true if successful, false if error
+ */
+bool renderDirEntries(DirRender *render) {
+	FILE *out = render->out;
+	DirReader *reader = render->reader;
+	bool isRoot = (strcmp(render->uri, "/") == 0);
+	for (int n = 0; n < DIR_RENDER_BATCH; n++) {
+		const char *name = nextDirEntry(reader);
+		if (name == NULL) {
+			if (reader->failed) {
+				return false;
+			}
+			fputs("  <tr><td colspan=\"5\"><hr></td></tr>\n"
+				  "  </table>\n"
+				  "</body>\n"
+				  "</html>", out);
+			render->done = true;
+			break;
+		}
+		// hidden files include those of uploads in progress
+		bool isParent = (strcmp(name, "..") == 0);
+		if ((*name == '.') && (!isParent || isRoot)) {
+			continue;
+		}
+		struct stat sb;
+		if (fstatat(reader->fd, name, &sb, 0) != 0) {
+			continue;  // removed since it was read
+		}
+		bool isDir = S_ISDIR(sb.st_mode);
+		if (!isParent) {
+			DirEntry entry = {
+				.name = strdupArena(render->names, name), .mtime = sb.st_mtim,
+				.size = sb.st_size, .isDir = isDir
+			};
+			if ((entry.name == NULL) || (appendVArray(render->entries, &entry) == NULL)) {
+				return false;
+			}
+		}
+
+		char mtime[MAXBUF];
+		milliTimeToRFC_1123_Date_Time(sb.st_mtim.tv_sec, mtime);
+		fprintf(out, "  <tr>\n"
+					 "    <td>%s</td>\n"
+					 "    <td><a href=\"",
+				isParent ? "&#x23ce" : isDir ? "&#x1F4C1;" : "");
+		writeHref(out, name);
+		fputs(isDir ? "/\">" : "\">", out);
+		if (isParent) {
+			fputs("Parent Directory", out);
+		} else {
+			writeHtml(out, name);
+		}
+		fprintf(out, "</a></td>\n"
+					 "    <td align=\"right\">%s</td>\n"
+					 "    <td align=\"right\">%lu</td>\n"
+					 "    <td></td>\n"
+					 "  </tr>\n",
+				mtime, (unsigned long)sb.st_size);
+	}
+	return fflush(out) == 0;
+}
+
+/**
+ * End rendering a listing, caching it if it is complete.
+ *
+ * @param render the rendering
+ * @param dirPath the directory path
+ * @param sb the status of the directory when rendering started
+ * @return the listing if complete, or NULL; release it with
+ *   releaseDirListing()
+ */
+DirListing *endDirRender(DirRender *render, const char *dirPath, const struct stat *sb) {
+	bool complete = render->done && (render->out != NULL) && (fclose(render->out) == 0);
+	if (!render->done && (render->out != NULL)) {
+		fclose(render->out);
+	}
+#if defined(__linux__)
+	close(render->reader->fd);
+#else
+	closedir(render->reader->dir);
+#endif
+	free(render->reader);
+	DirListing *listing = complete ? malloc(sizeof(DirListing)) : NULL;
+	if (listing == NULL) {
+		free(render->html);
+		if (render->entries != NULL) {
+			deleteVArray(render->entries);
+		}
+		if (render->names != NULL) {
+			deleteArena(render->names);
+		}
+		return NULL;
+	}
+	*listing = (DirListing){
+		.path = strdup(dirPath), .dev = sb->st_dev, .ino = sb->st_ino,
+		.mtime = sb->st_mtim, .html = render->html, .htmlLen = render->htmlLen,
+		.names = render->names, .entries = render->entries,
+		.slot = pathSlot(dirPath), .refs = 1
+	};
+	if (listing->path == NULL) {
+		freeDirListing(listing);
+		return NULL;
+	}
+
+	// a directory changed within the last second may change again
+	// without a new modification time, so it is not cached yet
+	time_t now = time(NULL);
+	if ((listing->htmlLen > DIR_CACHE_MAX_SIZE) || (sb->st_mtim.tv_sec >= now - 1)) {
+		return listing;
+	}
+	pthread_mutex_lock(&slots[listing->slot].mutex);
+	DirListing *old = slots[listing->slot].listing;
+	slots[listing->slot].listing = listing;
+	listing->refs++;
+	bool unused = (old != NULL) && (--old->refs == 0);
+	pthread_mutex_unlock(&slots[listing->slot].mutex);
+	if (unused) {
+		freeDirListing(old);
+	}
+	return listing;
+}
+
+/**
+ * Find the listing of a directory, rendering it if it is
+ * not cached.
+ *
+ * @param dirPath the directory path
+ * @param dirFd descriptor of the open directory, closed when done
+ * @param uri URI of the directory
+ * @param sb the status of the directory
+ * @return the listing, or NULL if error; release it with
+ *   releaseDirListing()
+ */
+DirListing *loadDirListing(const char *dirPath, int dirFd, const char *uri, const struct stat *sb) {
+	DirListing *listing = findDirListing(dirPath, sb);
+	if (listing != NULL) {
+		close(dirFd);
+		return listing;
+	}
+	DirRender render;
+	if (!startDirRender(&render, dirFd, uri)) {
+		return NULL;
+	}
+	while (!render.done && renderDirEntries(&render)) {
+	}
+	return endDirRender(&render, dirPath, sb);
+}
+
+/**
+ * Write a string to a stream as a JSON string.
+ * @param out the stream
+ * @param text the string
+ */
+static void writeJsonString(FILE *out, const char *text) {
+	fputc('"', out);
+	for (const unsigned char *p = (const unsigned char*)text; *p != '\0'; p++) {
+		if ((*p == '"') || (*p == '\\')) {
+			fputc('\\', out);
+			fputc(*p, out);
+		} else if (*p < 0x20) {
+			fprintf(out, "\\u%04x", *p);
+		} else {
+			fputc(*p, out);
+		}
+	}
+	fputc('"', out);
+}
+
+/**
+ * Write a page of the entries of a listing as JSON. The
+ * cursor of the next page is the offset of its first entry
+ * in the order, and is omitted after the last page.
+ *
+ * @param out the stream
+ * @param listing the listing
+ * @param uri URI of the directory
+ * @param sort the order
+ * @param descending true for descending order
+ * @param cursor offset of the first entry of the page
+ * @param limit largest number of entries of the page
+ * @return true if successful, false if no space
+ */
+bool writeDirListingJson(FILE *out, DirListing *listing, const char *uri,
+						 enum DirSort sort, bool descending, size_t cursor, size_t limit) {
+	static const char *sortNames[DirSort_Count] = {"name", "mtime", "size"};
+	size_t count;
+	const DirEntry **entries = getDirListingEntries(listing, sort, &count);
+	if (entries == NULL) {
+		return false;
+	}
+	size_t end = (cursor >= count) ? count : cursor + MIN(limit, count - cursor);
+
+	fputs("{\"path\":", out);
+	writeJsonString(out, uri);
+	fprintf(out, ",\"total\":%zu,\"sort\":\"%s\",\"order\":\"%s\",\"entries\":[",
+			count, sortNames[sort], descending ? "desc" : "asc");
+	for (size_t i = cursor; i < end; i++) {
+		const DirEntry *entry = entries[descending ? count-1 - i : i];
+		fputs((i == cursor) ? "\n{\"name\":" : ",\n{\"name\":", out);
+		writeJsonString(out, entry->name);
+		fprintf(out, ",\"type\":\"%s\",\"size\":%lld,\"mtime\":%lld}",
+				entry->isDir ? "dir" : "file", (long long)entry->size,
+				(long long)entry->mtime.tv_sec);
+	}
+	fputs("]", out);
+	if (end < count) {
+		fprintf(out, ",\"next\":\"%zu\"", end);
+	}
+	fputs("}\n", out);
+	return true;
+}
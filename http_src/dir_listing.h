@@ -0,0 +1,170 @@
+/*
+ * dir_listing.h
+ *
+ * Functions that render HTML and JSON listings of
+ * directories and cache them until their directories change.
+ *
+ *  @since 2026-10-18
+ */
+
+#ifndef DIR_LISTING_H_
+#define DIR_LISTING_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include "arena.h"
+#include "varray.h"
+
+/** number of directories whose listings are cached */
+#define DIR_CACHE_SLOTS 64
+
+/** size of a listing being rendered from which it is streamed */
+#define DIR_STREAM_SIZE (64*1024)
+
+/** largest listing that is cached */
+#define DIR_CACHE_MAX_SIZE (16*1024*1024)
+
+/** Orders of the entries of a listing */
+enum DirSort {
+	DirSort_Name = 0,   //!< by name
+	DirSort_Mtime,      //!< by modification time, then name
+	DirSort_Size,       //!< by size, then name
+	DirSort_Count       //!< number of orders
+};
+
+/** An entry of a listing */
+typedef struct DirEntry {
+	const char *name;           /** the file name */
+	struct timespec mtime;      /** modification time */
+	off_t size;                 /** file size */
+	bool isDir;                 /** entry is a directory */
+} DirEntry;
+
+/** Declaration of DirListing as opaque type */
+typedef struct DirListing DirListing;
+
+/** Declaration of DirReader as opaque type */
+typedef struct DirReader DirReader;
+
+/** A listing being rendered */
+typedef struct DirRender {
+	DirReader *reader;      /** reads the directory entries */
+	const char *uri;        /** URI of the directory */
+	FILE *out;              /** stream the listing is rendered to */
+	Arena *names;           /** names of the entries */
+	VArray *entries;        /** the entries rendered so far */
+	char *html;             /** the listing rendered so far */
+	size_t htmlLen;         /** length of the listing rendered so far */
+	bool done;              /** all entries are rendered */
+} DirRender;
+
+/**
+ * Find the cached listing of a directory that has not
+ * changed since it was rendered.
+ *
+ * @param dirPath the directory path
+ * @param sb the current status of the directory
+ * @return the listing, or NULL if none; release it with
+ *   releaseDirListing()
+ */
+DirListing *findDirListing(const char *dirPath, const struct stat *sb);
+
+/**
+ * Release a listing found or rendered.
+ *
+ * @param listing the listing
+ */
+void releaseDirListing(DirListing *listing);
+
+/**
+ * Returns the HTML of a listing.
+ *
+ * @param listing the listing
+ * @param len the length of the HTML
+ * @return the HTML
+ */
+const char *getDirListingHtml(DirListing *listing, size_t *len);
+
+/**
+ * Returns the gzip encoding of the HTML of a listing,
+ * compressing it the first time.
+ *
+ * @param listing the listing
+ * @param len the length of the encoding
+ * @return the encoding, or NULL if not available
+ */
+const char *getDirListingGzip(DirListing *listing, size_t *len);
+
+/**
+ * Returns the entries of a listing in an order. The order
+ * is sorted the first time, and kept with the listing.
+ *
+ * @param listing the listing
+ * @param sort the order
+ * @param count the number of entries
+ * @return the entries in order, or NULL if no space
+ */
+const DirEntry **getDirListingEntries(DirListing *listing, enum DirSort sort, size_t *count);
+
+/**
+ * Find the listing of a directory, rendering it if it is
+ * not cached.
+ *
+ * @param dirPath the directory path
+ * @param dirFd descriptor of the open directory, closed when done
+ * @param uri URI of the directory
+ * @param sb the status of the directory
+ * @return the listing, or NULL if error; release it with
+ *   releaseDirListing()
+ */
+DirListing *loadDirListing(const char *dirPath, int dirFd, const char *uri, const struct stat *sb);
+
+/**
+ * Write a page of the entries of a listing as JSON. The
+ * cursor of the next page is the offset of its first entry
+ * in the order, and is omitted after the last page.
+ *
+ * @param out the stream
+ * @param listing the listing
+ * @param uri URI of the directory
+ * @param sort the order
+ * @param descending true for descending order
+ * @param cursor offset of the first entry of the page
+ * @param limit largest number of entries of the page
+ * @return true if successful, false if no space
+ */
+bool writeDirListingJson(FILE *out, DirListing *listing, const char *uri,
+						 enum DirSort sort, bool descending, size_t cursor, size_t limit);
+
+/**
+ * Start rendering the listing of a directory.
+ *
+ * @param render the rendering
+ * @param dirFd descriptor of the open directory, owned by the rendering
+ * @param uri URI of the directory
+ * @return true if successful, false if error
+ */
+bool startDirRender(DirRender *render, int dirFd, const char *uri);
+
+/**
+ * Render the next entries of a listing, adding them to
+ * render->html.
+ *
+ * @param render the rendering
+ * @return true if successful, false if error
+ */
+bool renderDirEntries(DirRender *render);
+
+/**
+ * End rendering a listing, caching it if it is complete.
+ *
+ * @param render the rendering
+ * @param dirPath the directory path
+ * @param sb the status of the directory when rendering started
+ * @return the listing if complete, or NULL; release it with
+ *   releaseDirListing()
+ */
+DirListing *endDirRender(DirRender *render, const char *dirPath, const struct stat *sb);
+
+#endif /* DIR_LISTING_H_ */
@@ -0,0 +1,242 @@
+/*
+ * durability.c
+ *
+ * Functions that make files stored by requests durable
+ * as configured: before each request is answered, by
+ * batches of requests, or not at all.
+ *
+ * Syncing each request costs a disk flush per request,
+ * so uploads could go no faster than the disk flushes.
+ * In batched mode, requests instead join a batch once
+ * their writes are done, and one thread syncs the whole
+ * content file system for the batch with syncfs(), then
+ * wakes the requests to answer them. A batch waits up to
+ * DurabilityBatchDelay ms for more requests, and is synced
+ * at once when DurabilityBatchSize requests have joined.
+ * A request waits on its own eventfd, so a coroutine
+ * yields to others while its batch is synced.
+ *
+ *  @since 2026-10-18
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+#include "durability.h"
+#include "coroutine.h"
+#include "file_util.h"
+#include "http_server.h"
+
+#if defined(__linux__)
+
+/** A request waiting for its batch to be synced */
+typedef struct Waiter {
+	int efd;                  /** eventfd signaled when synced */
+	int status;               /** 0 if synced, -1 if error */
+	struct Waiter *next;      /** next waiter of the batch */
+} Waiter;
+
+/** guards the batch being collected */
+static pthread_mutex_t batchMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** signals the syncing thread that a batch has requests */
+static pthread_cond_t batchCond;
+
+/** requests of the batch being collected */
+static Waiter *batch = NULL;
+
+/** number of requests of the batch being collected */
+static long batchCount = 0;
+
+/** descriptor of the content directory for syncfs() */
+static int contentFd = -1;
+
+/**
+ * Returns a deadline some milliseconds from now.
+ * @param ms the milliseconds
+ * @param deadline the deadline
+ */
+static void deadlineAfter(long ms, struct timespec *deadline) {
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+	deadline->tv_sec += ms / 1000;
+	deadline->tv_nsec += (ms % 1000) * 1000000;
+	if (deadline->tv_nsec >= 1000000000) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000;
+	}
+}
+
+/**
+ * Thread that syncs batches of requests, collecting each
+ * until it is full or its delay has passed, and then
+ * waking its requests.
+ * @param arg not used
+ * @return NULL when done
+ */
+static void *syncBatches(void *arg) {
+	(void)arg;
+	pthread_mutex_lock(&batchMutex);
+	for (;;) {
+		while (batch == NULL) {
+			pthread_cond_wait(&batchCond, &batchMutex);
+		}
+		// wait for more requests from the first one
+		struct timespec deadline;
+		deadlineAfter(server.durability_batch_delay, &deadline);
+		while (   (batchCount < server.durability_batch_size)
+			   && (pthread_cond_timedwait(&batchCond, &batchMutex, &deadline) != ETIMEDOUT)) {
+		}
+		Waiter *synced = batch;
+		long count = batchCount;
+		batch = NULL;
+		batchCount = 0;
+		pthread_mutex_unlock(&batchMutex);
+
+		// requests joining now wait for the next batch
+		int status = syncfs(contentFd);
+		if (server.debug) {
+			fprintf(stderr, "Synced batch of %ld requests\n", count);
+		}
+		uint64_t one = 1;
+		while (synced != NULL) {
+			Waiter *next = synced->next;  // waiter may return once woken
+			synced->status = status;
+			write(synced->efd, &one, sizeof(one));
+			synced = next;
+		}
+		pthread_mutex_lock(&batchMutex);
+	}
+	return NULL;
+}
+
+/**
+ * Join the batch being collected and wait until it is
+ * synced. A request joins only once its writes are done.
+ * @return 0 if successful, -1 if error
+ */
+static int waitBatch(void) {
+	Waiter waiter = {.status = -1};
+	waiter.efd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+	if (waiter.efd < 0) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&batchMutex);
+	waiter.next = batch;
+	batch = &waiter;
+	if ((++batchCount == 1) || (batchCount >= server.durability_batch_size)) {
+		pthread_cond_signal(&batchCond);
+	}
+	pthread_mutex_unlock(&batchMutex);
+
+	uint64_t count;
+	while (read(waiter.efd, &count, sizeof(count)) < 0) {
+		if (inCoroutine()) {
+			coWaitFd(waiter.efd, POLLIN);
+		} else {
+			struct pollfd pfd = {.fd = waiter.efd, .events = POLLIN};
+			poll(&pfd, 1, -1);
+		}
+	}
+	close(waiter.efd);
+	return waiter.status;
+}
+
+/**
+ * Start the thread that syncs batches of requests if
+ * durability is batched.
+ *
+ * @return true if successful, false with errno set if error
+ */
+bool startDurability(void) {
+	if (server.durability != Durability_Batched) {
+		return true;
+	}
+	contentFd = open(server.content_base, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (contentFd < 0) {
+		return false;
+	}
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&batchCond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	pthread_t thread;
+	int err = pthread_create(&thread, NULL, syncBatches, NULL);
+	if (err != 0) {
+		errno = err;
+		return false;
+	}
+	pthread_detach(thread);
+	return true;
+}
+
+#else
+
+/**
+ * Start the thread that syncs batches of requests if
+ * durability is batched. Without syncfs(), batched
+ * requests are synced one by one.
+ *
+ * @return true if successful, false with errno set if error
+ */
+bool startDurability(void) {
+	return true;
+}
+
+#endif
+
+/**
+ * Make the data written to a file durable, before the
+ * file is renamed into place.
+ *
+ * @param fd the file descriptor
+ * @return 0 if successful, -1 if error
+ */
+int commitFile(int fd) {
+	switch (server.durability) {
+	case Durability_Request:
+		return fsync(fd);
+#if defined(__linux__)
+	case Durability_Batched:
+		return waitBatch();
+#else
+	case Durability_Batched:
+		return fsync(fd);
+#endif
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Make a file created, renamed or removed at a path
+ * durable, before the request is answered.
+ *
+ * @param filePath the file path
+ * @return 0 if successful, -1 if error
+ */
+int commitPath(const char *filePath) {
+	switch (server.durability) {
+	case Durability_Request:
+		return syncPath(filePath);
+#if defined(__linux__)
+	case Durability_Batched:
+		return waitBatch();
+#else
+	case Durability_Batched:
+		return syncPath(filePath);
+#endif
+	default:
+		return 0;
+	}
+}
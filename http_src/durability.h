@@ -0,0 +1,42 @@
+/*
+ * durability.h
+ *
+ * Functions that make files stored by requests durable
+ * as configured: before each request is answered, by
+ * batches of requests, or not at all.
+ *
+ *  @since 2026-10-18
+ */
+
+#ifndef DURABILITY_H_
+#define DURABILITY_H_
+
+#include <stdbool.h>
+
+/**
+ * Start the thread that syncs batches of requests if
+ * durability is batched.
+ *
+ * @return true if successful, false with errno set if error
+ */
+bool startDurability(void);
+
+/**
+ * Make the data written to a file durable, before the
+ * file is renamed into place.
+ *
+ * @param fd the file descriptor
+ * @return 0 if successful, -1 if error
+ */
+int commitFile(int fd);
+
+/**
+ * Make a file created, renamed or removed at a path
+ * durable, before the request is answered.
+ *
+ * @param filePath the file path
+ * @return 0 if successful, -1 if error
+ */
+int commitPath(const char *filePath);
+
+#endif /* DURABILITY_H_ */
@@ -7,9 +7,15 @@
  *  @author: Philip Gust
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/param.h>
 #include "http_server.h"
 #include "file_util.h"
 
@@ -163,3 +169,72 @@ int mkdirs(const char *path, mode_t mode) {
 	}
 	return 0;
 }
+
+/**
+ * Create a temporary file in a directory beside a file,
+ * so it can later be renamed over the file atomically. The
+ * temporary file is named ".<name>.XXXXXX" like mkstemp()
+ * names it, but relative to the directory descriptor.
+ *
+ * @param dirFd the directory descriptor
+ * @param name the file name
+ * @param tmpName return buffer of NAME_MAX+1 for the temporary name
+ * @return the open descriptor or -1 with errno set if error
+ */
+int makeTempFileAt(int dirFd, const char *name, char *tmpName) {
+	static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+	static unsigned long counter = 0;
+	for (int tries = 0; tries < 100; tries++) {
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		unsigned long x = (__atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED) * 2654435761ul)
+						  ^ (unsigned long)now.tv_nsec ^ ((unsigned long)getpid() << 20);
+		char suffix[7];
+		for (int i = 0; i < 6; i++, x /= 36) {
+			suffix[i] = digits[x % 36];
+		}
+		suffix[6] = '\0';
+		if (snprintf(tmpName, NAME_MAX+1, ".%s.%s", name, suffix) > NAME_MAX) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		int fd = openat(dirFd, tmpName, O_RDWR|O_CREAT|O_EXCL|O_CLOEXEC, 0644);
+		if (fd >= 0) {
+			fchmod(fd, 0644);  // whatever the umask, as the file it replaces
+			return fd;
+		} else if (errno != EEXIST) {
+			return -1;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Sync the directory of a file path, so a file created,
+ * renamed or removed in it survives a crash. The directory
+ * of a directory path ending with '/' is its parent.
+ *
+ * @param filePath the path and file
+ * @return 0 if successful, -1 with errno set if error
+ */
+int syncPath(const char *filePath) {
+	char name[MAXPATHLEN], path[MAXPATHLEN];
+	size_t len = strlen(filePath);
+	while ((len > 1) && (filePath[len-1] == '/')) {
+		len--;
+	}
+	if (len >= MAXPATHLEN) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memcpy(name, filePath, len);
+	name[len] = '\0';
+	int fd = open((getPath(name, path) == NULL) ? "." : (*path == '\0') ? "/" : path,
+				  O_RDONLY|O_DIRECTORY);
+	if (fd < 0) {
+		return -1;
+	}
+	int status = fsync(fd);
+	close(fd);
+	return status;
+}
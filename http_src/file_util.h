@@ -98,4 +98,27 @@ char *makeFilePath(const char *path, const char *name, char *filepath);
  */
 int mkdirs(const char *path, mode_t mode);
 
+/**
+ * Create a temporary file in a directory beside a file,
+ * so it can later be renamed over the file atomically. The
+ * temporary file is named ".<name>.XXXXXX" like mkstemp()
+ * names it, but relative to the directory descriptor.
+ *
+ * @param dirFd the directory descriptor
+ * @param name the file name
+ * @param tmpName return buffer of NAME_MAX+1 for the temporary name
+ * @return the open descriptor or -1 with errno set if error
+ */
+int makeTempFileAt(int dirFd, const char *name, char *tmpName);
+
+/**
+ * Sync the directory of a file path, so a file created,
+ * renamed or removed in it survives a crash. The directory
+ * of a directory path ending with '/' is its parent.
+ *
+ * @param filePath the path and file
+ * @return 0 if successful, -1 with errno set if error
+ */
+int syncPath(const char *filePath);
+
 #endif /* FILE_UTIL_H_ */
@@ -0,0 +1,298 @@
+/*
+ * form_decoder.c
+ *
+ * Functions that decode application/x-www-form-urlencoded
+ * and text/plain forms as they stream in.
+ *
+ * Each byte has a class from a table for the encoding.
+ * Runs of plain bytes are skipped eight at a time by
+ * testing a whole word for the few special bytes, and
+ * copied at once; escapes are decoded by table lookup.
+ *
+ *  @since 2026-10-18
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "form_decoder.h"
+#include "http_codes.h"
+
+/** Classes of bytes in a form */
+enum ByteClass {
+	Byte_Plain = 0,   //!< part of a name or value
+	Byte_Escape,      //!< starts a %xx escape
+	Byte_Space,       //!< encodes a space
+	Byte_Pair,        //!< ends a name/value pair
+	Byte_Equals,      //!< separates a name from its value
+	Byte_Ignore       //!< dropped
+};
+
+/** byte classes of urlencoded forms */
+static const unsigned char urlClasses[256] = {
+	['%'] = Byte_Escape, ['+'] = Byte_Space,
+	['&'] = Byte_Pair, [';'] = Byte_Pair, ['='] = Byte_Equals
+};
+
+/** special bytes of urlencoded forms */
+static const char urlSpecials[] = "%+&;=";
+
+/** byte classes of text/plain forms */
+static const unsigned char textClasses[256] = {
+	['\n'] = Byte_Pair, ['\r'] = Byte_Ignore, ['='] = Byte_Equals
+};
+
+/** special bytes of text/plain forms */
+static const char textSpecials[] = "\n\r=";
+
+/** hex digit values plus 1, or 0 for bytes that are not hex digits */
+const unsigned char hexValues[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16
+};
+
+/** a byte repeated in each byte of a word */
+#define WORD_BYTES(c) (0x0101010101010101ULL * (unsigned char)(c))
+
+/**
+ * Test the bytes of a word for a value. The lowest flagged
+ * byte is always a match, though higher ones may not be.
+ * @param word the word
+ * @param c the byte value
+ * @return non-zero if some byte may match
+ */
+static uint64_t matchBytes(uint64_t word, char c) {
+	uint64_t v = word ^ WORD_BYTES(c);
+	return (v - WORD_BYTES(1)) & ~v & WORD_BYTES(0x80);
+}
+
+/**
+ * Find the length of the run of plain bytes at the
+ * start of some bytes.
+ * @param dec the decoder
+ * @param p the bytes
+ * @param n the number of bytes
+ * @return length of the plain run
+ */
+static size_t plainRun(FormDecoder *dec, const unsigned char *p, size_t n) {
+	const char *specials = (dec->encoding == Form_UrlEncoded) ? urlSpecials : textSpecials;
+	size_t i = 0;
+	while (i + sizeof(uint64_t) <= n) {
+		uint64_t word;
+		memcpy(&word, p+i, sizeof(word));
+		uint64_t match = 0;
+		for (const char *s = specials; *s != '\0'; s++) {
+			match |= matchBytes(word, *s);
+		}
+		if (match == 0) {
+			i += sizeof(uint64_t);
+			continue;
+		}
+		// find the special byte in the word
+		for (size_t end = i + sizeof(uint64_t); i < end; i++) {
+			if (dec->classes[p[i]] != Byte_Plain) {
+				return i;
+			}
+		}
+	}
+	while ((i < n) && (dec->classes[p[i]] == Byte_Plain)) {
+		i++;
+	}
+	return i;
+}
+
+/**
+ * Find the encoding of a form from its media type.
+ *
+ * @param contentType the Content-Type header value
+ * @param encoding the encoding
+ * @return true if a form encoding that is decoded
+ */
+bool findFormEncoding(const char *contentType, enum FormEncoding *encoding) {
+	static const char urlType[] = "application/x-www-form-urlencoded";
+	static const char textType[] = "text/plain";
+	size_t len = strcspn(contentType, "; \t");
+	if ((len == sizeof(urlType)-1) && (strncasecmp(contentType, urlType, len) == 0)) {
+		*encoding = Form_UrlEncoded;
+		return true;
+	}
+	if ((len == sizeof(textType)-1) && (strncasecmp(contentType, textType, len) == 0)) {
+		*encoding = Form_TextPlain;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Start decoding a form.
+ *
+ * @param dec the decoder
+ * @param encoding the form encoding
+ * @param props the properties for name/value pairs
+ */
+void initFormDecoder(FormDecoder *dec, enum FormEncoding encoding, Properties *props) {
+	dec->encoding = encoding;
+	dec->classes = (encoding == Form_UrlEncoded) ? urlClasses : textClasses;
+	dec->props = props;
+	dec->inValue = false;
+	dec->escape = -1;
+	dec->nameLen = dec->valueLen = 0;
+}
+
+/**
+ * Append decoded bytes to the name or value.
+ * @param dec the decoder
+ * @param bytes the bytes
+ * @param n the number of bytes
+ * @return 0 if successful, or the status of an error response
+ */
+static int appendBytes(FormDecoder *dec, const void *bytes, size_t n) {
+	if (dec->inValue) {
+		if (dec->valueLen + n >= MAX_PROP_VAL) {
+			return Http_PayloadTooLarge;
+		}
+		memcpy(dec->value + dec->valueLen, bytes, n);
+		dec->valueLen += n;
+	} else {
+		if (dec->nameLen + n >= MAX_PROP_NAME) {
+			return Http_PayloadTooLarge;
+		}
+		memcpy(dec->name + dec->nameLen, bytes, n);
+		dec->nameLen += n;
+	}
+	return 0;
+}
+
+/**
+ * Add the decoded pair to the properties. Empty pairs,
+ * as between "&&", are skipped.
+ * @param dec the decoder
+ * @return 0 if successful, or the status of an error response
+ */
+static int endPair(FormDecoder *dec) {
+	int status = 0;
+	if (dec->inValue || (dec->nameLen > 0)) {
+		dec->name[dec->nameLen] = '\0';
+		dec->value[dec->valueLen] = '\0';
+		if (!putProperty(dec->props, dec->name, dec->value)) {
+			status = Http_PayloadTooLarge;
+		}
+	}
+	dec->inValue = false;
+	dec->nameLen = dec->valueLen = 0;
+	return status;
+}
+
+/**
+ * Decode the next bytes of a form. Pairs are added to the
+ * properties as they complete, and names, values and
+ * escapes may be split between calls.
+ *
+ * @param dec the decoder
+ * @param data the bytes
+ * @param n the number of bytes
+ * @return 0 if successful, or the status of an error response
+ */
+int decodeForm(FormDecoder *dec, const char *data, size_t n) {
+	const unsigned char *p = (const unsigned char*)data;
+	const unsigned char *end = p + n;
+	int status = 0;
+	while ((p < end) && (status == 0)) {
+		// hex digits of an escape
+		if (dec->escape >= 0) {
+			int digit = hexValues[*p++];
+			if (digit == 0) {
+				return Http_BadRequest;
+			}
+			if (dec->escape == 0) {
+				dec->escapeHi = digit-1;
+				dec->escape = 1;
+			} else {
+				char c = (char)((dec->escapeHi << 4) | (digit-1));
+				dec->escape = -1;
+				status = appendBytes(dec, &c, 1);
+			}
+			continue;
+		}
+
+		size_t run = plainRun(dec, p, end-p);
+		if (run > 0) {
+			status = appendBytes(dec, p, run);
+			p += run;
+			continue;
+		}
+
+		switch (dec->classes[*p++]) {
+		case Byte_Escape:
+			dec->escape = 0;
+			break;
+		case Byte_Space:
+			status = appendBytes(dec, " ", 1);
+			break;
+		case Byte_Pair:
+			status = endPair(dec);
+			break;
+		case Byte_Equals:
+			if (dec->inValue) {  // only the first '=' separates
+				status = appendBytes(dec, "=", 1);
+			} else {
+				dec->inValue = true;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	return status;
+}
+
+/**
+ * Finish decoding a form, adding its last pair.
+ *
+ * @param dec the decoder
+ * @return 0 if successful, or the status of an error response
+ */
+int endForm(FormDecoder *dec) {
+	if (dec->escape >= 0) {
+		return Http_BadRequest;
+	}
+	return endPair(dec);
+}
+
+/**
+ * Decode a form request body as it is read.
+ *
+ * @param body the request body
+ * @param encoding the form encoding
+ * @param props the properties for name/value pairs
+ * @return 0 if successful, or the status of an error response
+ */
+int readFormBody(RequestBody *body, enum FormEncoding encoding, Properties *props) {
+	FormDecoder *dec = malloc(sizeof(FormDecoder));
+	char *buf = malloc(BODY_SLICE_SIZE);
+	if ((dec == NULL) || (buf == NULL)) {
+		free(dec);
+		free(buf);
+		return Http_InternalServerError;
+	}
+
+	initFormDecoder(dec, encoding, props);
+	int status = 0;
+	ssize_t nread;
+	while ((nread = readRequestBody(body, buf, BODY_SLICE_SIZE)) > 0) {
+		if ((status = decodeForm(dec, buf, nread)) != 0) {
+			break;
+		}
+	}
+	if (nread < 0) {
+		status = body->status;
+	} else if (status == 0) {
+		status = endForm(dec);
+	}
+	free(buf);
+	free(dec);
+	return status;
+}
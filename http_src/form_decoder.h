@@ -0,0 +1,89 @@
+/*
+ * form_decoder.h
+ *
+ * Functions that decode application/x-www-form-urlencoded
+ * and text/plain forms as they stream in.
+ *
+ *  @since 2026-10-18
+ */
+
+#ifndef FORM_DECODER_H_
+#define FORM_DECODER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "properties.h"
+#include "request_body.h"
+
+/** Encodings of forms that are decoded */
+enum FormEncoding {
+	Form_UrlEncoded = 0,  //!< application/x-www-form-urlencoded
+	Form_TextPlain  = 1   //!< text/plain, one name=value per line
+};
+
+/** A form being decoded */
+typedef struct FormDecoder {
+	enum FormEncoding encoding;   /** the form encoding */
+	const unsigned char *classes; /** class of each byte */
+	Properties *props;            /** the decoded name/value pairs */
+	bool inValue;                 /** decoding a value, not a name */
+	int escape;                   /** hex digits of an escape seen, or -1 */
+	int escapeHi;                 /** first hex digit of an escape */
+	size_t nameLen;               /** length of the name */
+	size_t valueLen;              /** length of the value */
+	char name[MAX_PROP_NAME];     /** the name being decoded */
+	char value[MAX_PROP_VAL];     /** the value being decoded */
+} FormDecoder;
+
+/** hex digit values plus 1, or 0 for bytes that are not hex digits */
+extern const unsigned char hexValues[256];
+
+/**
+ * Find the encoding of a form from its media type.
+ *
+ * @param contentType the Content-Type header value
+ * @param encoding the encoding
+ * @return true if a form encoding that is decoded
+ */
+bool findFormEncoding(const char *contentType, enum FormEncoding *encoding);
+
+/**
+ * Start decoding a form.
+ *
+ * @param dec the decoder
+ * @param encoding the form encoding
+ * @param props the properties for name/value pairs
+ */
+void initFormDecoder(FormDecoder *dec, enum FormEncoding encoding, Properties *props);
+
+/**
+ * Decode the next bytes of a form. Pairs are added to the
+ * properties as they complete, and names, values and
+ * escapes may be split between calls.
+ *
+ * @param dec the decoder
+ * @param data the bytes
+ * @param n the number of bytes
+ * @return 0 if successful, or the status of an error response
+ */
+int decodeForm(FormDecoder *dec, const char *data, size_t n);
+
+/**
+ * Finish decoding a form, adding its last pair.
+ *
+ * @param dec the decoder
+ * @return 0 if successful, or the status of an error response
+ */
+int endForm(FormDecoder *dec);
+
+/**
+ * Decode a form request body as it is read.
+ *
+ * @param body the request body
+ * @param encoding the form encoding
+ * @param props the properties for name/value pairs
+ * @return 0 if successful, or the status of an error response
+ */
+int readFormBody(RequestBody *body, enum FormEncoding encoding, Properties *props);
+
+#endif /* FORM_DECODER_H_ */
@@ -9,14 +9,17 @@
  */
 
 #include <stdbool.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <sys/stat.h>
 #include <sys/param.h>
 #include <unistd.h>
-#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 
 #include "http_codes.h"
 #include "http_methods.h"
@@ -27,112 +30,275 @@
 #include "properties.h"
 #include "string_util.h"
 #include "file_util.h"
+#include "request_body.h"
+#include "multipart.h"
+#include "form_decoder.h"
+#include "arena.h"
+#include "path_lock.h"
+#include "upload.h"
+#include "durability.h"
+#include "content_watch.h"
+#include "negative_cache.h"
+#include "content_index.h"
+#include "dir_listing.h"
+
+/** size of the first block of the arena for a posted form */
+#define FORM_ARENA_SIZE (8*1024)
 
 /**
- * Generate html content for directory index page.
+ * Send a rendered directory listing, gzip encoded if the
+ * client accepts it.
  *
- * @param path the directory path
- * @param buf the string buffer to hold html content
+ * @param stream the socket stream
+ * @param listing the listing
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @param sendContent send content (GET)
  */
-static void dir_content(const char *path, char *buf) {
-    // Replace content base with /.
-    char pathCopy[MAXBUF];
-    char pathName[MAXBUF];
-    sprintf(pathName,"/");
-    strcpy(pathCopy, path);
-    char *token = strtok(pathCopy, "/");
-    while( token != NULL ) {
-        token = strtok(NULL, "/");
-        if (token != NULL) sprintf(pathName, "%s%s/", pathName, token);
-    }
-    sprintf(buf, "<html>\n"
-                 "<head>\n"
-                 "  <title>index of %s</title>\n"
-                 "</head>\n"
-                 "<body>\n"
-                 "  <h1>Index of %s</h1>\n"
-                 "  <table>\n"
-                 "  <tr>\n"
-                 "    <th valign=\"top\"></th>\n"
-                 "    <th>Name</th>\n"
-                 "    <th>Last modified</th>\n"
-                 "    <th>Size</th>\n"
-                 "    <th>Description</th>\n"
-                 "  </tr>\n"
-                 "  <tr>\n"
-                 "    <td colspan=\"5\"><hr></td>\n"
-                 "  </tr>", pathName, pathName);
-    DIR *dp = opendir(path);
-    struct dirent *ep;
-    while (ep = readdir (dp)) {
-        if (strcmp(ep->d_name, ".") == 0) {
-            continue;
-        }
-        char name[MAXBUF], link[MAXBUF], mtime[MAXBUF], td[MAXBUF], size[MAXBUF];
-        if (ep->d_type == DT_DIR) {
-            sprintf(link, "%s/", ep->d_name);
-            if (strcmp(ep->d_name, "..")==0) {
-                if (strcmp(pathName, "/")==0) {
-                    continue;
-                } else {
-                    sprintf(td, "&#x23ce");
-                    sprintf(name, "Parent Directory");
-                }
-            } else {
-                sprintf(td, "&#x1F4C1;");
-                sprintf(name, ep->d_name);
+static void send_listing(FILE *stream, DirListing *listing, Properties *requestHeaders, Properties *responseHeaders, bool sendContent) {
+    size_t contentLen;
+    const char *content = NULL;
+    if (acceptsEncoding(requestHeaders, "gzip")) {
+        content = getDirListingGzip(listing, &contentLen);
+    }
+    if (content != NULL) {
+        putProperty(responseHeaders, "Content-Encoding", "gzip");
+    } else {
+        content = getDirListingHtml(listing, &contentLen);
+    }
+    char lenBuf[MAXBUF];
+    sprintf(lenBuf,"%lu", contentLen);
+    putProperty(responseHeaders,"Content-Length", lenBuf);
+    // send response
+    sendResponseStatus(stream, Http_OK, NULL);
+    // Send response headers
+    sendResponseHeaders(stream, responseHeaders);
+    if (sendContent) {  // for GET
+        fwrite(content, 1, contentLen, stream);
+    }
+}
+
+/** number of entries of a JSON listing page if not given */
+#define LISTING_PAGE_SIZE 100
+
+/** largest number of entries of a JSON listing page */
+#define LISTING_MAX_PAGE_SIZE 1000
+
+/**
+ * Parse a query parameter that is a count.
+ * @param query the query parameters
+ * @param name the parameter name
+ * @param count the count, unchanged if the parameter is absent
+ * @return true if absent or valid, false if invalid
+ */
+static bool parse_count_param(Properties *query, const char *name, size_t *count) {
+    char val[MAX_PROP_VAL];
+    if (findProperty(query, 0, name, val) == SIZE_MAX) {
+        return true;
+    }
+    size_t len = strlen(val);
+    return (len > 0) && (parseSize(val, len, 10, count) == len);
+}
+
+/**
+ * Parse the query parameters of a directory request:
+ * format=html|json, and for JSON, sort=name|mtime|size,
+ * order=asc|desc, limit=entries and cursor=next.
+ *
+ * @param queryString the query string
+ * @param json true if JSON is requested
+ * @param sort the order of the entries
+ * @param descending true for descending order
+ * @param cursor offset of the first entry of the page
+ * @param limit largest number of entries of the page
+ * @return true if valid, false if not
+ */
+static bool parse_listing_query(const char *queryString, bool *json, enum DirSort *sort,
+                                bool *descending, size_t *cursor, size_t *limit) {
+    static const char *sorts[DirSort_Count] = {"name", "mtime", "size"};
+    *json = *descending = false;
+    *sort = DirSort_Name;
+    *cursor = 0;
+    *limit = LISTING_PAGE_SIZE;
+
+    Properties *query = newProperties();
+    decodeQuery(queryString, query);
+    char val[MAX_PROP_VAL];
+    bool valid = true;
+    if (findProperty(query, 0, "format", val) != SIZE_MAX) {
+        *json = (strcmp(val, "json") == 0);
+        valid = *json || (strcmp(val, "html") == 0);
+    }
+    if (valid && *json) {
+        if (findProperty(query, 0, "sort", val) != SIZE_MAX) {
+            int i = 0;
+            while ((i < DirSort_Count) && (strcmp(val, sorts[i]) != 0)) {
+                i++;
             }
-        } else {
-            sprintf(name, ep->d_name);
-            sprintf(link, ep->d_name);
-            sprintf(td, "");
+            *sort = i;
+            valid = (i < DirSort_Count);
+        }
+        if (valid && (findProperty(query, 0, "order", val) != SIZE_MAX)) {
+            *descending = (strcmp(val, "desc") == 0);
+            valid = *descending || (strcmp(val, "asc") == 0);
         }
-        char fullPath[MAXBUF];
-        sprintf(fullPath, "%s%s", path, ep->d_name);
-        struct stat sb;
-        stat(fullPath, &sb);
-        time_t timer = sb.st_mtim.tv_sec;
-        milliTimeToRFC_1123_Date_Time(timer, mtime);
-        sprintf(size,"%lu",(size_t)sb.st_size);
-        sprintf(buf+strlen(buf), "  <tr>\n"
-                                 "    <td>%s</td>\n"
-                                 "    <td><a href=\"%s\">%s</a></td>\n"
-                                 "    <td align=\"right\">%s</td>\n"
-                                 "    <td align=\"right\">%s</td>\n"
-                                 "    <td></td>\n"
-                                 "  </tr>\n",td, link, name, mtime, size);
-    }
-    (void) closedir (dp);
-    sprintf(buf+strlen(buf), "  <tr><td colspan=\"5\"><hr></td></tr>\n"
-                             "</body>\n"
-                             "</html>");
+        valid =    valid
+                && parse_count_param(query, "cursor", cursor)
+                && parse_count_param(query, "limit", limit)
+                && (*limit > 0) && (*limit <= LISTING_MAX_PAGE_SIZE);
+    }
+    deleteProperties(query);
+    return valid;
 }
 
 /**
- * Handle GET or HEAD request for directory.
+ * Handle GET or HEAD request for a page of the JSON listing
+ * of a directory. The entries are sorted once for each order
+ * and kept with the listing, so a page is a slice of them.
  *
  * @param stream the socket stream
+ * @param uri the request URI
  * @param path the directory path
- * @param requestHeaders the request headers
+ * @param fd descriptor of the open directory, closed when done
+ * @param sb the status of the directory
+ * @param sort the order of the entries
+ * @param descending true for descending order
+ * @param cursor offset of the first entry of the page
+ * @param limit largest number of entries of the page
  * @param responseHeaders the response headers
  * @param sendContent send content (GET)
  */
-static void do_dir(FILE *stream, const char *path, Properties *requestHeaders, Properties *responseHeaders, bool sendContent) {
-    char buf[2048];
-    dir_content(path, buf);
-    // Put content to tmp file and get file stat.
-    FILE *tmp = tmpStringFile(buf);
+static void do_json_dir(FILE *stream, const char *uri, const char *path, int fd, const struct stat *sb,
+                        enum DirSort sort, bool descending, size_t cursor, size_t limit,
+                        Properties *responseHeaders, bool sendContent) {
+    DirListing *listing = loadDirListing(path, fd, uri, sb);
+    char *content = NULL;
+    size_t contentLen = 0;
+    FILE *out = (listing == NULL) ? NULL : open_memstream(&content, &contentLen);
+    bool ok =    (out != NULL)
+              && writeDirListingJson(out, listing, uri, sort, descending, cursor, limit);
+    if (out != NULL) {
+        ok = (fclose(out) == 0) && ok;
+    }
+    if (listing != NULL) {
+        releaseDirListing(listing);
+    }
+    if (!ok) {
+        free(content);
+        sendStatusResponse(stream, Http_InternalServerError, NULL, responseHeaders);
+        return;
+    }
+
+    putProperty(responseHeaders, "Content-type", "application/json");
     char lenBuf[MAXBUF];
-    sprintf(lenBuf,"%lu", strlen(buf));
+    sprintf(lenBuf,"%lu", contentLen);
     putProperty(responseHeaders,"Content-Length", lenBuf);
-    putProperty(responseHeaders, "Content-type", "text/html");
-    // send response
     sendResponseStatus(stream, Http_OK, NULL);
-    // Send response headers
     sendResponseHeaders(stream, responseHeaders);
     if (sendContent) {  // for GET
-        copyFileStreamBytes(tmp, stream, strlen(buf));
-        fclose(tmp);
+        fwrite(content, 1, contentLen, stream);
+    }
+    free(content);
+}
+
+/**
+ * Handle GET or HEAD request for directory. A listing is
+ * reused until the directory changes. A large listing that
+ * must be rendered is streamed as it is, with chunked coding
+ * if the connection is kept, or else until it is closed.
+ * A query of format=json requests a page of the listing
+ * as JSON instead.
+ *
+ * @param stream the socket stream
+ * @param uri the request URI
+ * @param path the directory path
+ * @param fd descriptor of the open directory, closed when done
+ * @param sb the status of the directory
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @param sendContent send content (GET)
+ */
+static void do_dir(FILE *stream, const char *uri, const char *path, int fd, const struct stat *sb,
+                   Properties *requestHeaders, Properties *responseHeaders, bool sendContent) {
+    char query[MAX_PROP_VAL];
+    if (findProperty(requestHeaders, 0, "?", query) != SIZE_MAX) {
+        bool json, descending;
+        enum DirSort sort;
+        size_t cursor, limit;
+        if (!parse_listing_query(query, &json, &sort, &descending, &cursor, &limit)) {
+            close(fd);
+            sendStatusResponse(stream, Http_BadRequest, NULL, responseHeaders);
+            return;
+        }
+        if (json) {
+            do_json_dir(stream, uri, path, fd, sb, sort, descending, cursor, limit,
+                        responseHeaders, sendContent);
+            return;
+        }
+    }
+
+    putProperty(responseHeaders, "Content-type", "text/html");
+    putProperty(responseHeaders, "Vary", "Accept-Encoding");
+    DirListing *listing = findDirListing(path, sb);
+    if (listing != NULL) {
+        close(fd);
+        send_listing(stream, listing, requestHeaders, responseHeaders, sendContent);
+        releaseDirListing(listing);
+        return;
+    }
+
+    DirRender render;
+    if (!startDirRender(&render, fd, uri)) {
+        sendStatusResponse(stream, Http_InternalServerError, NULL, responseHeaders);
+        return;
+    }
+    bool streaming = false;
+    bool chunked = false;
+    size_t sent = 0;
+    bool ok = true;
+    while (ok && !render.done) {
+        ok = renderDirEntries(&render);
+        if (ok && sendContent && !streaming && (render.htmlLen >= DIR_STREAM_SIZE)) {
+            // the client finds the end of the body from the chunks,
+            // or from the connection closing
+            char connection[MAX_PROP_VAL];
+            chunked =    (findProperty(responseHeaders, 0, "Connection", connection) == SIZE_MAX)
+                      || (strcasecmp(connection, "close") != 0);
+            if (chunked) {
+                putProperty(responseHeaders, "Transfer-Encoding", "chunked");
+            }
+            sendResponseStatus(stream, Http_OK, NULL);
+            sendResponseHeaders(stream, responseHeaders);
+            streaming = true;
+        }
+        if (ok && streaming && (render.htmlLen > sent)) {
+            if (chunked) {
+                sendChunk(stream, render.html + sent, render.htmlLen - sent);
+            } else {
+                fwrite(render.html + sent, 1, render.htmlLen - sent, stream);
+            }
+            sent = render.htmlLen;
+        }
+    }
+    if (streaming) {
+        if (!ok) {
+            // an unfinished body can only be ended by closing
+            putProperty(responseHeaders, "Connection", "close");
+        } else if (chunked) {
+            sendChunk(stream, NULL, 0);
+        }
+    }
+
+    listing = endDirRender(&render, path, sb);
+    if (!streaming) {
+        if (listing != NULL) {
+            send_listing(stream, listing, requestHeaders, responseHeaders, sendContent);
+        } else {
+            sendStatusResponse(stream, Http_InternalServerError, NULL, responseHeaders);
+        }
+    }
+    if (listing != NULL) {
+        releaseDirListing(listing);
     }
 }
 
@@ -151,18 +317,39 @@ static void do_get_or_head(FILE *stream, const char *uri, Properties *requestHea
 	resolveUri(uri, filePath);
 	FILE *contentStream = NULL;
 
-	// ensure file exists
+	// serve the file from one descriptor: a concurrent PUT or
+	// DELETE replaces or removes the path, but not this file
+	// (non-blocking so a FIFO cannot stall the open); a path
+	// known to be missing is not looked up again, nor is one
+	// the content index finds is not a file or directory, nor
+	// the files of an upload in progress
+	ContentInfo info;
+	enum ContentLookup lookup = lookupContent(filePath, &info);
+	unsigned long stamp = 0;
+	if (   isUploadPath(filePath) || (lookup == ContentLookup_Missing)
+		|| ((lookup == ContentLookup_Unknown) && isKnownMissing(filePath, &stamp))
+		|| (   (lookup == ContentLookup_Found) && !S_ISREG(info.mode)
+			&& !(S_ISDIR(info.mode) && strendswith(filePath, "/")))) {
+		sendStatusResponse(stream, Http_NotFound, NULL, responseHeaders);
+		return;
+	}
+	int fd = openContent(filePath, O_RDONLY|O_NONBLOCK);
 	struct stat sb;
-	if (stat(filePath, &sb) != 0) {
+	if ((fd < 0) || (fstat(fd, &sb) != 0)) {
+		if (fd >= 0) {
+			close(fd);
+		} else if ((errno == ENOENT) && (lookup == ContentLookup_Unknown)) {
+			addMissingPath(filePath, stamp);
+		}
 		sendStatusResponse(stream, Http_NotFound, NULL, responseHeaders);
 		return;
 	}
 	// directory path ends with '/'
 	if (S_ISDIR(sb.st_mode) && strendswith(filePath, "/")) {
-		// not allowed for this method
-		do_dir(stream, filePath, requestHeaders, responseHeaders, sendContent);
+		do_dir(stream, uri, filePath, fd, &sb, requestHeaders, responseHeaders, sendContent);
 		return;
 	} else if (!S_ISREG(sb.st_mode)) { // error if not regular file
+		close(fd);
 		sendStatusResponse(stream, Http_NotFound, NULL, responseHeaders);
 		return;
 	}
@@ -177,14 +364,15 @@ static void do_get_or_head(FILE *stream, const char *uri, Properties *requestHea
 	time_t timer = sb.st_mtim.tv_sec;
 	putProperty(responseHeaders,"Last-Modified",
 				milliTimeToRFC_1123_Date_Time(timer, buf));
+	putProperty(responseHeaders,"ETag", makeETag(&sb, buf));
 
 	// get mime type of file
-	getMediaType(filePath, buf);
-	if (strcmp(buf, "text/directory") == 0) {
+	const char *mediaType = (lookup == ContentLookup_Found) ? info.mediaType : lookupMediaType(filePath);
+	if (strcmp(mediaType, "text/directory") == 0) {
 		// some browsers interpret text/directory as a VCF file
-		strcpy(buf,"text/html");
+		mediaType = "text/html";
 	}
-	putProperty(responseHeaders, "Content-type", buf);
+	putProperty(responseHeaders, "Content-type", mediaType);
 
 	// send response
 	sendResponseStatus(stream, Http_OK, NULL);
@@ -192,10 +380,11 @@ static void do_get_or_head(FILE *stream, const char *uri, Properties *requestHea
 	// Send response headers
 	sendResponseHeaders(stream, responseHeaders);
 
-	if (sendContent) {  // for GET
-		contentStream = fopen(filePath, "r");
+	if (sendContent && ((contentStream = fdopen(fd, "r")) != NULL)) {  // for GET
 		copyFileStreamBytes(contentStream, stream, contentLen);
 		fclose(contentStream);
+	} else {
+		close(fd);
 	}
 }
 
@@ -221,6 +410,32 @@ void do_get(FILE *stream, const char *uri, Properties *requestHeaders, Propertie
  * @param responseHeaders the response headers
  */
 void do_head(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+	// report the committed ranges of an upload in progress; its
+	// staging file is looked up first, so the ranges are not
+	// read for a path the index or the negative cache knows
+	// has no upload
+	char filePath[MAXPATHLEN], stagePath[MAXPATHLEN];
+	resolveUri(uri, filePath);
+	ContentInfo info;
+	unsigned long stamp = 0;
+	enum ContentLookup lookup = ContentLookup_Missing;
+	if (!isUploadPath(filePath) && (makeUploadStagePath(filePath, stagePath) != NULL)) {
+		lookup = lookupContent(stagePath, &info);
+	}
+	if (   ((lookup == ContentLookup_Found) && S_ISREG(info.mode))
+		|| ((lookup == ContentLookup_Unknown) && !isKnownMissing(stagePath, &stamp))) {
+		UploadRanges ranges;
+		lockPath(filePath);
+		bool uploading = readUploadRanges(filePath, &ranges);
+		unlockPath(filePath);
+		if (uploading) {
+			char buf[MAX_PROP_VAL];
+			putProperty(responseHeaders, "Upload-Ranges", formatUploadRanges(&ranges, buf));
+		} else if (lookup == ContentLookup_Unknown) {
+			addMissingPath(stagePath, stamp);
+		}
+	}
+
 	do_get_or_head(stream, uri, requestHeaders, responseHeaders, false);
 }
 
@@ -237,139 +452,628 @@ void do_delete(FILE *stream, const char *uri, Properties *requestHeaders, Proper
     char filePath[MAXPATHLEN];
     resolveUri(uri, filePath);
 
-    // ensure file exists
+    // the files of uploads in progress are not for requests
+    if (isUploadPath(filePath)) {
+        sendStatusResponse(stream, Http_Forbidden, NULL, responseHeaders);
+        return;
+    }
+
+    // the path is removed relative to its directory, which
+    // must be in the content tree
+    char name[NAME_MAX+1];
+    int dirFd = openParentBeneath(filePath, name);
+    if (dirFd < 0) {
+        sendStatusResponse(stream, (errno == ENOENT) ? Http_NotFound : Http_Forbidden, NULL, responseHeaders);
+        return;
+    }
+
+    // check and remove the path as one step
+    lockPath(filePath);
+    int status = Http_OK;
+    struct stat sb;
+    bool removed = false;
+    // also ends an upload to the path in progress
+    bool cancelled = removeUpload(filePath);
+    if (statBeneath(dirFd, name, filePath, &sb) != 0) {
+        status = cancelled ? Http_OK : Http_NotFound;
+    } else if (S_ISDIR(sb.st_mode) && strendswith(filePath, "/")) {
+        // directory path ends with '/'; only an empty one is removed
+        if (unlinkat(dirFd, name, AT_REMOVEDIR) != 0) {
+            status = ((errno == ENOTEMPTY) || (errno == EEXIST)) ? Http_MethodNotAllowed : Http_Forbidden;
+        } else {
+            removed = true;
+        }
+    } else if (!S_ISREG(sb.st_mode)) { // error if not regular file
+        status = Http_NotFound;
+    } else if (unlinkat(dirFd, name, 0) != 0) {
+        status = Http_Forbidden;
+    } else {
+        removed = true;
+    }
+    unlockPath(filePath);
+    close(dirFd);
+    if (removed) {
+        reportContentChange(ContentEvent_Removed, filePath, S_ISDIR(sb.st_mode));
+    }
+
+    // the removal must reach the disk before it is reported
+    if ((status == Http_OK) && (commitPath(filePath) != 0)) {
+        status = Http_InternalServerError;
+    }
+    sendStatusResponse(stream, status, NULL, responseHeaders);
+}
+
+
+/**
+ * Check the If-Match and If-None-Match preconditions of
+ * a request that replaces a file.
+ *
+ * @param sb the file status, or NULL if no file
+ * @param requestHeaders the request headers
+ * @return 0 if met, or Http_PreconditionFailed
+ */
+static int check_preconditions(const struct stat *sb, Properties *requestHeaders) {
+    char etag[MAXBUF];
+    if (sb != NULL) {
+        makeETag(sb, etag);
+    }
+    char tags[MAX_PROP_VAL];
+    if (findProperty(requestHeaders, 0, "If-Match", tags) != SIZE_MAX) {
+        // strong comparison, and "*" matches any file
+        if (   (sb == NULL)
+            || ((strcmp(tags, "*") != 0) && !matchETag(tags, etag, false))) {
+            return Http_PreconditionFailed;
+        }
+    }
+    if (findProperty(requestHeaders, 0, "If-None-Match", tags) != SIZE_MAX) {
+        // weak comparison, and "*" matches any file
+        if (   (sb != NULL)
+            && ((strcmp(tags, "*") == 0) || matchETag(tags, etag, true))) {
+            return Http_PreconditionFailed;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Store a request body as the file for a URI, replacing
+ * any existing file, and send the response. The body is
+ * written to a temporary file in the same directory that
+ * is renamed over the file, so readers see either the old
+ * or the new file but never part of one.
+ *
+ * @param stream the socket stream
+ * @param body the request body
+ * @param uri the request URI
+ * @param filePath the file path of the URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+static void store_body(FILE *stream, RequestBody *body, const char *uri, const char *filePath,
+                       Properties *requestHeaders, Properties *responseHeaders) {
+    // a body must declare its length or be chunked
+    if (!body->present) {
+        sendStatusResponse(stream, Http_LengthRequired, NULL, responseHeaders);
+        return;
+    }
+
+    // the file is replaced relative to its directory, which
+    // must be in the content tree
+    char name[NAME_MAX+1], tmpName[NAME_MAX+1];
+    int dirFd = openParentBeneath(filePath, name);
+    if (dirFd < 0) {
+        bool refused = (errno == EXDEV) || (errno == ELOOP) || (errno == EACCES);
+        sendStatusResponse(stream, refused ? Http_Forbidden : Http_MethodNotAllowed, NULL, responseHeaders);
+        return;
+    }
     struct stat sb;
-    if (stat(filePath, &sb) != 0) {
-        sendStatusResponse(stream, Http_NotFound, NULL, responseHeaders);
+    int fd = -1;
+    if (   ((statBeneath(dirFd, name, filePath, &sb) == 0) && !S_ISREG(sb.st_mode))
+        || ((fd = makeTempFileAt(dirFd, name, tmpName)) < 0)) {
+        close(dirFd);
+        sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
         return;
     }
-    // directory path ends with '/'
-    if (S_ISDIR(sb.st_mode) && strendswith(filePath, "/")) {
-        DIR* dir = opendir(filePath);
-        int count = 0;
-        struct dirent *entry;
-        while((entry = readdir(dir))!=NULL)  {
-            ++count;
+
+    // move the body to the file without copying it
+    int status = spliceRequestBody(body, fd);
+    if ((status == 0) && (commitFile(fd) != 0)) {
+        status = Http_InternalServerError;
+    }
+    if ((close(fd) != 0) && (status == 0)) {
+        status = Http_InternalServerError;
+    }
+
+    // the file may have changed while the body was read, so check
+    // the preconditions again and replace the file as one step
+    bool exists = false;
+    char etag[MAXBUF];
+    if (status == 0) {
+        lockPath(filePath);
+        exists = (statBeneath(dirFd, name, filePath, &sb) == 0);
+        if (exists && !S_ISREG(sb.st_mode)) {
+            status = Http_MethodNotAllowed;
+        } else {
+            status = check_preconditions(exists ? &sb : NULL, requestHeaders);
         }
-        closedir(filePath);
-        if (count == 2) {
-            //delete directory
-            rmdir(filePath);
-            sendStatusResponse(stream, Http_OK, NULL, responseHeaders);
-            return;
+        if ((status == 0) && (renameat(dirFd, tmpName, dirFd, name) != 0)) {
+            status = Http_InternalServerError;
         }
-        else {
-            // not empty directory, not allowed for this method
-            sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
-            return;
+        // the new entity tag lets the client make its next update conditional
+        if ((status == 0) && (statBeneath(dirFd, name, filePath, &sb) == 0)) {
+            putProperty(responseHeaders,"ETag", makeETag(&sb, etag));
         }
-    } else if (!S_ISREG(sb.st_mode)) { // error if not regular file
-        sendStatusResponse(stream, Http_NotFound, NULL, responseHeaders);
+        unlockPath(filePath);
+    }
+    if (status != 0) {
+        unlinkat(dirFd, tmpName, 0);
+    }
+    close(dirFd);
+    if (status != 0) {
+        sendStatusResponse(stream, status, NULL, responseHeaders);
         return;
-    } else {
-        //delete file
-        remove(filePath);
+    }
+    reportContentChange(ContentEvent_Created, filePath, false);
+    // the directory entry must also reach the disk
+    if (commitPath(filePath) != 0) {
+        sendStatusResponse(stream, Http_InternalServerError, NULL, responseHeaders);
+        return;
+    }
+
+    if (exists) {
         sendStatusResponse(stream, Http_OK, NULL, responseHeaders);
+    } else {
+        putProperty(responseHeaders,"Location", uri);
+        sendStatusResponse(stream, Http_Created, NULL, responseHeaders);
     }
 }
 
+/**
+ * Check that a new file can be created in the nearest
+ * existing directory of a path.
+ *
+ * @param dirPath the directory path
+ * @return 0 if allowed, or the status of an error response
+ */
+static int check_writable_dir(const char *dirPath) {
+    char path[MAXPATHLEN];
+    strcpy(path, dirPath);
+    // directories that do not exist yet are created; the
+    // nearest one must be in the content tree
+    int dirFd;
+    while ((dirFd = openBeneath(path, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0) {
+        char *p = strrchr(path, '/');
+        if (errno == ENOTDIR) {
+            return Http_Conflict;
+        } else if ((errno != ENOENT) || (p == NULL) || (p == path)) {
+            return Http_Forbidden;
+        }
+        *p = '\0';
+    }
+    int status = (faccessat(dirFd, ".", W_OK|X_OK, 0) == 0) ? 0 : Http_Forbidden;
+    close(dirFd);
+    return status;
+}
 
 /**
- * Handle HEAD request.
+ * Decide whether a request may send its body, from its
+ * method, the target path and the request preconditions,
+ * so an upload that would fail is refused before any of
+ * it is read.
  *
- * @param the socket stream
+ * @param method the request method
  * @param uri the request URI
  * @param requestHeaders the request headers
- * @param responseHeaders the response headers
+ * @return 0 if the body is accepted, or the status of an error response
  */
-void do_put(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+int admit_body(const char *method, const char *uri, Properties *requestHeaders) {
     // get path to URI in file system
     char filePath[MAXPATHLEN];
     resolveUri(uri, filePath);
+    if (isUploadPath(filePath)) {
+        return Http_Forbidden;  // the files of uploads in progress
+    }
+    // the path is looked up relative to its directory, which
+    // must be in the content tree
+    char name[NAME_MAX+1];
+    struct stat sb;
+    int dirFd = openParentBeneath(filePath, name);
+    bool exists = (dirFd >= 0) && (statBeneath(dirFd, name, filePath, &sb) == 0);
+    bool writable = (dirFd >= 0) && (faccessat(dirFd, ".", W_OK|X_OK, 0) == 0);
+    int dirErr = (dirFd >= 0) ? 0 : errno;
+    if (dirFd >= 0) {
+        close(dirFd);
+    } else if ((dirErr == EXDEV) || (dirErr == ELOOP)) {
+        return Http_Forbidden;
+    }
+    char path[MAXPATHLEN];
+
+    if (strcasecmp(method, "PUT") == 0) {
+        if (exists && !S_ISREG(sb.st_mode)) {
+            return Http_MethodNotAllowed;
+        }
+        // a PUT does not create directories
+        if ((dirErr == ENOENT) || (dirErr == ENOTDIR)) {
+            return Http_Conflict;
+        } else if (!writable) {
+            return Http_Forbidden;
+        }
+        // a range must be valid and its body exactly the range
+        char contentRange[MAX_PROP_VAL];
+        if (findProperty(requestHeaders, 0, "Content-Range", contentRange) != SIZE_MAX) {
+            size_t first, last, total, length;
+            if (!parseContentRange(contentRange, &first, &last, &total)) {
+                return Http_BadRequest;
+            }
+            char contentLength[MAX_PROP_VAL];
+            if (   (findProperty(requestHeaders, 0, "Content-Length", contentLength) != SIZE_MAX)
+                && (parseSize(contentLength, strlen(contentLength), 10, &length) > 0)
+                && (length != last - first + 1)) {
+                return Http_BadRequest;
+            }
+        }
+        return check_preconditions(exists ? &sb : NULL, requestHeaders);
+    } else if (strcasecmp(method, "POST") == 0) {
+        char contentType[MAX_PROP_VAL];
+        enum FormEncoding encoding;
+        if (findProperty(requestHeaders, 0, "Content-Type", contentType) != SIZE_MAX) {
+            if (isMultipartForm(contentType)) {
+                // files of the form are stored in the directory
+                int fd = openBeneath(filePath, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+                if ((fd < 0) && ((errno == EXDEV) || (errno == ELOOP))) {
+                    return Http_Forbidden;
+                } else if (fd >= 0) {
+                    writable = (faccessat(fd, ".", W_OK|X_OK, 0) == 0);
+                    close(fd);
+                    if (!writable) {
+                        return Http_Forbidden;
+                    }
+                }
+                return 0;
+            } else if (findFormEncoding(contentType, &encoding)) {
+                return 0;
+            }
+        }
+        if (exists && !S_ISREG(sb.st_mode)) {
+            return Http_MethodNotAllowed;
+        }
+        if (getPath(filePath, path) != NULL) {
+            int status = check_writable_dir(path);
+            if (status != 0) {
+                return status;
+            }
+        }
+        return check_preconditions(exists ? &sb : NULL, requestHeaders);
+    } else if (   (strcasecmp(method, "GET") == 0) || (strcasecmp(method, "HEAD") == 0)
+               || (strcasecmp(method, "DELETE") == 0)) {
+        return 0;
+    }
+    return Http_NotImplemented;
+}
 
-    char buf[MAXBUF];
-    FILE* contentStream;
-    // ensure file exists
+/**
+ * Store a request body as one range of a file uploaded in
+ * parts, and send the response. Ranges are written to a
+ * staging file through their own descriptors, so several
+ * can arrive at once. Once the ranges cover the file, the
+ * staging file replaces it; until then the response is
+ * 202 Accepted with the committed ranges.
+ *
+ * @param stream the socket stream
+ * @param body the request body
+ * @param uri the request URI
+ * @param filePath the file path of the URI
+ * @param contentRange the Content-Range header value
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+static void store_range(FILE *stream, RequestBody *body, const char *uri, const char *filePath,
+                        const char *contentRange, Properties *requestHeaders, Properties *responseHeaders) {
+    // a body must declare its length or be chunked
+    if (!body->present) {
+        sendStatusResponse(stream, Http_LengthRequired, NULL, responseHeaders);
+        return;
+    }
+    // the body must be exactly the range
+    size_t first, last, total;
+    if (!parseContentRange(contentRange, &first, &last, &total)) {
+        sendStatusResponse(stream, Http_BadRequest, NULL, responseHeaders);
+        return;
+    }
+    size_t rangeLen = last - first + 1;
+    if (!body->chunked && (body->remaining != rangeLen)) {
+        sendStatusResponse(stream, Http_BadRequest, NULL, responseHeaders);
+        return;
+    }
+    if ((body->limit == 0) || (body->limit > rangeLen)) {
+        body->limit = rangeLen;
+    }
+    // the path is looked up relative to its directory, which
+    // must be in the content tree
+    char name[NAME_MAX+1];
     struct stat sb;
-    if (stat(filePath, &sb) == 0) {
-        putProperty(responseHeaders,"Location", filePath);
-        contentStream = fopen(filePath, "r");
-        if (contentStream == NULL) {
-            sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
+    int dirFd = openParentBeneath(filePath, name);
+    if (dirFd < 0) {
+        bool refused = (errno == EXDEV) || (errno == ELOOP) || (errno == EACCES);
+        sendStatusResponse(stream, refused ? Http_Forbidden : Http_Conflict, NULL, responseHeaders);
+        return;
+    }
+    bool isFile = (statBeneath(dirFd, name, filePath, &sb) != 0) || S_ISREG(sb.st_mode);
+    close(dirFd);
+    if (!isFile) {
+        sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
+        return;
+    }
+
+    // the first range of an upload records the size of the file
+    // and the staging file; ranges recorded for a staging file
+    // that is gone are void
+    UploadRanges ranges;
+    int status = 0;
+    struct stat stageSb;
+    char stagePath[MAXPATHLEN];
+    bool began = false;
+    lockPath(filePath);
+    int fd = openUpload(filePath);
+    if ((fd < 0) && ((errno == EXDEV) || (errno == ELOOP) || (errno == EACCES))) {
+        status = Http_Forbidden;  // not in the content tree
+    } else if ((fd < 0) || (fstat(fd, &stageSb) != 0)) {
+        status = Http_InternalServerError;
+    } else if (   !readUploadRanges(filePath, &ranges)
+               || (ranges.dev != stageSb.st_dev) || (ranges.ino != stageSb.st_ino)) {
+        ranges = (UploadRanges){.total = total, .dev = stageSb.st_dev, .ino = stageSb.st_ino};
+        if (writeUploadRanges(filePath, &ranges) != 0) {
+            status = Http_InternalServerError;
         } else {
-            sendStatusResponse(stream, Http_Created, NULL, responseHeaders);
+            began = true;
+        }
+    } else if (ranges.total != total) {
+        status = Http_Conflict;
+    }
+    unlockPath(filePath);
+    // HEAD looks up the staging file before reading the ranges
+    if (began && (makeUploadStagePath(filePath, stagePath) != NULL)) {
+        reportContentChange(ContentEvent_Created, stagePath, false);
+    }
+    if (status != 0) {
+        if (fd >= 0) {
+            close(fd);
         }
-        fclose(contentStream);
+        sendStatusResponse(stream, status, NULL, responseHeaders);
         return;
+    }
+
+    // write the range at its offset in the staging file
+    if (lseek(fd, (off_t)first, SEEK_SET) < 0) {
+        status = Http_InternalServerError;
+    } else if ((status = spliceRequestBody(body, fd)) == 0) {
+        if (body->length != rangeLen) {
+            status = Http_BadRequest;
+        } else if (commitFile(fd) != 0) {
+            status = Http_InternalServerError;
+        }
+    }
+    if ((close(fd) != 0) && (status == 0)) {
+        status = Http_InternalServerError;
+    }
+    if (status != 0) {
+        sendStatusResponse(stream, status, NULL, responseHeaders);
+        return;
+    }
+
+    // record the range, and replace the file once all are written,
+    // if the range was written to the staging file of the upload
+    bool complete = false;
+    bool exists = false;
+    char buf[MAX_PROP_VAL];
+    lockPath(filePath);
+    if (   !readUploadRanges(filePath, &ranges) || (ranges.total != total)
+        || (ranges.dev != stageSb.st_dev) || (ranges.ino != stageSb.st_ino)) {
+        status = Http_Conflict;  // the upload was ended meanwhile
+    } else if (!addUploadRange(&ranges, first, last)) {
+        status = Http_RangeNotSatisfiable;
+    } else if (!(complete = isUploadComplete(&ranges))) {
+        if (writeUploadRanges(filePath, &ranges) != 0) {
+            status = Http_InternalServerError;
+        } else {
+            putProperty(responseHeaders, "Upload-Ranges", formatUploadRanges(&ranges, buf));
+        }
+    } else if ((dirFd = openParentBeneath(filePath, name)) < 0) {
+        status = Http_Forbidden;
     } else {
-        contentStream = fopen(filePath, "w");
-        if (contentStream == NULL) {
-            sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
-        } else{
-            char key[64] = "Length Required";
-            int retIdx = findProperty(requestHeaders, 0, key, buf);
-            if (retIdx == SIZE_MAX) {
-                sendStatusResponse(stream, Http_LengthRequired, NULL, responseHeaders);
-            } else {
-                int bodylen = atoi(buf);
-                if (findProperty(requestHeaders, 0, "Body", buf) != SIZE_MAX) {
-                    fwrite(buf, 1, bodylen, contentStream);
-                    sendStatusResponse(stream, Http_OK, NULL, responseHeaders);
-                }
-            }
+        exists = (statBeneath(dirFd, name, filePath, &sb) == 0);
+        if (exists && !S_ISREG(sb.st_mode)) {
+            status = Http_MethodNotAllowed;
+        } else {
+            status = check_preconditions(exists ? &sb : NULL, requestHeaders);
         }
-        fclose(contentStream);
+        if ((status == 0) && (promoteUpload(filePath, total) != 0)) {
+            status = Http_InternalServerError;
+        }
+        if ((status == 0) && (statBeneath(dirFd, name, filePath, &sb) == 0)) {
+            putProperty(responseHeaders,"ETag", makeETag(&sb, buf));
+        }
+        close(dirFd);
+    }
+    unlockPath(filePath);
+    if (status != 0) {
+        sendStatusResponse(stream, status, NULL, responseHeaders);
+        return;
+    }
+    if (complete) {
+        reportContentChange(ContentEvent_Created, filePath, false);
     }
-}
 
+    // the ranges or the directory entry must also reach the disk
+    if (commitPath(filePath) != 0) {
+        sendStatusResponse(stream, Http_InternalServerError, NULL, responseHeaders);
+        return;
+    }
+    if (!complete) {
+        sendStatusResponse(stream, Http_Accepted, NULL, responseHeaders);
+        return;
+    }
+    if (exists) {
+        sendStatusResponse(stream, Http_OK, NULL, responseHeaders);
+    } else {
+        putProperty(responseHeaders,"Location", uri);
+        sendStatusResponse(stream, Http_Created, NULL, responseHeaders);
+    }
+}
 
 /**
- * Handle HEAD request.
+ * Handle PUT request.
  *
- * @param the socket stream
+ * @param stream the socket stream
+ * @param body the request body
  * @param uri the request URI
  * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_post(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+void do_put(FILE *stream, RequestBody *body, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
     // get path to URI in file system
     char filePath[MAXPATHLEN];
+    resolveUri(uri, filePath);
+
+    // the files of uploads in progress are not for requests
+    if (isUploadPath(filePath)) {
+        sendStatusResponse(stream, Http_Forbidden, NULL, responseHeaders);
+        return;
+    }
 
-    char buf[MAXBUF];
-    FILE* contentStream;
+    // a range of a file uploaded in parts
+    char contentRange[MAX_PROP_VAL];
+    if (findProperty(requestHeaders, 0, "Content-Range", contentRange) != SIZE_MAX) {
+        store_range(stream, body, uri, filePath, contentRange, requestHeaders, responseHeaders);
+        return;
+    }
 
-    char* p = strchr(filePath, '/');
-    p++;
-    strncpy(buf, filePath, p - filePath );
-    buf[p-filePath] = 0;
+    store_body(stream, body, uri, filePath, requestHeaders, responseHeaders);
+}
 
-    struct stat sb;
-    if (stat(buf, &sb) != 0) {
-        mkdir(buf,  0777);
+
+/**
+ * Send a page listing the fields and files of a form.
+ *
+ * @param stream the socket stream
+ * @param fields the field values by name
+ * @param files the stored file names by field name
+ * @param responseHeaders the response headers
+ */
+static void send_form_response(FILE *stream, Properties *fields, Properties *files, Properties *responseHeaders) {
+    FILE *tmp = tmpfile();
+    if (tmp == NULL) {
+        sendStatusResponse(stream, Http_InternalServerError, NULL, responseHeaders);
+        return;
+    }
+    fputs("<html>\n"
+          "<head><title>Form received</title></head>\n"
+          "<body>\n"
+          "  <h1>Form received</h1>\n"
+          "  <table>\n", tmp);
+    char name[MAX_PROP_NAME], val[MAX_PROP_VAL];
+    for (size_t i = 0; getProperty(fields, i, name, val); i++) {
+        fputs("  <tr><td>", tmp);
+        writeHtml(tmp, name);
+        fputs("</td><td>", tmp);
+        writeHtml(tmp, val);
+        fputs("</td></tr>\n", tmp);
     }
+    for (size_t i = 0; getProperty(files, i, name, val); i++) {
+        fputs("  <tr><td>", tmp);
+        writeHtml(tmp, name);
+        fputs("</td><td>file ", tmp);
+        writeHtml(tmp, val);
+        fputs("</td></tr>\n", tmp);
+    }
+    fputs("  </table>\n"
+          "</body>\n"
+          "</html>", tmp);
 
-    if (stat(filePath, &sb) == 0) {
-        contentStream = fopen(filePath, "w");
-        putProperty(responseHeaders,"Location", filePath);
-        sendStatusResponse(stream, Http_Created, NULL, responseHeaders);
-        fclose(contentStream);
+    char lenBuf[MAXBUF];
+    long contentLen = ftell(tmp);
+    rewind(tmp);
+    sprintf(lenBuf,"%ld", contentLen);
+    putProperty(responseHeaders,"Content-Length", lenBuf);
+    putProperty(responseHeaders, "Content-type", "text/html");
+    sendResponseStatus(stream, Http_OK, NULL);
+    sendResponseHeaders(stream, responseHeaders);
+    copyFileStreamBytes(tmp, stream, contentLen);
+    fclose(tmp);
+}
+
+/**
+ * Handle POST of a form. Files of a multipart/form-data
+ * form are stored in the directory of the request URI,
+ * and the response lists the fields and files received.
+ *
+ * @param stream the socket stream
+ * @param body the request body
+ * @param contentType the Content-Type header value
+ * @param filePath the file path of the URI
+ * @param responseHeaders the response headers
+ */
+static void do_post_form(FILE *stream, RequestBody *body, const char *contentType, const char *filePath, Properties *responseHeaders) {
+    // fields and files are released all at once
+    Arena *arena = newArena(FORM_ARENA_SIZE);
+    if (arena == NULL) {
+        sendStatusResponse(stream, Http_InternalServerError, NULL, responseHeaders);
+        return;
     }
+    Properties *fields = newArenaProperties(arena);
+    Properties *files = newArenaProperties(arena);
 
-    contentStream = fopen(filePath, "r");
-    if (contentStream == NULL) {
-        sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
+    enum FormEncoding encoding;
+    int status;
+    if (isMultipartForm(contentType)) {
+        status = readMultipartForm(body, contentType, filePath, server.max_part_size, fields, files);
+    } else if (findFormEncoding(contentType, &encoding)) {
+        status = readFormBody(body, encoding, fields);
     } else {
-        char key[64] = "Length Required";
-        int retIdx = findProperty(requestHeaders, 0, key, buf);
-        if (retIdx == SIZE_MAX) {
-            sendStatusResponse(stream, Http_LengthRequired, NULL, responseHeaders);
-        } else {
-            int bodylen = atoi(buf);
-            if (findProperty(requestHeaders, 0, "Body", buf) != SIZE_MAX) {
-                fwrite(buf, 1, bodylen, contentStream);
-                sendStatusResponse(stream, Http_OK, NULL, responseHeaders);
-            }
-        }
+        status = Http_UnsupportedMediaType;
+    }
+    if (status != 0) {
+        sendStatusResponse(stream, status, NULL, responseHeaders);
+    } else {
+        send_form_response(stream, fields, files, responseHeaders);
+    }
+    deleteArena(arena);
+}
+
+/**
+ * Handle POST request.
+ *
+ * @param stream the socket stream
+ * @param body the request body
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+void do_post(FILE *stream, RequestBody *body, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+    // get path to URI in file system
+    char filePath[MAXPATHLEN];
+    resolveUri(uri, filePath);
+
+    // the files of uploads in progress are not for requests
+    if (isUploadPath(filePath)) {
+        sendStatusResponse(stream, Http_Forbidden, NULL, responseHeaders);
+        return;
     }
-    fclose(contentStream);
+
+    // forms are decoded as they stream in
+    char contentType[MAX_PROP_VAL];
+    enum FormEncoding encoding;
+    if (   (findProperty(requestHeaders, 0, "Content-Type", contentType) != SIZE_MAX)
+        && (isMultipartForm(contentType) || findFormEncoding(contentType, &encoding))) {
+        do_post_form(stream, body, contentType, filePath, responseHeaders);
+        return;
+    }
+
+    // create directories of the path if needed
+    char path[MAXPATHLEN];
+    if (getPath(filePath, path) != NULL) {
+        mkdirsBeneath(path, 0777);
+    }
+
+    store_body(stream, body, uri, filePath, requestHeaders, responseHeaders);
 }
@@ -13,6 +13,7 @@
 
 #include <stdio.h>
 #include "properties.h"
+#include "request_body.h"
 
 /**
  * Handle HEAD request.
@@ -49,23 +50,38 @@ void do_delete(FILE *stream, const char *uri, Properties *requestHeaders, Proper
 
 
 /**
- * Handle HEAD request.
+ * Handle PUT request.
  *
- * @param the socket stream
+ * @param stream the socket stream
+ * @param body the request body
  * @param uri the request URI
  * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_put(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
+void do_put(FILE *stream, RequestBody *body, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
 
 
 
 /**
- * Handle HEAD request.
+ * Handle POST request.
  *
- * @param the socket stream
+ * @param stream the socket stream
+ * @param body the request body
  * @param uri the request URI
  * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_post(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
+void do_post(FILE *stream, RequestBody *body, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
+
+/**
+ * Decide whether a request may send its body, from its
+ * method, the target path and the request preconditions,
+ * so an upload that would fail is refused before any of
+ * it is read.
+ *
+ * @param method the request method
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @return 0 if the body is accepted, or the status of an error response
+ */
+int admit_body(const char *method, const char *uri, Properties *requestHeaders);
@@ -11,42 +11,236 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/param.h>
 #include "http_methods.h"
+#include "http_request.h"
 #include "http_util.h"
 #include "string_util.h"
 #include "time_util.h"
 #include "http_server.h"
 #include "http_codes.h"
+#include "request_class.h"
+#include "network_util.h"
+#include "coroutine.h"
+#include "arena.h"
+#include "connection.h"
+
+/** size of the first block of a request arena */
+#define REQUEST_ARENA_SIZE (16*1024)
+
+/** arena kept by each thread for its next request */
+static __thread Arena *freeArena = NULL;
 
 /**
- *  Process an http request.
- *  @param sock_fd the socket descriptor
+ * Get an arena for a new request, reusing the one
+ * kept by this thread if available.
+ * @return the arena or NULL if no space
  */
-void process_request(int sock_fd) {
+static Arena *acquire_arena(void) {
+	Arena *arena = freeArena;
+	if (arena != NULL) {
+		freeArena = NULL;
+		return arena;
+	}
+	return newArena(REQUEST_ARENA_SIZE);
+}
+
+/**
+ * Release the arena of a finished request, keeping
+ * it for the next request of this thread if none is.
+ * @param arena the arena
+ */
+static void release_arena(Arena *arena) {
+	if (freeArena == NULL) {
+		resetArena(arena);
+		freeArena = arena;
+	} else {
+		deleteArena(arena);
+	}
+}
+
+/**
+ * Release a request, keeping its connection for another
+ * request if allowed, and otherwise closing it. A body
+ * left unread would be taken for the next request, so
+ * its connection is closed.
+ * @param request the request
+ * @return true if the connection was kept
+ */
+static bool finish_request(HttpRequest *request) {
+	Connection *conn = request->conn;
+	bool keepAlive =    request->keepAlive && request->body.done
+					 && !ferror(conn->stream) && flushConnection(conn);
+	if (!keepAlive) {
+		// close socket stream (also closes socket)
+		deleteConnection(conn);
+	}
+	// release request state and headers all at once
+	release_arena(request->arena);
+	return keepAlive;
+}
+
+/**
+ * Returns true if a header has the specified value,
+ * ignoring case.
+ * @param headers the headers
+ * @param name the header name
+ * @param val the value
+ * @return true if the header has the value
+ */
+static bool header_is(Properties *headers, const char *name, const char *val) {
+	PropertyRef prop;
+	return    (findPropertyRef(headers, 0, name, &prop) != SIZE_MAX)
+		   && (prop.valLen == strlen(val))
+		   && (strncasecmp(prop.val, val, prop.valLen) == 0);
+}
+
+/**
+ * Decide whether the connection of a request can serve
+ * another request after this one. Connections are kept
+ * only by coroutines, since an idle connection would pin
+ * a pool thread, and only for HTTP/1.1 requests.
+ * @param request the request
+ * @param version the request protocol version
+ * @return true if the connection can be kept
+ */
+static bool keep_alive(HttpRequest *request, const char *version) {
+	return    inCoroutine()
+		   && (server.keep_alive_timeout > 0)
+		   && (strcmp(version, "HTTP/1.1") == 0)
+		   && !header_is(request->requestHeaders, "Connection", "close");
+}
+
+/**
+ * Close the connection of a request after its response,
+ * and tell the client so.
+ * @param request the request
+ */
+static void close_after(HttpRequest *request) {
+	if (request->keepAlive) {
+		request->keepAlive = false;
+		putProperty(request->responseHeaders, "Connection", "close");
+	}
+}
+
+/**
+ * Decide whether to read the body of a request before
+ * reading any of it. A client that sent "Expect:
+ * 100-continue" waits for a 100 Continue interim response
+ * before sending the body, so an upload that would be
+ * refused costs it nothing.
+ * @param request the request
+ * @param version the request protocol version
+ * @return 0 if the body is to be read, or the status of an error response
+ */
+static int admit_request(HttpRequest *request, const char *version) {
+	Properties *requestHeaders = request->requestHeaders;
+	PropertyRef prop;
+	bool expectContinue = false;
+	if (findPropertyRef(requestHeaders, 0, "Expect", &prop) != SIZE_MAX) {
+		if (!header_is(requestHeaders, "Expect", "100-continue")) {
+			return Http_ExpectationFailed;
+		}
+		// HTTP/1.0 clients do not wait for 100 Continue
+		expectContinue = (strcmp(version, "HTTP/1.1") == 0);
+	}
+	if (!request->body.present) {
+		return 0;
+	}
+
+	int status = admit_body(request->method, request->uri, requestHeaders);
+	if ((status == 0) && expectContinue && !request->body.done) {
+		FILE *stream = request->conn->stream;
+		sendResponseStatus(stream, Http_Continue, NULL);
+		fputs(CRLF, stream);
+		if (!flushConnection(request->conn)) {
+			status = Http_InternalServerError;
+		}
+	}
+	return status;
+}
+
+/**
+ *  Run a parsed request by its method.
+ *  @param request the request
+ *  @return true if the connection was kept
+ */
+static bool run_request(HttpRequest *request) {
+	FILE *stream = request->conn->stream;
+	const char *method = request->method;
+	const char *uri = request->uri;
+	Properties *requestHeaders = request->requestHeaders;
+	Properties *responseHeaders = request->responseHeaders;
+
+	// dispatch based on method
+	if (strcasecmp(method, "GET") == 0) {
+		do_get(stream, uri, requestHeaders, responseHeaders);
+	} else 	if (strcasecmp(method, "HEAD") == 0) {
+		do_head(stream, uri, requestHeaders, responseHeaders);
+    }
+    else if (strcasecmp(method, "DELETE") == 0) {
+        do_delete(stream, uri, requestHeaders, responseHeaders);
+    }
+    else if (strcasecmp(method, "PUT") == 0) {
+        do_put(stream, &request->body, uri, requestHeaders, responseHeaders);
+    }
+    else if (strcasecmp(method, "POST") == 0) {
+        do_post(stream, &request->body, uri, requestHeaders, responseHeaders);
+	} else {
+		sendStatusResponse(stream, Http_NotImplemented, NULL, responseHeaders);
+	}
+
+	// the client cannot find the end of a response without a length
+	// or chunks, and a handler may close the connection after all
+	PropertyRef prop;
+	if (   (   (findPropertyRef(responseHeaders, 0, "Content-Length", &prop) == SIZE_MAX)
+			&& !header_is(responseHeaders, "Transfer-Encoding", "chunked"))
+		|| header_is(responseHeaders, "Connection", "close")) {
+		request->keepAlive = false;
+	}
+	return finish_request(request);
+}
+
+/**
+ *  Dispatch a parsed request to its method.
+ *  @param request the request
+ */
+static void dispatch_request(HttpRequest *request) {
+	run_request(request);
+}
+
+/**
+ *  Read and serve one request on a connection.
+ *  @param conn the connection
+ *  @return true if the connection was kept for another request
+ */
+static bool serve_request(Connection *conn) {
 	char buf[MAXBUF];
 	char request[MAXBUF];
-	char method[MAXBUF];
-	char uri[MAXBUF], encUri[MAXBUF];
+	char encUri[MAXBUF];
 	char version[MAXBUF];
-
-	// open socket as a stream
-	FILE *stream = fdopen(sock_fd, "r+");
-	if (stream == NULL) {
-		perror("fdopen");
-		return;
-	}
-	// turn off buffering to also allow direct use of socket
-	setvbuf(stream, NULL, _IONBF, 0);
+	FILE *stream = conn->stream;
 
 	// get header line
 	if (fgets(request, MAXBUF, stream) == NULL) {
-		return;
+		deleteConnection(conn);
+		return false;
 	}
-	
+
+	// request state and headers live in an arena until the
+	// request is finished
+	Arena *arena = acquire_arena();
+	if (arena == NULL) {
+		deleteConnection(conn);
+		return false;
+	}
+	HttpRequest *req = allocArena(arena, sizeof(HttpRequest));
+	*req = (HttpRequest){.conn = conn, .arena = arena};
+
 	// eliminate newline from request
 	trim_newline(request);
 	// initialize request headers
-	Properties *responseHeaders = newProperties();
+	Properties *responseHeaders = req->responseHeaders = newArenaProperties(arena);
 	// name of server
 	putProperty(responseHeaders, "Server", server.server_name);
 	// date and time of this response
@@ -56,21 +250,37 @@ void process_request(int sock_fd) {
 				milliTimeToRFC_1123_Date_Time(timer, buf));
 
 	// parse header
-	if (sscanf(request, "%s %s %s", method, encUri, version) != 3) {
+	if (sscanf(request, "%s %s %s", req->method, encUri, version) != 3) {
 		if (server.debug) {
 			fprintf(stderr, "request header incomplete: %s\n", request);
 		}
+		putProperty(responseHeaders, "Connection", "close");
 		sendStatusResponse(stream, Http_BadRequest, NULL, responseHeaders);
-		return;
+		return finish_request(req);
 	}
 
 	// initialize request headers
-	Properties *requestHeaders = newProperties();
+	Properties *requestHeaders = req->requestHeaders = newArenaProperties(arena);
 	readRequestHeaders(stream, requestHeaders);
 	if (server.debug) {
 		debugRequest(request, requestHeaders);
 	}
 
+	// tell the client if the connection closes after the response
+	req->keepAlive = keep_alive(req, version);
+	if (!req->keepAlive) {
+		putProperty(responseHeaders, "Connection", "close");
+	}
+
+	// find the framing of the body, refusing one that is
+	// too large before reading it
+	int status = openRequestBody(&req->body, conn, requestHeaders, server.max_body_size);
+	if (status != 0) {
+		close_after(req);
+		sendStatusResponse(stream, status, NULL, responseHeaders);
+		return finish_request(req);
+	}
+
 	// save query parameters as request header key "?"
 	char *p = strpbrk(encUri,"?&");  // query separators
 	if (p != NULL) {
@@ -78,39 +288,59 @@ void process_request(int sock_fd) {
 		*p = '\0';
 	}
 
-	// unescape URI
-	if (unescapeUri(encUri, uri) == NULL) {
+	// unescape URI, removing dot segments so that it stays
+	// in the content base
+	if ((unescapeUri(encUri, req->uri) == NULL) || (normalizeUriPath(req->uri) == NULL)) {
 		if (server.debug) {
-			fprintf(stderr, "request header invalid URI encoding %s\n", request);
+			fprintf(stderr, "request header invalid URI %s\n", request);
 		}
 		sendStatusResponse(stream, Http_BadRequest, NULL, responseHeaders);
-		return;
+		return finish_request(req);
 	}
 
-	// dispatch based on method
-	if (strcasecmp(method, "GET") == 0) {
-		do_get(stream, uri, requestHeaders, responseHeaders);
-	} else 	if (strcasecmp(method, "HEAD") == 0) {
-		do_head(stream, uri, requestHeaders, responseHeaders);
-    }
-    else if (strcasecmp(method, "DELETE") == 0) {
-        do_delete(stream, uri, requestHeaders, responseHeaders);
-    }
-    else if (strcasecmp(method, "PUT") == 0) {
-        do_put(stream, uri, requestHeaders, responseHeaders);
-    }
-    else if (strcasecmp(method, "POST") == 0) {
-        do_post(stream, uri, requestHeaders, responseHeaders);
-	} else {
-		sendStatusResponse(stream, Http_NotImplemented, NULL, responseHeaders);
+	// refuse an upload or send 100 Continue before its body
+	if ((status = admit_request(req, version)) != 0) {
+		if (!req->body.done) {
+			close_after(req);  // the body is not read
+		}
+		sendStatusResponse(stream, status, NULL, responseHeaders);
+		return finish_request(req);
 	}
 
-	// delete headers
-	deleteProperties(requestHeaders);
-	deleteProperties(responseHeaders);
-	// close socket stream
-	fflush(stream);
-	fclose(stream);
-	close(sock_fd);
+	// hand bulk requests to their own job class so they cannot
+	// hold up small requests queued behind them; coroutines do
+	// not hold up others while waiting, so they run them inline
+	char filePath[MAXPATHLEN];
+	resolveUri(req->uri, filePath);
+	enum RequestClass requestClass = classifyRequest(req->method, req->uri, filePath);
+	if ((requestClass != Request_Interactive) && !inCoroutine()) {
+		if (thpool_add_work_flow(requestPool, requestClass, conn->client, (void*)dispatch_request, req) == 0) {
+			return false;
+		}
+	}
+
+	return run_request(req);
 }
 
+/**
+ *  Process the requests of a connection.
+ *  @param sock_fd the socket descriptor
+ */
+void process_request(int sock_fd) {
+	Connection *conn = newConnection(sock_fd);
+	if (conn == NULL) {
+		perror("newConnection");
+		close(sock_fd);
+		return;
+	}
+
+	// serve requests until the connection closes or stays
+	// idle too long; its buffers are released while idle
+	int timeoutMs = (int)server.keep_alive_timeout * 1000;
+	while (serve_request(conn)) {
+		if (!waitConnection(conn, timeoutMs)) {
+			deleteConnection(conn);
+			return;
+		}
+	}
+}
@@ -10,6 +10,25 @@
 #ifndef HTTP_REQUEST_H_
 #define HTTP_REQUEST_H_
 
+#include <stdio.h>
+#include "http_server.h"
+#include "properties.h"
+#include "arena.h"
+#include "connection.h"
+#include "request_body.h"
+
+/** A parsed request waiting to be dispatched to its method */
+typedef struct HttpRequest {
+	Connection *conn;            /** the client connection */
+	bool keepAlive;              /** keep the connection for another request */
+	char method[MAXBUF];         /** the request method */
+	char uri[MAXBUF];            /** the unescaped request URI */
+	Properties *requestHeaders;  /** the request headers */
+	Properties *responseHeaders; /** the response headers */
+	RequestBody body;            /** the request body */
+	Arena *arena;                /** storage for the request and headers */
+} HttpRequest;
+
 /**
  *  Process an http request.
  *  @param sock_fd the socket descriptor
@@ -13,6 +13,9 @@
 #include <string.h>
 #include <unistd.h>
 #include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
 #include "file_util.h"
 #include "time_util.h"
 #include "http_request.h"
@@ -20,6 +23,14 @@
 #include "properties.h"
 #include "http_server.h"
 #include "media_util.h"
+#include "http_codes.h"
+#include "http_util.h"
+#include "request_class.h"
+#include "coroutine.h"
+#include "durability.h"
+#include "content_watch.h"
+#include "negative_cache.h"
+#include "content_index.h"
 #include <pthread.h>
 #include "../thpool_src/thpool.h"
 
@@ -28,7 +39,13 @@
 
 /** http server configuration */
 struct http_server_conf server;
-Properties* mediaTypeProperty;
+
+/** thread pool that runs requests */
+threadpool requestPool;
+
+/** pre-rendered response to connections shed under overload */
+static char overloadResponse[MAX_PROP_VAL];
+static size_t overloadResponseLen;
 
 
 /**
@@ -38,11 +55,11 @@ Properties* mediaTypeProperty;
  */
 static bool process_config(const char* configFileName) {
 	bool status = true;
-	Properties* httpConfig = newProperties();
+	Properties* httpConfig = NULL;
 
 	do {
-		// load properties from config file
-		if (loadProperties(configFileName, httpConfig) == 0) {
+		// load properties from config file through its snapshot
+		if ((httpConfig = mapProperties(configFileName, loadProperties)) == NULL) {
 			fprintf(stderr, "Missing configuration file '%s'\n", configFileName);
 			status = false;
 			break;
@@ -73,20 +90,16 @@ static bool process_config(const char* configFileName) {
 				break;
 			}
 		}
+        // media types are compiled from mime.types; a ContentTypes
+        // file overrides them
         char mediaTypeConfigFile[MAX_PROP_VAL];
-        mediaTypeProperty = NULL;
-        int entries;
         if (findProperty(httpConfig, 0, "ContentTypes", mediaTypeConfigFile) != SIZE_MAX) {
-            entries = readMediaTypes(mediaTypeConfigFile);
-        }
-        else {
-            entries = readMediaTypes("mime.types");
-        }
-        if (entries == 0) {
-            status = false;
-            break;
+            if (readMediaTypes(mediaTypeConfigFile) == 0) {
+                fprintf(stderr, "Invalid ContentTypes %s\n", mediaTypeConfigFile);
+                status = false;
+                break;
+            }
         }
-        storeProperties("mime.type.test", mediaTypeProperty);
 		// initialize the listener port
 		server.server_port = DEFAULT_HTTP_PORT;
 		char listenProp[MAX_PROP_VAL];
@@ -103,6 +116,10 @@ static bool process_config(const char* configFileName) {
 		static char contentBaseProp[MAX_PROP_VAL] = "content";
 		server.content_base = contentBaseProp;
 		findProperty(httpConfig, 0, "ContentBase", contentBaseProp);
+		server.content_base_len = strlen(contentBaseProp);
+		while ((server.content_base_len > 1) && (contentBaseProp[server.content_base_len-1] == '/')) {
+			server.content_base_len--;
+		}
 
 		// set server host property or use default "localhost"
 		static char serverHostProp[MAX_PROP_VAL] = "localhost";
@@ -122,12 +139,246 @@ static bool process_config(const char* configFileName) {
 		server.server_protocol = serverProtocolProp;
 		findProperty(httpConfig, 0, "ServerProtocol", serverProtocolProp);
 
+		// read rules for scheduling classes of requests
+		if (!readRequestClasses(httpConfig)) {
+			status = false;
+			break;
+		}
+
+		// bound the connection queue and shed connections that would
+		// wait too long, or use defaults: 1024 queued, 5ms for 100ms
+		server.queue_limit = 1024;
+		server.queue_target = 5;
+		server.queue_interval = 100;
+		server.retry_after = 1;
+		if (   !findIntProperty(httpConfig, "QueueLimit", 0, &server.queue_limit)
+			|| !findIntProperty(httpConfig, "QueueTarget", 0, &server.queue_target)
+			|| !findIntProperty(httpConfig, "QueueInterval", 0, &server.queue_interval)
+			|| !findIntProperty(httpConfig, "RetryAfter", 0, &server.retry_after)) {
+			status = false;
+			break;
+		}
+
+		// share threads fairly between client addresses, or use
+		// default of at most 4 threads serving any one client
+		server.client_threads = 4;
+		if (!findIntProperty(httpConfig, "ClientThreads", 0, &server.client_threads)) {
+			status = false;
+			break;
+		}
+
+		// serve connections as coroutines on event loop threads if
+		// specified, by default 4 threads and 64K coroutine stacks,
+		// the least that serves every request
+		char coroutinesProp[MAX_PROP_VAL];
+		if (findProperty(httpConfig, 0, "Coroutines", coroutinesProp) != SIZE_MAX) {
+			server.coroutines = (strcasecmp(coroutinesProp, "true") == 0);
+		}
+		server.coroutine_threads = 4;
+		server.coroutine_stack_size = CO_STACK_SIZE;
+		if (   !findIntProperty(httpConfig, "CoroutineThreads", 1, &server.coroutine_threads)
+			|| !findIntProperty(httpConfig, "CoroutineStackSize", CO_STACK_SIZE, &server.coroutine_stack_size)) {
+			status = false;
+			break;
+		}
+
+		// coroutines keep idle connections for another request
+		// for KeepAliveTimeout seconds, by default 5
+		server.keep_alive_timeout = 5;
+		if (!findIntProperty(httpConfig, "KeepAliveTimeout", 0, &server.keep_alive_timeout)) {
+			status = false;
+			break;
+		}
+
+		// refuse request bodies over MaxBodySize bytes and form
+		// parts over MaxPartSize bytes, by default none
+		server.max_body_size = 0;
+		server.max_part_size = 0;
+		if (   !findIntProperty(httpConfig, "MaxBodySize", 0, &server.max_body_size)
+			|| !findIntProperty(httpConfig, "MaxPartSize", 0, &server.max_part_size)) {
+			status = false;
+			break;
+		}
+
+		// sync stored files before answering each request, sync
+		// them by batches of requests if "batched", or leave it
+		// to the operating system if "none"
+		server.durability = Durability_Request;
+		char durabilityProp[MAX_PROP_VAL];
+		if (findProperty(httpConfig, 0, "Durability", durabilityProp) != SIZE_MAX) {
+			if (strcasecmp(durabilityProp, "none") == 0) {
+				server.durability = Durability_None;
+			} else if (strcasecmp(durabilityProp, "batched") == 0) {
+				server.durability = Durability_Batched;
+			} else if (strcasecmp(durabilityProp, "request") != 0) {
+				fprintf(stderr, "Invalid Durability %s\n", durabilityProp);
+				status = false;
+				break;
+			}
+		}
+
+		// a batch syncs after waiting DurabilityBatchDelay ms for
+		// more requests, or at once when DurabilityBatchSize have
+		// joined it, by default 2ms or 64 requests
+		server.durability_batch_delay = 2;
+		server.durability_batch_size = 64;
+		if (   !findIntProperty(httpConfig, "DurabilityBatchDelay", 0, &server.durability_batch_delay)
+			|| !findIntProperty(httpConfig, "DurabilityBatchSize", 1, &server.durability_batch_size)) {
+			status = false;
+			break;
+		}
+
+		// answer requests for paths found missing within the last
+		// NegativeCacheTtl ms without looking again, by default 1000ms,
+		// and if NegativeCacheBloom is "true", for paths not in a filter
+		// of the content tree sized for NegativeCacheBloomSize paths
+		char bloomProp[MAX_PROP_VAL];
+		if (findProperty(httpConfig, 0, "NegativeCacheBloom", bloomProp) != SIZE_MAX) {
+			server.negative_cache_bloom = (strcasecmp(bloomProp, "true") == 0);
+		}
+		server.negative_cache_ttl = 1000;
+		server.negative_cache_bloom_size = 1048576;
+		if (   !findIntProperty(httpConfig, "NegativeCacheTtl", 0, &server.negative_cache_ttl)
+			|| !findIntProperty(httpConfig, "NegativeCacheBloomSize", 1, &server.negative_cache_bloom_size)) {
+			status = false;
+			break;
+		}
+
+		// if ContentIndex is "true", look paths up in an index of the
+		// content tree, opening files relative to up to ContentIndexDirFds
+		// directory descriptors, by default 256
+		char indexProp[MAX_PROP_VAL];
+		if (findProperty(httpConfig, 0, "ContentIndex", indexProp) != SIZE_MAX) {
+			server.content_index = (strcasecmp(indexProp, "true") == 0);
+		}
+		server.content_index_dir_fds = 256;
+		if (!findIntProperty(httpConfig, "ContentIndexDirFds", 0, &server.content_index_dir_fds)) {
+			status = false;
+			break;
+		}
+
 	} while(false);
 
-	deleteProperties(httpConfig);
+	if (httpConfig != NULL) {
+		deleteProperties(httpConfig);
+	}
 	return status;
 }
 
+/**
+ * Render the response to connections shed under overload.
+ * It is rendered once so the acceptor can send it without
+ * parsing the request or involving a worker thread.
+ */
+static void render_overload_response(void) {
+	const char *statusMsg = httpCodeStr(Http_ServiceUnavailable);
+	char body[2*MAXBUF];
+	sprintf(body, "<html>"
+			"<head><title>%d %s</title></head>"
+			"<body>%d %s</body></html>",
+			Http_ServiceUnavailable, statusMsg, Http_ServiceUnavailable, statusMsg);
+	overloadResponseLen = snprintf(overloadResponse, sizeof(overloadResponse),
+			"%s %d %s%s"
+			"Server: %s%s"
+			"Retry-After: %ld%s"
+			"Connection: close%s"
+			"Content-Length: %lu%s"
+			"Content-type: text/html%s"
+			"%s%s",
+			server.server_protocol, Http_ServiceUnavailable, statusMsg, CRLF,
+			server.server_name, CRLF,
+			server.retry_after, CRLF,
+			CRLF,
+			strlen(body), CRLF,
+			CRLF,
+			CRLF, body);
+}
+
+/**
+ * Turn away a connection with the pre-rendered overload response.
+ * @param socket_fd the client socket
+ */
+static void shed_connection(int socket_fd) {
+	// consume request bytes already received so closing
+	// the socket does not reset the connection
+	char buf[MAX_PROP_VAL];
+	while (recv(socket_fd, buf, sizeof(buf), MSG_DONTWAIT) > 0) {}
+
+	send(socket_fd, overloadResponse, overloadResponseLen, MSG_DONTWAIT | MSG_NOSIGNAL);
+	shutdown(socket_fd, SHUT_WR);
+	close(socket_fd);
+}
+
+/**
+ * Coroutine that processes a request from a connection.
+ * @param arg the socket descriptor
+ */
+static void coroutine_request(void *arg) {
+	process_request((int)(intptr_t)arg);
+}
+
+/**
+ * Coroutine that accepts connections on the shared non-blocking
+ * listener socket and starts a coroutine for each of them.
+ * @param arg the listener socket descriptor
+ */
+static void coroutine_acceptor(void *arg) {
+	int listen_sock_fd = (int)(intptr_t)arg;
+	for (;;) {
+		int socket_fd = accept(listen_sock_fd, NULL, NULL);
+		if (socket_fd < 0) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+				coWaitFd(listen_sock_fd, POLLIN);
+			} else if (errno != EINTR) {
+				perror("accept");
+			}
+			continue;
+		}
+		fcntl(socket_fd, F_SETFL, O_NONBLOCK);
+		set_socket_nosigpipe(socket_fd);
+		if (server.debug) {
+			fprintf(stderr, "New connection accepted by coroutine\n");
+		}
+		if (!coSpawn(currentCoScheduler(), coroutine_request, (void*)(intptr_t)socket_fd)) {
+			shed_connection(socket_fd);
+		}
+	}
+}
+
+/**
+ * Event loop thread that runs connection coroutines.
+ * @param arg the listener socket descriptor
+ * @return NULL when done
+ */
+static void *coroutine_thread(void *arg) {
+	CoScheduler *sched = newCoScheduler(server.coroutine_stack_size, requestPool);
+	if (sched == NULL) {
+		fprintf(stderr, "Coroutines not available\n");
+		exit(EXIT_FAILURE);
+	}
+	coSpawn(sched, coroutine_acceptor, arg);
+	coRun(sched);
+	deleteCoScheduler(sched);
+	return NULL;
+}
+
+/**
+ * Serve connections as coroutines on event loop threads,
+ * which share the listener socket.
+ * @param listen_sock_fd the listener socket
+ */
+static void run_coroutine_threads(int listen_sock_fd) {
+	fcntl(listen_sock_fd, F_SETFL, O_NONBLOCK);
+	pthread_t threads[server.coroutine_threads];
+	for (int i = 0; i < server.coroutine_threads; i++) {
+		pthread_create(&threads[i], NULL, coroutine_thread, (void*)(intptr_t)listen_sock_fd);
+	}
+	fprintf(stderr, "Serving coroutines on %ld threads\n", server.coroutine_threads);
+	for (int i = 0; i < server.coroutine_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+}
+
 /**
  * Main program starts the server and processes requests
  * @param argc argument count
@@ -157,12 +408,49 @@ int main(int argc, char* argv[argc]) {
 	}
 
 	// create thread pool
-    struct thpool_* pool = thpool_init(THREAD_POOL_SIZE);
+    requestPool = thpool_init(THREAD_POOL_SIZE);
     fprintf( stderr, "Pool started with %d threads ", THREAD_POOL_SIZE );
+    initRequestClasses(requestPool, THREAD_POOL_SIZE);
+    thpool_set_limit(requestPool, Request_Interactive,
+                     server.queue_limit, server.queue_target, server.queue_interval);
+    thpool_set_flow_limit(requestPool, Request_Interactive, server.client_threads);
+    thpool_set_flow_limit(requestPool, Request_Bulk, server.client_threads);
+    render_overload_response();
+
+	// start syncing batches of stored files if needed
+	if (!startDurability()) {
+		perror("startDurability");
+		return EXIT_FAILURE;
+	}
+
+	// open files beneath the content base
+	if (!openContentBase()) {
+		perror("openContentBase");
+		return EXIT_FAILURE;
+	}
 
+	// remember missing paths and index the content tree,
+	// watching it for changes
+	if (!initNegativeCache()) {
+		perror("initNegativeCache");
+		return EXIT_FAILURE;
+	}
+	if (!initContentIndex()) {
+		perror("initContentIndex");
+		return EXIT_FAILURE;
+	}
+	if (!startContentWatch()) {
+		perror("startContentWatch");
+		return EXIT_FAILURE;
+	}
 
+	if (server.coroutines) {
+		// event loop threads accept and serve connections; the
+		// pool then only runs calls offloaded by coroutines
+		run_coroutine_threads(listen_sock_fd);
+	}
 
-	while (true) {
+	while (!server.coroutines) {
         // accept client connection
 		int socket_fd = accept_peer_connection(listen_sock_fd);
 
@@ -175,10 +463,18 @@ int main(int argc, char* argv[argc]) {
 				fprintf(stderr, "New connection accepted  %s:%u\n", host, port);
 			}
 		}
-		// add jobs to thread pool
+		// add jobs to thread pool, queued fairly by client address
         // handle request
-        if ( thpool_add_work(pool, (void*)process_request, (void*)socket_fd) != 0 ){
+        unsigned long client = get_peer_address(socket_fd);
+        int status = thpool_offer_work(requestPool, Request_Interactive, client, (void*)process_request, (void*)socket_fd);
+        if (status == THPOOL_SHED) {
+            if (server.debug) {
+                fprintf(stderr, "Overloaded: shedding connection\n");
+            }
+            shed_connection(socket_fd);
+        } else if ( status != 0 ){
             printf( "Job add error." );
+            close(socket_fd);
         }
         // int thpool_add_work(thpool_* thpool_p, void (*function_p)(void*), void* arg_p)
 
@@ -188,12 +484,11 @@ int main(int argc, char* argv[argc]) {
     }
 
     // destroy the threadpool
-    thpool_destroy(pool);
+    thpool_destroy(requestPool);
 
     // close listener socket
     close(listen_sock_fd);
-	if (mediaTypeProperty != NULL)
-	    deleteProperties(mediaTypeProperty);
+	freeMediaTypes();
     return EXIT_SUCCESS;
 
 }
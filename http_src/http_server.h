@@ -12,6 +12,7 @@
 
 #include <stdbool.h>
 #include "properties.h"
+#include "thpool.h"
 
 /** maximum buffer size */
 #define MAXBUF 256
@@ -19,6 +20,13 @@
 /** web newline sequence */
 #define CRLF "\r\n"
 
+/** When stored files are synced to disk */
+enum Durability {
+	Durability_None    = 0,  //!< left to the operating system
+	Durability_Request = 1,  //!< before each request is answered
+	Durability_Batched = 2   //!< by batches of requests, before they are answered
+};
+
 /** http server config properties */
 struct http_server_conf {
 	/** debug flag */
@@ -27,6 +35,9 @@ struct http_server_conf {
 	/** path to web content directory */
 	const char *content_base;
 
+	/** length of content_base without a trailing '/' */
+	size_t content_base_len;
+
 	/** name of http server */
 	const char* server_name;
 
@@ -38,10 +49,70 @@ struct http_server_conf {
 
 	/** http response protocol */
 	const char* server_protocol;
+
+	/** maximum queued connections (0 for no limit) */
+	long queue_limit;
+
+	/** acceptable connection queueing time in ms (0 for no shedding) */
+	long queue_target;
+
+	/** time in ms queueing may exceed the target before shedding */
+	long queue_interval;
+
+	/** seconds a shed client is told to wait before retrying */
+	long retry_after;
+
+	/** maximum threads serving one client address (0 for no limit) */
+	long client_threads;
+
+	/** serve connections as coroutines on event loop threads */
+	bool coroutines;
+
+	/** number of event loop threads running coroutines */
+	long coroutine_threads;
+
+	/** stack size of each connection coroutine */
+	long coroutine_stack_size;
+
+	/** seconds an idle connection waits for another request (0 to close) */
+	long keep_alive_timeout;
+
+	/** maximum request body size in bytes (0 for no limit) */
+	long max_body_size;
+
+	/** maximum size of a part of a form in bytes (0 for no limit) */
+	long max_part_size;
+
+	/** when files stored by requests are synced to disk */
+	enum Durability durability;
+
+	/** time in ms a batch of requests waits for more before syncing */
+	long durability_batch_delay;
+
+	/** number of requests that syncs a batch without waiting */
+	long durability_batch_size;
+
+	/** time in ms a path found missing is remembered (0 for none) */
+	long negative_cache_ttl;
+
+	/** keep a Bloom filter of the paths in the content tree */
+	bool negative_cache_bloom;
+
+	/** number of paths the Bloom filter is sized for */
+	long negative_cache_bloom_size;
+
+	/** keep an index of the content tree in memory */
+	bool content_index;
+
+	/** number of directory descriptors the index keeps open */
+	long content_index_dir_fds;
 };
 
 /**  external declaration of server config */
 extern struct http_server_conf server;
 
+/**  external declaration of request thread pool */
+extern threadpool requestPool;
+
 
 #endif /* HTTP_SERVER_H */
@@ -7,13 +7,26 @@
  *  @author: Philip Gust
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include "properties.h"
+#include <strings.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+#endif
 #include "file_util.h"
+#include "properties.h"
 #include "string_util.h"
 #include "http_codes.h"
 #include "http_server.h"
+#include "form_decoder.h"
 
 
 /**
@@ -73,11 +86,11 @@ void sendResponseStatus(FILE *ostream, int status, const char *statusMsg) {
  */
 void sendResponseHeaders(FILE *ostream, Properties *responseHeaders) {
 	// output headers
-	char name[MAX_PROP_NAME], val[MAX_PROP_VAL];
-	for (int i = 0; getProperty(responseHeaders, i, name, val); i++) {
-		fprintf(ostream, "%s: %s%s", name, val, CRLF);
+	PropertyRef prop;
+	for (size_t i = 0; getPropertyRef(responseHeaders, i, &prop); i++) {
+		fprintf(ostream, "%.*s: %.*s%s", (int)prop.nameLen, prop.name, (int)prop.valLen, prop.val, CRLF);
     	if (server.debug) {
-    		fprintf(stderr, "%s: %s\n", name, val);
+    		fprintf(stderr, "%.*s: %.*s\n", (int)prop.nameLen, prop.name, (int)prop.valLen, prop.val);
     	}
 	}
 
@@ -109,7 +122,6 @@ void sendStatusResponse(FILE* ostream, int status, const char *statusMsg, Proper
 	    "<head><title>%d %s</title></head>"
 	    "<body>%d %s</body></html>";
 	sprintf(errorBody, errorPage, status, statusMsg, status, statusMsg);
-	FILE *tmpStream = tmpStringFile(errorBody);
 
 	char buf[MAXBUF];
 	size_t contentLen = strlen(errorBody);
@@ -121,35 +133,77 @@ void sendStatusResponse(FILE* ostream, int status, const char *statusMsg, Proper
 	sendResponseHeaders(ostream, responseHeaders);
 
 	// Send the error page body.
-	copyFileStreamBytes(tmpStream, ostream, contentLen);
-	fclose(tmpStream);
+	fwrite(errorBody, 1, contentLen, ostream);
 }
 
 /**
  * Decode a URI string by replacing %xx with the
  * corresponding character code and '+' with " ".
-z * @param escUrl the esc URI
+ * @param escUrl the esc URI
  * @param uri the decoded URI
  * @return the URL if successful, NULL if error
  */
 char *unescapeUri(const char *escUri, char *uri) {
 	char *p = uri;
-	while (*escUri) {
-		if ( *escUri == '%') {
-            int c;
-            if (sscanf(escUri, "%%%02x", &c) == 0) {
-                return NULL;
-            }
-            *p++ = (unsigned char) c;
-            escUri += 3;
-        } else if (*escUri == '+') { // spaces encoded as "+"
-		    *p++ = ' ';
-            escUri++;
+	for (const unsigned char *s = (const unsigned char*)escUri; *s != '\0'; ) {
+		if (*s == '%') {
+			// both hex digits must be valid; an escaped NUL
+			// would truncate the URI
+			int hi = hexValues[s[1]];
+			int lo = (hi == 0) ? 0 : hexValues[s[2]];
+			if ((lo == 0) || ((hi == 1) && (lo == 1))) {
+				return NULL;
+			}
+			*p++ = (char)(((hi-1) << 4) | (lo-1));
+			s += 3;
+		} else if (*s == '+') { // spaces encoded as "+"
+			*p++ = ' ';
+			s++;
+		} else {
+			*p++ = *s++;
+		}
+	}
+	*p = '\0';
+	return uri;
+}
+
+/**
+ * Remove the "." and ".." segments of a URI path in place,
+ * as RFC 3986 does, so a ".." never leaves the root and
+ * the path cannot name a file outside the content base.
+ * Repeated '/' are collapsed, so a file has one path.
+ * @param uri the URI path
+ * @return the URI path if successful, NULL if not absolute
+ */
+char *normalizeUriPath(char *uri) {
+	if (uri[0] != '/') {
+		return NULL;
+	}
+	char *out = uri;  // end of the path kept
+	const char *in = uri;
+	while (*in != '\0') {  // at the '/' before a segment
+		const char *seg = in + 1;
+		size_t len = strcspn(seg, "/");
+		if ((len == 0) && (seg[0] == '/')) {  // empty segment
+			in = seg;
+			continue;
+		} else if ((len == 1) && (seg[0] == '.')) {
+			in = seg + 1;
+		} else if ((len == 2) && (seg[0] == '.') && (seg[1] == '.')) {
+			while ((out > uri) && (*--out != '/')) {  // drop the last segment
+			}
+			in = seg + 2;
 		} else {
-			*p++ = *escUri++;
+			memmove(out, in, len + 1);
+			out += len + 1;
+			in = seg + len;
+			continue;
+		}
+		if (*in == '\0') {  // a dot segment last names a directory
+			*out++ = '/';
 		}
 	}
-	*p++ = '\0';
+	*out = '\0';
 	return uri;
 }
 
@@ -165,6 +219,255 @@ char *resolveUri(const char *uri, char *fspath) {
 	return fspath;
 }
 
+/** descriptor of the content base, or -1 if not open */
+static int contentBaseFd = -1;
+
+/** openat2() is supported */
+static bool hasOpenat2 = true;
+
+/**
+ * Open the content base, so files are opened beneath it.
+ *
+ * @return true if successful, false with errno set if error
+ */
+bool openContentBase(void) {
+	contentBaseFd = open(server.content_base, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	return (contentBaseFd >= 0);
+}
+
+/**
+ * Open a path in the content tree, refusing one that
+ * leaves the tree through ".." or a symbolic link if the
+ * kernel supports openat2(). Otherwise the whole path is
+ * resolved, and only the removal of dot segments from
+ * request URIs keeps it in the tree.
+ *
+ * @param filePath the file path
+ * @param flags the open() flags, without O_CREAT
+ * @return the file descriptor, or -1 with errno set if error
+ */
+int openBeneath(const char *filePath, int flags) {
+#if defined(SYS_openat2)
+	size_t baseLen = server.content_base_len;
+	if (   (contentBaseFd >= 0) && __atomic_load_n(&hasOpenat2, __ATOMIC_RELAXED)
+		&& (strncmp(filePath, server.content_base, baseLen) == 0)
+		&& ((filePath[baseLen] == '/') || (filePath[baseLen] == '\0'))) {
+		const char *rel = filePath + baseLen;
+		while (*rel == '/') {  // relative to the base
+			rel++;
+		}
+		struct open_how how = {
+			.flags = (unsigned)flags,
+			.resolve = RESOLVE_BENEATH|RESOLVE_NO_MAGICLINKS
+		};
+		int fd = syscall(SYS_openat2, contentBaseFd, (*rel == '\0') ? "." : rel, &how, sizeof(how));
+		if ((fd >= 0) || (errno != ENOSYS)) {
+			return fd;
+		}
+		__atomic_store_n(&hasOpenat2, false, __ATOMIC_RELAXED);
+	}
+#endif
+	return open(filePath, flags);
+}
+
+/**
+ * Open the directory of a path in the content tree as
+ * openBeneath() does, so the entry for the path can be
+ * changed relative to it. A directory path may end with
+ * '/'; the content base itself has no directory.
+ *
+ * @param filePath the file path
+ * @param name buffer of NAME_MAX+1 for the last component
+ * @return the directory descriptor, or -1 with errno set if error
+ */
+int openParentBeneath(const char *filePath, char *name) {
+	size_t len = strlen(filePath);
+	while ((len > 0) && (filePath[len-1] == '/')) {
+		len--;
+	}
+	size_t start = len;
+	while ((start > 0) && (filePath[start-1] != '/')) {
+		start--;
+	}
+	if ((start == 0) || (start <= server.content_base_len)) {
+		errno = EACCES;
+		return -1;
+	} else if ((len - start > NAME_MAX) || (start >= MAXPATHLEN)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memcpy(name, filePath+start, len-start);
+	name[len-start] = '\0';
+	char dirPath[MAXPATHLEN];
+	memcpy(dirPath, filePath, start);
+	dirPath[start] = '\0';
+	return openBeneath(dirPath, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+}
+
+/**
+ * Get the status of a path in the content tree from its
+ * directory opened by openParentBeneath(). A symbolic link
+ * is followed only as openBeneath() follows it, so the
+ * status is never of a file outside the tree.
+ *
+ * @param dirFd the directory descriptor
+ * @param name the last component of the path
+ * @param filePath the file path
+ * @param sb the status of the path
+ * @return 0 if successful, -1 with errno set if error
+ */
+int statBeneath(int dirFd, const char *name, const char *filePath, struct stat *sb) {
+	if (fstatat(dirFd, name, sb, AT_SYMLINK_NOFOLLOW) != 0) {
+		return -1;
+	} else if (!S_ISLNK(sb->st_mode)) {
+		return 0;
+	}
+	int fd = openBeneath(filePath, O_RDONLY|O_NONBLOCK|O_NOCTTY|O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	int status = fstat(fd, sb);
+	close(fd);
+	return status;
+}
+
+/**
+ * Make the directories of a path in the content tree, each
+ * relative to its directory opened by openParentBeneath().
+ *
+ * @param dirPath the directory path
+ * @param mode mode if a directory is created
+ * @return 0 if successful, -1 with errno set if error
+ */
+int mkdirsBeneath(const char *dirPath, mode_t mode) {
+	size_t len = strlen(dirPath);
+	if (len >= MAXPATHLEN) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	char path[MAXPATHLEN], name[NAME_MAX+1];
+	for (size_t i = server.content_base_len+1; i <= len; i++) {
+		if (((i < len) && (dirPath[i] != '/')) || (dirPath[i-1] == '/')) {
+			continue;  // not the end of a component
+		}
+		memcpy(path, dirPath, i);
+		path[i] = '\0';
+		int dirFd = openParentBeneath(path, name);
+		if (dirFd < 0) {
+			return -1;
+		}
+		int status = mkdirat(dirFd, name, mode);
+		close(dirFd);
+		if ((status != 0) && (errno != EEXIST)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Make the entity tag of a file from its size and
+ * modification time, quoted for an ETag header.
+ * @param sb the file status
+ * @param etag buffer of MAXBUF for the entity tag
+ * @return the entity tag
+ */
+char *makeETag(const struct stat *sb, char *etag) {
+	sprintf(etag, "\"%llx-%llx%09lx\"", (unsigned long long)sb->st_size,
+			(unsigned long long)sb->st_mtim.tv_sec, (long)sb->st_mtim.tv_nsec);
+	return etag;
+}
+
+/**
+ * Returns true if a list of entity tags in an If-Match or
+ * If-None-Match header includes an entity tag. Weak tags
+ * ("W/" prefix) match only with weak comparison.
+ * @param tags the comma-separated entity tags
+ * @param etag the entity tag
+ * @param weak true for weak comparison
+ * @return true if the list includes the entity tag
+ */
+bool matchETag(const char *tags, const char *etag, bool weak) {
+	size_t etagLen = strlen(etag);
+	for (const char *p = tags; *p != '\0'; ) {
+		p += strspn(p, " \t,");
+		size_t len = strcspn(p, " \t,");
+		bool isWeak = (strncmp(p, "W/", 2) == 0);
+		const char *tag = isWeak ? p+2 : p;
+		size_t tagLen = isWeak ? len-2 : len;
+		if (   (weak || !isWeak)
+			&& (tagLen == etagLen) && (strncmp(tag, etag, etagLen) == 0)) {
+			return true;
+		}
+		p += len;
+	}
+	return false;
+}
+
+/**
+ * Write text to a stream with HTML special characters escaped.
+ *
+ * @param ostream the stream
+ * @param text the text
+ */
+void writeHtml(FILE *ostream, const char *text) {
+	for (const char *p = text; *p != '\0'; p++) {
+		switch (*p) {
+		case '<':  fputs("&lt;", ostream); break;
+		case '>':  fputs("&gt;", ostream); break;
+		case '&':  fputs("&amp;", ostream); break;
+		case '"':  fputs("&quot;", ostream); break;
+		default:   fputc(*p, ostream); break;
+		}
+	}
+}
+
+/**
+ * Send a chunk of a response body with chunked transfer
+ * coding. An empty chunk ends the body.
+ *
+ * @param ostream the socket stream
+ * @param data the chunk data
+ * @param len the length of the chunk data
+ */
+void sendChunk(FILE *ostream, const void *data, size_t len) {
+	fprintf(ostream, "%zx%s", len, CRLF);
+	if (len > 0) {
+		fwrite(data, 1, len, ostream);
+	}
+	fputs(CRLF, ostream);
+}
+
+/**
+ * Returns true if the Accept-Encoding request header
+ * accepts a content coding with a non-zero quality.
+ *
+ * @param requestHeaders the request headers
+ * @param coding the content coding
+ * @return true if the coding is accepted
+ */
+bool acceptsEncoding(Properties *requestHeaders, const char *coding) {
+	char codings[MAX_PROP_VAL];
+	if (findProperty(requestHeaders, 0, "Accept-Encoding", codings) == SIZE_MAX) {
+		return false;
+	}
+	size_t codingLen = strlen(coding);
+	for (char *p = codings; *p != '\0'; ) {
+		p += strspn(p, " \t,");
+		size_t len = strcspn(p, " \t,;");
+		bool match = (len == codingLen) && (strncasecmp(p, coding, len) == 0);
+		p += len;
+		// quality "q=0" refuses the coding
+		char *end = p + strcspn(p, ",");
+		char *q = strstr(p, "q=");
+		if (match) {
+			return (q == NULL) || (q > end) || (strtod(q+2, NULL) > 0);
+		}
+		p = end;
+	}
+	return false;
+}
+
 /**
  * Debug request by printing request and request headers
  *
@@ -172,10 +475,10 @@ char *resolveUri(const char *uri, char *fspath) {
  * @param requestHeaders the request headers
  */
 void debugRequest(const char *request, Properties *requestHeaders) {
-	char name[MAXBUF], val[MAXBUF];
 	fprintf(stderr, "\n%s\n", request);
-	for (int i = 0; getProperty(requestHeaders, i, name, val); i++) {
-		fprintf(stderr, "%s: %s\n", name, val);
+	PropertyRef prop;
+	for (size_t i = 0; getPropertyRef(requestHeaders, i, &prop); i++) {
+		fprintf(stderr, "%.*s: %.*s\n", (int)prop.nameLen, prop.name, (int)prop.valLen, prop.val);
 	}
 	fprintf(stderr, "\n");
 }
@@ -187,28 +490,9 @@ void debugRequest(const char *request, Properties *requestHeaders) {
  * @param queryProps the query parameters
  */
 void decodeQuery(const char *query, Properties *queryProps) {
-    char querytoks[strlen(query)+1];
-    strcpy(querytoks, query);  // strtok_r modifies string
-    char *saveptr;  // for re-entrant strtok_r
-    for (char* qt = querytoks; ; qt = NULL) {
-        // get next name/value
-        char* tok = strtok_r(qt, "&;", &saveptr); // either & or ;
-        if (tok == NULL) {
-            break;
-        }
-        // split into name and value
-        char *valp = strchr(tok, '=');
-        if (valp == NULL) {
-            valp = tok+strlen(tok); // non-standard: no value
-        } else {
-            *valp++ = '\0';  // split into name/value
-        }
-
-        // decode name and value
-        char name[strlen(tok) + 1];
-        char value[strlen(valp) + 1];
-        unescapeUri(tok, name);
-        unescapeUri(valp, value);
-        putProperty(queryProps, name, value);
+    FormDecoder dec;
+    initFormDecoder(&dec, Form_UrlEncoded, queryProps);
+    if (decodeForm(&dec, query, strlen(query)) == 0) {
+        endForm(&dec);
     }
 }
@@ -10,6 +10,8 @@
 #ifndef HTTP_UTIL_H_
 #define HTTP_UTIL_H_
 
+#include <stdbool.h>
+#include <sys/stat.h>
 #include "properties.h"
 
 /**
@@ -59,6 +61,72 @@ void sendStatusResponse(FILE* ostream, int status, const char *statusMsg, Proper
  */
 char *unescapeUri(const char *escUri, char *uri);
 
+/**
+ * Remove the "." and ".." segments of a URI path in place,
+ * as RFC 3986 does, so a ".." never leaves the root and
+ * the path cannot name a file outside the content base.
+ * Repeated '/' are collapsed, so a file has one path.
+ * @param uri the URI path
+ * @return the URI path if successful, NULL if not absolute
+ */
+char *normalizeUriPath(char *uri);
+
+/**
+ * Open the content base, so files are opened beneath it.
+ *
+ * @return true if successful, false with errno set if error
+ */
+bool openContentBase(void);
+
+/**
+ * Open a path in the content tree, refusing one that
+ * leaves the tree through ".." or a symbolic link if the
+ * kernel supports openat2(). Otherwise the whole path is
+ * resolved, and only the removal of dot segments from
+ * request URIs keeps it in the tree.
+ *
+ * @param filePath the file path
+ * @param flags the open() flags, without O_CREAT
+ * @return the file descriptor, or -1 with errno set if error
+ */
+int openBeneath(const char *filePath, int flags);
+
+/**
+ * Open the directory of a path in the content tree as
+ * openBeneath() does, so the entry for the path can be
+ * changed relative to it. A directory path may end with
+ * '/'; the content base itself has no directory.
+ *
+ * @param filePath the file path
+ * @param name buffer of NAME_MAX+1 for the last component
+ * @return the directory descriptor, or -1 with errno set if error
+ */
+int openParentBeneath(const char *filePath, char *name);
+
+/**
+ * Get the status of a path in the content tree from its
+ * directory opened by openParentBeneath(). A symbolic link
+ * is followed only as openBeneath() follows it, so the
+ * status is never of a file outside the tree.
+ *
+ * @param dirFd the directory descriptor
+ * @param name the last component of the path
+ * @param filePath the file path
+ * @param sb the status of the path
+ * @return 0 if successful, -1 with errno set if error
+ */
+int statBeneath(int dirFd, const char *name, const char *filePath, struct stat *sb);
+
+/**
+ * Make the directories of a path in the content tree, each
+ * relative to its directory opened by openParentBeneath().
+ *
+ * @param dirPath the directory path
+ * @param mode mode if a directory is created
+ * @return 0 if successful, -1 with errno set if error
+ */
+int mkdirsBeneath(const char *dirPath, mode_t mode);
+
 /**
  * Resolves server URI to file system path.
  * @param uri the request URI
@@ -75,6 +143,54 @@ char *resolveUri(const char *uri, char *fspath);
  */
 void decodeQuery(const char *query, Properties *queryProps);
 
+/**
+ * Make the entity tag of a file from its size and
+ * modification time, quoted for an ETag header.
+ * @param sb the file status
+ * @param etag buffer of MAXBUF for the entity tag
+ * @return the entity tag
+ */
+char *makeETag(const struct stat *sb, char *etag);
+
+/**
+ * Returns true if a list of entity tags in an If-Match or
+ * If-None-Match header includes an entity tag. Weak tags
+ * ("W/" prefix) match only with weak comparison.
+ * @param tags the comma-separated entity tags
+ * @param etag the entity tag
+ * @param weak true for weak comparison
+ * @return true if the list includes the entity tag
+ */
+bool matchETag(const char *tags, const char *etag, bool weak);
+
+/**
+ * Write text to a stream with HTML special characters escaped.
+ *
+ * @param ostream the stream
+ * @param text the text
+ */
+void writeHtml(FILE *ostream, const char *text);
+
+/**
+ * Send a chunk of a response body with chunked transfer
+ * coding. An empty chunk ends the body.
+ *
+ * @param ostream the socket stream
+ * @param data the chunk data
+ * @param len the length of the chunk data
+ */
+void sendChunk(FILE *ostream, const void *data, size_t len);
+
+/**
+ * Returns true if the Accept-Encoding request header
+ * accepts a content coding with a non-zero quality.
+ *
+ * @param requestHeaders the request headers
+ * @param coding the content coding
+ * @return true if the coding is accepted
+ */
+bool acceptsEncoding(Properties *requestHeaders, const char *coding);
+
 /**
  * Debug request by printing request and request headers
  *
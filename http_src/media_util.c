@@ -17,10 +17,50 @@
 #include "http_server.h"
 #include "file_util.h"
 #include "properties.h"
-extern Properties* mediaTypeProperty;
+#include "mph.h"
+
 /** default media type */
 static const char *DEFAULT_MEDIA_TYPE = "application/octet-stream";
 
+/** media types compiled from mime.types at build time */
+extern const MphTable builtinMediaTypes;
+
+/** media types with overrides loaded at startup */
+static MphTable overrideMediaTypes;
+
+/** override media types by extension, and their key arrays */
+static Properties *overrideProps = NULL;
+static const char **overrideKeys = NULL;
+static const char **overrideVals = NULL;
+
+/** current media types table */
+static const MphTable *mediaTypes = &builtinMediaTypes;
+
+/**
+ * Return a media type for a given filename. The
+ * media type is found with a single hash probe.
+ *
+ * @param filename the name of the file
+ * @return the media type string
+ */
+const char *lookupMediaType(const char *filename) {
+	// special-case directory based on trailing '/'
+	size_t len = strlen(filename);
+	if ((len > 0) && (filename[len-1] == '/')) {
+		return "text/directory";
+	}
+
+	// get file extension; default if no extension
+	const char *ext = strrchr(filename, '.');
+	if (ext == NULL) {
+		return DEFAULT_MEDIA_TYPE;
+	}
+
+	// media type for extension, which is case-independent
+	const char *mediaType = lookupMph(mediaTypes, ext+1);
+	return (mediaType == NULL) ? DEFAULT_MEDIA_TYPE : mediaType;
+}
+
 /**
  * Return a media type for a given filename.
  *
@@ -30,76 +70,99 @@ static const char *DEFAULT_MEDIA_TYPE = "application/octet-stream";
  */
 char *getMediaType(const char *filename, char *mediaType)
 {
-	// special-case directory based on trailing '/'
-	if (filename[strlen(filename)-1] == '/') {
-		strcpy(mediaType, "text/directory");
-		return mediaType;
+	strcpy(mediaType, lookupMediaType(filename));
+	return mediaType;
+}
+
+/**
+ * Load extension to media type properties from a file
+ * in mime.types format.
+ *
+ * @param configFileName the name of the configuration file
+ * @param props the properties
+ * @return the number of properties loaded
+ */
+static int loadMediaTypes(const char* configFileName, Properties* props) {
+	FILE* propStream = fopen(configFileName, "r");
+	if (propStream == NULL) {
+		return 0;
 	}
+	char buf[MAXBUF];
+	int nprops = 0;
 
-	// get file extension
-    char ext[MAXBUF];
-    if (getExtension(filename, ext) == NULL) {
-    	// default if no extension
-    	strcpy(mediaType, DEFAULT_MEDIA_TYPE);
-    	return mediaType;
-    }
-
-    // lower-case extension
-    strlower(ext, ext);
-
-    // media type sting for extension
-    char mtstr[MAX_PROP_VAL];
-    if (findProperty(mediaTypeProperty, 0, ext, mtstr) == SIZE_MAX) {
-        strcpy(mtstr, DEFAULT_MEDIA_TYPE);
-    }
-    strcpy(mediaType, mtstr);
-    return mediaType;
+	// each line is a media type followed by its extensions
+	while (fgets(buf, MAXBUF, propStream) != NULL) {
+		if (buf[0] == '#') { // ignore comment
+			continue;
+		}
+		char *wordp;
+		char *type = strtok_r(buf, " \t\r\n", &wordp);
+		for (char *ext; (type != NULL) && (ext = strtok_r(NULL, " \t\r\n", &wordp)) != NULL; ) {
+			putProperty(props, ext, type);
+			nprops++;
+		}
+	}
+	fclose(propStream);
+	return nprops;
 }
 
 /**
- * Load the file extension to media type mapping from config file
+ * Load file extension to media type mappings from config
+ * file, overriding those compiled from mime.types. The file
+ * is read through a mapped snapshot of its properties.
  *
  * @param configFileName the name of the configuration file
- * @return the number of properties loaded
+ * @return the number of extensions loaded
  */
 int readMediaTypes(char* configFileName) {
-    if (mediaTypeProperty == NULL) {
-        mediaTypeProperty = newProperties();
-    }
-    FILE* propStream = fopen(configFileName, "r");
-    if (propStream == NULL) {
-        return 0;
-    }
-    char buf[MAXBUF];
-    int nprops = 0;
-
-    // get next line
-    while (fgets(buf, MAXBUF, propStream) != NULL) {
-        if (buf[0] == '#') { // ignore comment
-            continue;
-        }
-        char *valp = strchr(buf, '\t');
-        if (valp != NULL) {
-            //
-            *valp++ = '\0';
-            valp = trim_trailing_tabs(valp);
-            // trim newline characters
-            trim_newline(valp);
-            while(1) {
-                char *valpp = strchr(valp, ' ');
-                if (valpp == NULL) {
-                    putProperty(mediaTypeProperty, valp, buf);
-                    nprops++;
-                    break;
-                }
-                *valpp++ = '\0';
-                putProperty(mediaTypeProperty, valp, buf);
-                valp = valpp;
-                nprops++;
-            }
-        }
-    }
-    fclose(propStream);
-    return nprops;
+	overrideProps = mapProperties(configFileName, loadMediaTypes);
+	if (overrideProps == NULL) {
+		return 0;
+	}
 
+	// file types followed by built-in types
+	size_t nprops = nProperties(overrideProps);
+	size_t maxKeys = nprops + builtinMediaTypes.nkeys;
+	overrideKeys = malloc(maxKeys * sizeof(char*));
+	overrideVals = malloc(maxKeys * sizeof(char*));
+	if ((overrideKeys == NULL) || (overrideVals == NULL)) {
+		freeMediaTypes();
+		return 0;
+	}
+	for (size_t i = 0; i < nprops; i++) {
+		PropertyRef prop;
+		getPropertyRef(overrideProps, i, &prop);
+		overrideKeys[i] = prop.name;
+		overrideVals[i] = prop.val;
+	}
+	for (size_t i = 0; i < builtinMediaTypes.nkeys; i++) {
+		overrideKeys[nprops+i] = builtinMediaTypes.keys[i];
+		overrideVals[nprops+i] = builtinMediaTypes.vals[i];
+	}
+
+	// first of duplicate extensions is kept, so the file takes precedence
+	if (!buildMph(&overrideMediaTypes, overrideKeys, overrideVals, maxKeys)) {
+		freeMediaTypes();
+		return 0;
+	}
+	mediaTypes = &overrideMediaTypes;
+	return nprops;
+}
+
+/**
+ * Free media types loaded by readMediaTypes(),
+ * reverting to those compiled from mime.types.
+ */
+void freeMediaTypes(void) {
+	if (mediaTypes == &overrideMediaTypes) {
+		freeMph(&overrideMediaTypes);
+	}
+	mediaTypes = &builtinMediaTypes;
+	free(overrideKeys);
+	free(overrideVals);
+	overrideKeys = overrideVals = NULL;
+	if (overrideProps != NULL) {
+		deleteProperties(overrideProps);
+		overrideProps = NULL;
+	}
 }
@@ -11,6 +11,16 @@
 #define MEDIA_UTIL_H_
 #include <unistd.h>
 #include "properties.h"
+
+/**
+ * Return a media type for a given filename. The
+ * media type is found with a single hash probe.
+ *
+ * @param filename the name of the file
+ * @return the media type string
+ */
+const char *lookupMediaType(const char *filename);
+
 /**
  * Return a media type for a given filename.
  *
@@ -21,11 +31,18 @@
 char *getMediaType(const char *filename, char *mediaType);
 
 /**
- * Load the file extension to media type mapping from config file
+ * Load file extension to media type mappings from config
+ * file, overriding those compiled from mime.types.
  *
  * @param configFileName the name of the configuration file
- * @return the number of properties loaded
+ * @return the number of extensions loaded
  */
 int readMediaTypes(char* configFileName);
 
+/**
+ * Free media types loaded by readMediaTypes(),
+ * reverting to those compiled from mime.types.
+ */
+void freeMediaTypes(void);
+
 #endif /* MEDIA_UTIL_H_ */
@@ -0,0 +1,237 @@
+/*
+ * mph.c
+ *
+ * Functions that implement minimal perfect hash tables
+ * of string keys and values. Keys are hashed to buckets
+ * of about MPH_BUCKET_KEYS keys, and each bucket has a
+ * seed that displaces its keys into free slots, so every
+ * key has its own slot.
+ *
+ *  @since 2026-10-18
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "mph.h"
+#include "string_util.h"
+
+/** average number of keys in a bucket */
+#define MPH_BUCKET_KEYS 3
+
+/** maximum displacement seed to try for a bucket */
+#define MPH_MAX_SEED (1u << 24)
+
+/**
+ * Returns the hash of a key, folded to lower case.
+ *
+ * @param key the key
+ * @return the hash of the key
+ */
+uint64_t hashMphKey(const char *key) {
+	return strhash(key, SIZE_MAX, true);
+}
+
+/**
+ * Returns the bucket for a key hash.
+ *
+ * @param hash the key hash
+ * @param nbuckets the number of buckets
+ * @return the bucket
+ */
+static uint32_t bucketOf(uint64_t hash, uint32_t nbuckets) {
+	return (uint32_t)((hash >> 32) % nbuckets);
+}
+
+/**
+ * Returns the slot for a key hash displaced by a seed.
+ *
+ * @param hash the key hash
+ * @param seed the seed of the key bucket
+ * @param nkeys the number of slots
+ * @return the slot
+ */
+static uint32_t slotOf(uint64_t hash, uint32_t seed, uint32_t nkeys) {
+	uint64_t h = hash ^ (seed * 0x9e3779b97f4a7c15ull);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return (uint32_t)(h % nkeys);
+}
+
+/** Definition of a key to place */
+typedef struct MphKey {
+	uint64_t hash;		/** key hash */
+	uint32_t index;		/** index of key in input */
+	uint32_t bucket;	/** bucket of key */
+	uint32_t size;		/** number of keys in bucket */
+} MphKey;
+
+/** Definition of the comparison function for qsort */
+typedef int (*qcompar)(const void *, const void *);
+
+/**
+ * Order keys by hash then input index, so duplicates
+ * are adjacent with the first one leading.
+ */
+static int compareHash(const MphKey *k1, const MphKey *k2) {
+	if (k1->hash != k2->hash) {
+		return (k1->hash < k2->hash) ? -1 : 1;
+	}
+	return (k1->index < k2->index) ? -1 : (k1->index > k2->index);
+}
+
+/**
+ * Order keys by descending bucket size then bucket,
+ * so the hardest buckets are placed first.
+ */
+static int compareBucket(const MphKey *k1, const MphKey *k2) {
+	if (k1->size != k2->size) {
+		return (k1->size > k2->size) ? -1 : 1;
+	}
+	return (k1->bucket < k2->bucket) ? -1 : (k1->bucket > k2->bucket);
+}
+
+/**
+ * Build a table from keys and values. The first of
+ * duplicate keys is kept. Keys are case-independent.
+ * The table refers to the key and value strings.
+ *
+ * @param table the table to build
+ * @param keys the keys
+ * @param vals the values
+ * @param nkeys the number of keys and values
+ * @return true if built, false if out of memory or
+ *   keys with different names have the same hash
+ */
+bool buildMph(MphTable *table, const char *const keys[], const char *const vals[], size_t nkeys) {
+	memset(table, 0, sizeof(MphTable));
+	MphKey *mkeys = malloc((nkeys + 1) * sizeof(MphKey));
+	if (mkeys == NULL) {
+		return false;
+	}
+
+	// remove duplicate keys, keeping the first
+	for (uint32_t i = 0; i < nkeys; i++) {
+		mkeys[i].hash = hashMphKey(keys[i]);
+		mkeys[i].index = i;
+	}
+	qsort(mkeys, nkeys, sizeof(MphKey), (qcompar)compareHash);
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < nkeys; i++) {
+		if ((n > 0) && (mkeys[n-1].hash == mkeys[i].hash)) {
+			if (strcasecmp(keys[mkeys[n-1].index], keys[mkeys[i].index]) != 0) {
+				free(mkeys);
+				return false;
+			}
+			continue;
+		}
+		mkeys[n++] = mkeys[i];
+	}
+
+	uint32_t nbuckets = (n + MPH_BUCKET_KEYS - 1) / MPH_BUCKET_KEYS + 1;
+	uint32_t *seeds = calloc(nbuckets, sizeof(uint32_t));
+	uint32_t *owners = malloc((n + 1) * sizeof(uint32_t));
+	const char **tkeys = malloc((n + 1) * sizeof(char*));
+	const char **tvals = malloc((n + 1) * sizeof(char*));
+	uint32_t *sizes = calloc(nbuckets, sizeof(uint32_t));
+	bool status = (seeds != NULL) && (owners != NULL) && (tkeys != NULL)
+			   && (tvals != NULL) && (sizes != NULL);
+
+	if (status) {
+		// group keys by bucket, largest buckets first
+		for (uint32_t i = 0; i < n; i++) {
+			mkeys[i].bucket = bucketOf(mkeys[i].hash, nbuckets);
+			sizes[mkeys[i].bucket]++;
+		}
+		for (uint32_t i = 0; i < n; i++) {
+			mkeys[i].size = sizes[mkeys[i].bucket];
+		}
+		qsort(mkeys, n, sizeof(MphKey), (qcompar)compareBucket);
+		for (uint32_t i = 0; i < n; i++) {
+			owners[i] = UINT32_MAX;
+		}
+
+		// find a seed for each bucket that puts its keys in free slots
+		for (uint32_t first = 0, last; status && (first < n); first = last) {
+			for (last = first + 1; (last < n) && (mkeys[last].bucket == mkeys[first].bucket); last++)
+				;
+			uint32_t seed;
+			for (seed = 0; seed < MPH_MAX_SEED; seed++) {
+				uint32_t i;
+				for (i = first; i < last; i++) {
+					uint32_t slot = slotOf(mkeys[i].hash, seed, n);
+					if (owners[slot] != UINT32_MAX) {
+						break;
+					}
+					owners[slot] = i;
+				}
+				if (i == last) {
+					break;
+				}
+				// release slots taken by this bucket and try next seed
+				while (i-- > first) {
+					owners[slotOf(mkeys[i].hash, seed, n)] = UINT32_MAX;
+				}
+			}
+			if (seed == MPH_MAX_SEED) {
+				status = false;
+			}
+			seeds[mkeys[first].bucket] = seed;
+		}
+	}
+
+	if (status) {
+		for (uint32_t slot = 0; slot < n; slot++) {
+			uint32_t index = mkeys[owners[slot]].index;
+			tkeys[slot] = keys[index];
+			tvals[slot] = vals[index];
+		}
+		table->nkeys = n;
+		table->nbuckets = nbuckets;
+		table->seeds = seeds;
+		table->keys = tkeys;
+		table->vals = tvals;
+	} else {
+		free(seeds);
+		free(tkeys);
+		free(tvals);
+	}
+	free(sizes);
+	free(owners);
+	free(mkeys);
+	return status;
+}
+
+/**
+ * Free storage allocated by buildMph(). The key
+ * and value strings are not freed.
+ *
+ * @param table the table
+ */
+void freeMph(MphTable *table) {
+	free((void*)table->seeds);
+	free((void*)table->keys);
+	free((void*)table->vals);
+	memset(table, 0, sizeof(MphTable));
+}
+
+/**
+ * Look up the value for a key. Key comparison is
+ * case-independent.
+ *
+ * @param table the table
+ * @param key the key
+ * @return the value or NULL if not found
+ */
+const char *lookupMph(const MphTable *table, const char *key) {
+	if (table->nkeys == 0) {
+		return NULL;
+	}
+	uint64_t hash = hashMphKey(key);
+	uint32_t seed = table->seeds[bucketOf(hash, table->nbuckets)];
+	uint32_t slot = slotOf(hash, seed, table->nkeys);
+	return (strcasecmp(table->keys[slot], key) == 0) ? table->vals[slot] : NULL;
+}
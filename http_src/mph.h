@@ -0,0 +1,67 @@
+/*
+ * mph.h
+ *
+ * Functions that implement minimal perfect hash tables
+ * of string keys and values. Tables are built once from
+ * a fixed key set, and a lookup probes a single slot.
+ *
+ *  @since 2026-10-18
+ */
+
+#ifndef MPH_H_
+#define MPH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Definition of a minimal perfect hash table */
+typedef struct MphTable {
+	uint32_t nkeys;				/** number of keys and slots */
+	uint32_t nbuckets;			/** number of displacement buckets */
+	const uint32_t *seeds;		/** displacement seed for each bucket */
+	const char *const *keys;	/** key in each slot */
+	const char *const *vals;	/** value in each slot */
+} MphTable;
+
+/**
+ * Returns the hash of a key, folded to lower case.
+ *
+ * @param key the key
+ * @return the hash of the key
+ */
+uint64_t hashMphKey(const char *key);
+
+/**
+ * Build a table from keys and values. The first of
+ * duplicate keys is kept. Keys are case-independent.
+ * The table refers to the key and value strings.
+ *
+ * @param table the table to build
+ * @param keys the keys
+ * @param vals the values
+ * @param nkeys the number of keys and values
+ * @return true if built, false if out of memory or
+ *   keys with different names have the same hash
+ */
+bool buildMph(MphTable *table, const char *const keys[], const char *const vals[], size_t nkeys);
+
+/**
+ * Free storage allocated by buildMph(). The key
+ * and value strings are not freed.
+ *
+ * @param table the table
+ */
+void freeMph(MphTable *table);
+
+/**
+ * Look up the value for a key. Key comparison is
+ * case-independent.
+ *
+ * @param table the table
+ * @param key the key
+ * @return the value or NULL if not found
+ */
+const char *lookupMph(const MphTable *table, const char *key);
+
+#endif /* MPH_H_ */
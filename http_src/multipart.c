@@ -0,0 +1,497 @@
+/*
+ * multipart.c
+ *
+ * Functions that parse multipart/form-data request
+ * bodies as they stream in.
+ *
+ * The body passes through a window of BODY_SLICE_SIZE
+ * bytes. Each boundary delimiter is found with a
+ * Boyer-Moore-Horspool search, and the bytes of a part
+ * before it are handed on as soon as they cannot be the
+ * start of a delimiter, so a form uses the same memory
+ * whatever the size of its files.
+ *
+ *  @since 2026-10-18
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include "multipart.h"
+#include "file_util.h"
+#include "http_codes.h"
+#include "http_server.h"
+#include "http_util.h"
+#include "path_lock.h"
+#include "durability.h"
+#include "content_watch.h"
+
+/** Definition of a multipart body being parsed */
+typedef struct Multipart {
+	RequestBody *body;           /** the request body */
+	unsigned char *buf;          /** window onto the body */
+	size_t pos;                  /** start of unparsed bytes */
+	size_t len;                  /** end of bytes in the window */
+	unsigned char delim[4+MULTIPART_MAX_BOUNDARY]; /** CRLF "--" boundary */
+	size_t delimLen;             /** length of the delimiter */
+	size_t skip[256];            /** Horspool shift by last byte */
+} Multipart;
+
+/** Definition of the part being read */
+typedef struct Part {
+	char name[MAX_PROP_NAME];    /** field name */
+	bool isFile;                 /** part is a file input */
+	char fileName[MAXPATHLEN];   /** file name, or empty if none chosen */
+	char tmpName[NAME_MAX+1];    /** temporary name of a file */
+	int fd;                      /** descriptor of a file, or -1 */
+	int dirFd;                   /** directory of a file while fd is open */
+	bool discard;                /** ignore the part */
+	size_t size;                 /** bytes in the part so far */
+	size_t limit;                /** maximum bytes in the part, or 0 */
+	size_t valueLen;             /** length of a field value */
+	char value[MAX_PROP_VAL];    /** value of a field */
+} Part;
+
+/**
+ * Returns true if a media type is multipart/form-data.
+ *
+ * @param contentType the Content-Type header value
+ * @return true if multipart/form-data
+ */
+bool isMultipartForm(const char *contentType) {
+	static const char formType[] = "multipart/form-data";
+	size_t len = sizeof(formType)-1;
+	return    (strncasecmp(contentType, formType, len) == 0)
+		   && ((contentType[len] == '\0') || (contentType[len] == ';') || (contentType[len] == ' '));
+}
+
+/**
+ * Find a parameter of a header value, such as the
+ * boundary of a Content-Type or the name of a
+ * Content-Disposition. Quoted values are unquoted.
+ * @param header the header value
+ * @param param the parameter name
+ * @param val return buffer for the value
+ * @param size size of the return buffer
+ * @return true if found and it fits, false otherwise
+ */
+static bool findParam(const char *header, const char *param, char *val, size_t size) {
+	size_t paramLen = strlen(param);
+	for (const char *p = strchr(header, ';'); p != NULL; p = strchr(p, ';')) {
+		for (p++; (*p == ' ') || (*p == '\t'); p++) {}
+		if ((strncasecmp(p, param, paramLen) != 0) || (p[paramLen] != '=')) {
+			continue;
+		}
+		p += paramLen+1;
+		const char *end;
+		if (*p == '"') {
+			end = strchr(++p, '"');
+			if (end == NULL) {
+				return false;
+			}
+		} else {
+			end = p + strcspn(p, "; \t");
+		}
+		if ((size_t)(end-p) >= size) {
+			return false;
+		}
+		memcpy(val, p, end-p);
+		val[end-p] = '\0';
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Search the unparsed bytes of the window for the
+ * delimiter using Boyer-Moore-Horspool.
+ * @param mp the multipart body
+ * @return offset of the delimiter in the window, or SIZE_MAX
+ */
+static size_t findDelim(Multipart *mp) {
+	const unsigned char *delim = mp->delim;
+	size_t last = mp->delimLen-1;
+	for (size_t i = mp->pos; i + last < mp->len; ) {
+		unsigned char c = mp->buf[i+last];
+		if ((c == delim[last]) && (memcmp(mp->buf+i, delim, last) == 0)) {
+			return i;
+		}
+		i += mp->skip[c];
+	}
+	return SIZE_MAX;
+}
+
+/**
+ * Move unparsed bytes to the start of the window and
+ * read more of the body after them.
+ * @param mp the multipart body
+ * @return number of bytes read, 0 at end of body or
+ *   if the window is full, -1 if error
+ */
+static ssize_t fillWindow(Multipart *mp) {
+	memmove(mp->buf, mp->buf+mp->pos, mp->len-mp->pos);
+	mp->len -= mp->pos;
+	mp->pos = 0;
+	if (mp->len == BODY_SLICE_SIZE) {
+		return 0;
+	}
+	ssize_t nread = readRequestBody(mp->body, mp->buf+mp->len, BODY_SLICE_SIZE-mp->len);
+	if (nread > 0) {
+		mp->len += nread;
+	}
+	return nread;
+}
+
+/**
+ * Make at least some unparsed bytes available.
+ * @param mp the multipart body
+ * @param n the number of bytes
+ * @return 0 if available, or the status of an error response
+ */
+static int ensureWindow(Multipart *mp, size_t n) {
+	while (mp->len - mp->pos < n) {
+		ssize_t nread = fillWindow(mp);
+		if (nread <= 0) {
+			return (nread < 0) ? mp->body->status : Http_BadRequest;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Hand bytes of the current part to its file or field.
+ * @param part the part
+ * @param data the bytes
+ * @param n the number of bytes
+ * @return 0 if successful, or the status of an error response
+ */
+static int writePart(Part *part, const unsigned char *data, size_t n) {
+	if (part->discard || (n == 0)) {
+		return 0;
+	}
+	part->size += n;
+	if ((part->limit > 0) && (part->size > part->limit)) {
+		return Http_PayloadTooLarge;
+	}
+	if (part->fd < 0) {
+		if (part->valueLen + n >= MAX_PROP_VAL) {
+			return Http_PayloadTooLarge;
+		}
+		memcpy(part->value + part->valueLen, data, n);
+		part->valueLen += n;
+		return 0;
+	}
+	while (n > 0) {
+		ssize_t nwritten = write(part->fd, data, n);
+		if (nwritten < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (errno == ENOSPC) ? Http_InsufficientStorage : Http_InternalServerError;
+		}
+		data += nwritten;
+		n -= nwritten;
+	}
+	return 0;
+}
+
+/**
+ * Read the bytes of a part up to and including the next
+ * delimiter. Bytes that cannot start a delimiter are
+ * handed on without waiting for the rest of the part.
+ * @param mp the multipart body
+ * @param part the part, or NULL to discard the bytes
+ * @return 0 if successful, or the status of an error response
+ */
+static int readPartData(Multipart *mp, Part *part) {
+	for (;;) {
+		size_t end = findDelim(mp);
+		size_t avail = (end != SIZE_MAX) ? end
+					 : (mp->len >= mp->delimLen) ? mp->len - (mp->delimLen-1) : 0;
+		if (avail > mp->pos) {
+			if (part != NULL) {
+				int status = writePart(part, mp->buf+mp->pos, avail-mp->pos);
+				if (status != 0) {
+					return status;
+				}
+			}
+			mp->pos = avail;
+		}
+		if (end != SIZE_MAX) {
+			mp->pos = end + mp->delimLen;
+			return 0;
+		}
+		ssize_t nread = fillWindow(mp);
+		if (nread <= 0) {
+			// body ended before the closing delimiter
+			return (nread < 0) ? mp->body->status : Http_BadRequest;
+		}
+	}
+}
+
+/**
+ * Read the headers of a part and prepare to receive it.
+ * @param mp the multipart body
+ * @param part the part to prepare
+ * @return 0 if successful, or the status of an error response
+ */
+static int readPartHeaders(Multipart *mp, Part *part) {
+	// headers end with an empty line; the window must hold them
+	char *end;
+	for (;;) {
+		end = memmem(mp->buf+mp->pos, mp->len-mp->pos, "\r\n\r\n", 4);
+		if (end != NULL) {
+			break;
+		}
+		ssize_t nread = fillWindow(mp);
+		if (nread <= 0) {
+			return (nread < 0) ? mp->body->status : Http_BadRequest;
+		}
+	}
+	*end = '\0';
+	char *headers = (char*)mp->buf+mp->pos;
+	mp->pos = (unsigned char*)end - mp->buf + 4;
+
+	*part->name = *part->fileName = '\0';
+	char *saveptr;
+	for (char *line = strtok_r(headers, "\r\n", &saveptr); line != NULL;
+		 line = strtok_r(NULL, "\r\n", &saveptr)) {
+		if (strncasecmp(line, "Content-Disposition:", 20) == 0) {
+			if (!findParam(line, "name", part->name, sizeof(part->name))) {
+				return Http_BadRequest;
+			}
+			part->isFile = (strcasestr(line, "filename=") != NULL);
+			if (   part->isFile
+				&& !findParam(line, "filename", part->fileName, sizeof(part->fileName))) {
+				return Http_BadRequest;
+			}
+		}
+	}
+	if (*part->name == '\0') {
+		return Http_BadRequest;
+	}
+	return 0;
+}
+
+/**
+ * Open the file for a part with a file name. Only the last
+ * component of the name is used. A part without a name is
+ * a file input with no file chosen, so it is discarded.
+ * @param part the part
+ * @param dirPath the directory for files
+ * @return 0 if successful, or the status of an error response
+ */
+static int openPartFile(Part *part, const char *dirPath) {
+	const char *name = part->fileName;
+	for (const char *p = name; *p != '\0'; p++) {
+		if ((*p == '/') || (*p == '\\')) {
+			name = p+1;
+		}
+	}
+	if (*name == '\0') {
+		part->discard = true;
+		return 0;
+	}
+	// also refuses "." and ".." and temporary file names
+	if (*name == '.') {
+		return Http_BadRequest;
+	}
+	memmove(part->fileName, name, strlen(name)+1);
+
+	if ((strlen(dirPath) + strlen(part->fileName) + 2 > MAXPATHLEN) || (strlen(part->fileName) > NAME_MAX)) {
+		return Http_BadRequest;
+	}
+	// the file is created relative to its directory, which
+	// must be in the content tree
+	if (mkdirsBeneath(dirPath, 0777) != 0) {
+		return Http_InternalServerError;
+	}
+	part->dirFd = openBeneath(dirPath, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (part->dirFd < 0) {
+		return Http_Forbidden;
+	}
+	part->fd = makeTempFileAt(part->dirFd, part->fileName, part->tmpName);
+	if (part->fd < 0) {
+		close(part->dirFd);
+		return Http_InternalServerError;
+	}
+	return 0;
+}
+
+/**
+ * Finish a part, storing a field value or renaming a file
+ * into place.
+ * @param part the part
+ * @param dirPath the directory for files
+ * @param fields the field values by name
+ * @param files the stored file names by field name
+ * @return 0 if successful, or the status of an error response
+ */
+static int endPart(Part *part, const char *dirPath, Properties *fields, Properties *files) {
+	if (part->discard) {
+		return 0;
+	}
+	if (part->fd < 0) {
+		part->value[part->valueLen] = '\0';
+		return putProperty(fields, part->name, part->value) ? 0 : Http_PayloadTooLarge;
+	}
+
+	int status = 0;
+	if (commitFile(part->fd) != 0) {
+		status = Http_InternalServerError;
+	}
+	if ((close(part->fd) != 0) && (status == 0)) {
+		status = Http_InternalServerError;
+	}
+	part->fd = -1;
+	char filePath[MAXPATHLEN];
+	makeFilePath(dirPath, part->fileName, filePath);
+	if (status == 0) {
+		lockPath(filePath);
+		if (renameat(part->dirFd, part->tmpName, part->dirFd, part->fileName) != 0) {
+			status = Http_InternalServerError;
+		}
+		unlockPath(filePath);
+	}
+	if (status != 0) {
+		unlinkat(part->dirFd, part->tmpName, 0);
+	}
+	close(part->dirFd);
+	if (status != 0) {
+		return status;
+	}
+	reportContentChange(ContentEvent_Created, filePath, false);
+	if (commitPath(filePath) != 0) {
+		return Http_InternalServerError;
+	}
+	return putProperty(files, part->name, part->fileName) ? 0 : Http_PayloadTooLarge;
+}
+
+/**
+ * Read the parts of a body after its first delimiter.
+ * @param mp the multipart body
+ * @param part storage for the current part
+ * @param dirPath the directory for files
+ * @param partLimit maximum size of a part, or 0 for none
+ * @param fields the field values by name
+ * @param files the stored file names by field name
+ * @return 0 if successful, or the status of an error response
+ */
+static int readParts(Multipart *mp, Part *part, const char *dirPath,
+					 size_t partLimit, Properties *fields, Properties *files) {
+	for (;;) {
+		// "--" after a delimiter ends the body; otherwise
+		// padding and a CRLF start the headers of a part
+		int status = ensureWindow(mp, 2);
+		if (status != 0) {
+			return status;
+		}
+		if (memcmp(mp->buf+mp->pos, "--", 2) == 0) {
+			break;
+		}
+		while ((mp->buf[mp->pos] == ' ') || (mp->buf[mp->pos] == '\t')) {
+			mp->pos++;
+			if ((status = ensureWindow(mp, 2)) != 0) {
+				return status;
+			}
+		}
+		if (memcmp(mp->buf+mp->pos, "\r\n", 2) != 0) {
+			return Http_BadRequest;
+		}
+
+		// headers start after the CRLF, but keep it so an
+		// empty header block still ends with CRLF CRLF
+		memset(part, 0, sizeof(Part));
+		part->fd = -1;
+		part->limit = partLimit;
+		if ((status = readPartHeaders(mp, part)) != 0) {
+			return status;
+		}
+		if (part->isFile && ((status = openPartFile(part, dirPath)) != 0)) {
+			return status;
+		}
+		if (   ((status = readPartData(mp, part)) != 0)
+			|| ((status = endPart(part, dirPath, fields, files)) != 0)) {
+			return status;
+		}
+	}
+
+	// discard the epilogue after the closing delimiter
+	mp->pos = mp->len;
+	ssize_t nread;
+	while ((nread = fillWindow(mp)) > 0) {
+		mp->pos = mp->len;
+	}
+	return (nread < 0) ? mp->body->status : 0;
+}
+
+/**
+ * Read a multipart/form-data body. Parts with a file name
+ * are written to a file of that name in a directory as
+ * they arrive; other parts are small fields whose values
+ * must fit a property. Files appear only once complete.
+ *
+ * @param body the request body
+ * @param contentType the Content-Type header value
+ * @param dirPath the directory for files
+ * @param partLimit maximum size of a part, or 0 for none
+ * @param fields the field values by name
+ * @param files the stored file names by field name
+ * @return 0 if successful, or the status of an error response
+ */
+int readMultipartForm(RequestBody *body, const char *contentType, const char *dirPath,
+					  size_t partLimit, Properties *fields, Properties *files) {
+	char boundary[MULTIPART_MAX_BOUNDARY+1];
+	if (   !findParam(contentType, "boundary", boundary, sizeof(boundary))
+		|| (*boundary == '\0')) {
+		return Http_BadRequest;
+	}
+
+	Multipart *mp = malloc(sizeof(Multipart));
+	Part *part = malloc(sizeof(Part));
+	unsigned char *buf = malloc(BODY_SLICE_SIZE);
+	if ((mp == NULL) || (part == NULL) || (buf == NULL)) {
+		free(mp);
+		free(part);
+		free(buf);
+		return Http_InternalServerError;
+	}
+
+	// the delimiter is CRLF "--" boundary; the body starts
+	// with "--" boundary, so the window starts with a CRLF
+	*mp = (Multipart){.body = body, .buf = buf};
+	mp->delimLen = 4 + strlen(boundary);  // not NUL-terminated
+	memcpy(mp->delim, "\r\n--", 4);
+	memcpy(mp->delim+4, boundary, mp->delimLen-4);
+	for (int c = 0; c < 256; c++) {
+		mp->skip[c] = mp->delimLen;
+	}
+	for (size_t i = 0; i < mp->delimLen-1; i++) {
+		mp->skip[mp->delim[i]] = mp->delimLen-1 - i;
+	}
+	memcpy(buf, "\r\n", 2);
+	mp->len = 2;
+	part->fd = -1;
+
+	// skip the preamble, then read the parts
+	int status = readPartData(mp, NULL);
+	if (status == 0) {
+		status = readParts(mp, part, dirPath, partLimit, fields, files);
+	}
+	if (part->fd >= 0) {
+		close(part->fd);
+		unlinkat(part->dirFd, part->tmpName, 0);
+		close(part->dirFd);
+	}
+	free(buf);
+	free(part);
+	free(mp);
+	return status;
+}
@@ -0,0 +1,45 @@
+/*
+ * multipart.h
+ *
+ * Functions that parse multipart/form-data request
+ * bodies as they stream in.
+ *
+ *  @since 2026-10-18
+ */
+
+#ifndef MULTIPART_H_
+#define MULTIPART_H_
+
+#include <stddef.h>
+#include "properties.h"
+#include "request_body.h"
+
+/** maximum length of a multipart boundary */
+#define MULTIPART_MAX_BOUNDARY 70
+
+/**
+ * Returns true if a media type is multipart/form-data.
+ *
+ * @param contentType the Content-Type header value
+ * @return true if multipart/form-data
+ */
+bool isMultipartForm(const char *contentType);
+
+/**
+ * Read a multipart/form-data body. Parts with a file name
+ * are written to a file of that name in a directory as
+ * they arrive; other parts are small fields whose values
+ * must fit a property. Files appear only once complete.
+ *
+ * @param body the request body
+ * @param contentType the Content-Type header value
+ * @param dirPath the directory for files
+ * @param partLimit maximum size of a part, or 0 for none
+ * @param fields the field values by name
+ * @param files the stored file names by field name
+ * @return 0 if successful, or the status of an error response
+ */
+int readMultipartForm(RequestBody *body, const char *contentType, const char *dirPath,
+					  size_t partLimit, Properties *fields, Properties *files);
+
+#endif /* MULTIPART_H_ */
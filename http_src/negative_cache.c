@@ -0,0 +1,416 @@
+/*
+ * negative_cache.c
+ *
+ * Functions that answer requests for paths missing from
+ * the content tree without looking them up again.
+ *
+ * A path found missing is remembered for NegativeCacheTtl
+ * ms, in a slot of a table by path hash. Each creation in
+ * the content tree advances a change count: it forgets the
+ * path and its parents, or all paths for a directory, and
+ * a path found missing is not remembered if the count has
+ * changed since it was looked up, so a creation racing a
+ * lookup cannot leave its path remembered as missing.
+ *
+ * If NegativeCacheBloom is true, a Bloom filter also holds
+ * every path reported in the tree. A path is missing if
+ * its nearest watched parent is known and the path under
+ * it is not in the filter, since every entry of a watched
+ * directory is in it. Paths only ever join the filter, so
+ * removed paths are looked up as before.
+ *
+ * Only paths without empty, "." or ".." segments are
+ * answered, since only these match the reported paths.
+ *
+ *  @since 2026-10-18
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "negative_cache.h"
+#include "content_watch.h"
+#include "http_server.h"
+#include "path_lock.h"
+#include "string_util.h"
+
+/** number of hashes of a path in the Bloom filter */
+#define BLOOM_HASHES 7
+
+/** bits of the Bloom filter for each path, for 1% false positives */
+#define BLOOM_BITS_PER_PATH 10
+
+/** number of buckets of the watched directories to start */
+#define WATCHED_BUCKETS 1024
+
+/** A path remembered as missing */
+static struct {
+	uint64_t hash;                    /** hash of the path */
+	unsigned long stamp;              /** change count when looked up */
+	long long expires;                /** monotonic time in ms it expires */
+	char path[NEG_CACHE_PATH_SIZE];   /** the path */
+} slots[NEG_CACHE_SLOTS];
+
+/** the locks of the slots */
+static StripeLock stripes[NEG_CACHE_STRIPES];
+
+/** number of creations in the content tree */
+static unsigned long changes = 1;
+
+/** slots with an earlier stamp are forgotten */
+static unsigned long flushed = 0;
+
+/** A directory whose entries are all in the Bloom filter */
+typedef struct WatchedDir {
+	uint64_t hash;                /** hash of the path */
+	struct WatchedDir *next;      /** next in the bucket */
+	char path[];                  /** the path */
+} WatchedDir;
+
+/** the Bloom filter, or NULL if none */
+static uint64_t *bloom = NULL;
+
+/** number of bits of the Bloom filter less one */
+static uint64_t bloomMask;
+
+/** guards the watched directories, and clearing the filter */
+static pthread_rwlock_t watchedLock = PTHREAD_RWLOCK_INITIALIZER;
+
+/** the watched directories by path hash */
+static WatchedDir **watched = NULL;
+
+/** number of buckets of watched */
+static size_t watchedBuckets = 0;
+
+/** number of watched directories */
+static size_t watchedCount = 0;
+
+/**
+ * Returns the monotonic time in ms.
+ * @return the time
+ */
+static long long nowMillis(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * Returns the bit index of a hash of a path in the filter.
+ * @param hash the hash of the path
+ * @param i the number of the hash
+ * @return the bit index
+ */
+static uint64_t bloomBit(uint64_t hash, int i) {
+	// second hash for double hashing, mixed from the first
+	uint64_t hash2 = hash ^ (hash >> 31);
+	hash2 *= 0x9E3779B97F4A7C15ull;
+	return (hash + i * (hash2 | 1)) & bloomMask;
+}
+
+/**
+ * Add part of a path to the Bloom filter.
+ * @param path the path
+ * @param len the length of the part
+ */
+static void addBloom(const char *path, size_t len) {
+	uint64_t hash = strhash(path, len, false);
+	for (int i = 0; i < BLOOM_HASHES; i++) {
+		uint64_t bit = bloomBit(hash, i);
+		__atomic_fetch_or(&bloom[bit >> 6], 1ull << (bit & 63), __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Returns true if part of a path may be in the Bloom filter.
+ * @param path the path
+ * @param len the length of the part
+ * @return true if it may be in the filter, false if not
+ */
+static bool inBloom(const char *path, size_t len) {
+	uint64_t hash = strhash(path, len, false);
+	for (int i = 0; i < BLOOM_HASHES; i++) {
+		uint64_t bit = bloomBit(hash, i);
+		if ((__atomic_load_n(&bloom[bit >> 6], __ATOMIC_RELAXED) & (1ull << (bit & 63))) == 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Returns true if part of a path is of a watched directory.
+ * The watched directories must be locked.
+ * @param path the path
+ * @param len the length of the part
+ * @return true if watched
+ */
+static bool isWatched(const char *path, size_t len) {
+	uint64_t hash = strhash(path, len, false);
+	for (WatchedDir *dir = watched[hash % watchedBuckets]; dir != NULL; dir = dir->next) {
+		if ((dir->hash == hash) && (strncmp(dir->path, path, len) == 0) && (dir->path[len] == '\0')) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Add a watched directory.
+ * @param dirPath the directory path
+ */
+static void addWatched(const char *dirPath) {
+	size_t len = strlen(dirPath);
+	WatchedDir *dir = malloc(sizeof(WatchedDir) + len+1);
+	if (dir == NULL) {
+		return;  // looked up instead
+	}
+	dir->hash = strhash(dirPath, len, false);
+	memcpy(dir->path, dirPath, len+1);
+
+	pthread_rwlock_wrlock(&watchedLock);
+	if (isWatched(dirPath, len)) {
+		free(dir);
+		pthread_rwlock_unlock(&watchedLock);
+		return;
+	}
+	if (watchedCount >= 2*watchedBuckets) {
+		// rehash into twice the buckets
+		size_t buckets = 2*watchedBuckets;
+		WatchedDir **table = calloc(buckets, sizeof(WatchedDir*));
+		if (table != NULL) {
+			for (size_t b = 0; b < watchedBuckets; b++) {
+				for (WatchedDir *d = watched[b], *next; d != NULL; d = next) {
+					next = d->next;
+					d->next = table[d->hash % buckets];
+					table[d->hash % buckets] = d;
+				}
+			}
+			free(watched);
+			watched = table;
+			watchedBuckets = buckets;
+		}
+	}
+	dir->next = watched[dir->hash % watchedBuckets];
+	watched[dir->hash % watchedBuckets] = dir;
+	watchedCount++;
+	pthread_rwlock_unlock(&watchedLock);
+}
+
+/**
+ * Remove a directory and those under it from the watched
+ * directories, or all of them, also clearing the filter.
+ * @param dirPath the directory path, or NULL for all
+ */
+static void removeWatched(const char *dirPath) {
+	size_t len = (dirPath == NULL) ? 0 : strlen(dirPath);
+	pthread_rwlock_wrlock(&watchedLock);
+	for (size_t b = 0; b < watchedBuckets; b++) {
+		for (WatchedDir **prev = &watched[b], *dir; (dir = *prev) != NULL; ) {
+			if (   (dirPath == NULL)
+				|| ((strncmp(dir->path, dirPath, len) == 0) && ((dir->path[len] == '\0') || (dir->path[len] == '/')))) {
+				*prev = dir->next;
+				free(dir);
+				watchedCount--;
+			} else {
+				prev = &dir->next;
+			}
+		}
+	}
+	if (dirPath == NULL) {
+		memset(bloom, 0, (bloomMask+1) / 8);
+	}
+	pthread_rwlock_unlock(&watchedLock);
+}
+
+/**
+ * Returns true if a path is not in the content tree as the
+ * filter and the watched directories know it.
+ * @param path the path
+ * @param len the length of the path
+ * @return true if missing
+ */
+static bool isMissingFromTree(const char *path, size_t len) {
+	bool missing = false;
+	pthread_rwlock_rdlock(&watchedLock);
+	// from the parent up, find the nearest watched directory
+	for (size_t childLen = len; ; ) {
+		size_t parentLen = childLen;
+		while ((parentLen > server.content_base_len) && (path[parentLen-1] != '/')) {
+			parentLen--;
+		}
+		if (parentLen <= server.content_base_len) {
+			break;
+		}
+		parentLen--;
+		if (isWatched(path, parentLen)) {
+			missing = !inBloom(path, childLen);
+			break;
+		}
+		childLen = parentLen;
+	}
+	pthread_rwlock_unlock(&watchedLock);
+	return missing;
+}
+
+/**
+ * Forget part of a path remembered as missing.
+ * @param path the path
+ * @param len the length of the part
+ */
+static void forgetMissingPath(const char *path, size_t len) {
+	uint64_t hash = strhash(path, len, false);
+	size_t slot = hash % NEG_CACHE_SLOTS;
+	pthread_mutex_t *mutex = stripeMutex(stripes, NEG_CACHE_STRIPES, slot);
+	pthread_mutex_lock(mutex);
+	if (   (slots[slot].hash == hash) && (strncmp(slots[slot].path, path, len) == 0)
+		&& (slots[slot].path[len] == '\0')) {
+		slots[slot].path[0] = '\0';
+	}
+	pthread_mutex_unlock(mutex);
+}
+
+/**
+ * Listener to changes to the content tree.
+ * @param event the change
+ * @param path the file path, or NULL if ContentEvent_Lost
+ * @param isDir true if the path is of a directory
+ * @param sb the status of the path, or NULL if not known
+ */
+static void contentChanged(enum ContentEvent event, const char *path, bool isDir, const struct stat *sb) {
+	(void)sb;
+	size_t len = (path == NULL) ? 0 : contentPathLen(path);
+	switch (event) {
+	case ContentEvent_Created:
+		if ((len == 0) || isDir) {
+			// may be any path, or many paths under the directory
+			__atomic_store_n(&flushed, __atomic_add_fetch(&changes, 1, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+		} else {
+			__atomic_add_fetch(&changes, 1, __ATOMIC_SEQ_CST);
+		}
+		// the path and its parents exist
+		for (size_t end = len; end > server.content_base_len; ) {
+			if (bloom != NULL) {
+				addBloom(path, end);
+			}
+			forgetMissingPath(path, end);
+			do {
+				end--;
+			} while ((end > server.content_base_len) && (path[end] != '/'));
+		}
+		if ((len != 0) && isDir && (bloom != NULL)) {
+			// entries moved in with it are not yet in the filter
+			removeWatched(path);
+		}
+		break;
+	case ContentEvent_Removed:
+		if ((len != 0) && isDir && (bloom != NULL)) {
+			removeWatched(path);
+		}
+		break;
+	case ContentEvent_Watched:
+		if ((len != 0) && (bloom != NULL)) {
+			addWatched(path);
+		}
+		break;
+	case ContentEvent_Changed:
+		break;
+	case ContentEvent_Lost:
+		if (bloom != NULL) {
+			removeWatched(NULL);
+		}
+		__atomic_store_n(&flushed, __atomic_add_fetch(&changes, 1, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+		break;
+	}
+}
+
+/**
+ * Start remembering missing paths as configured, and
+ * listening for paths created in the content tree.
+ *
+ * @return true if successful, false with errno set if error
+ */
+bool initNegativeCache(void) {
+	initStripeLocks(stripes, NEG_CACHE_STRIPES);
+	if (server.negative_cache_bloom) {
+		uint64_t bits = 64;
+		while (bits < (uint64_t)server.negative_cache_bloom_size * BLOOM_BITS_PER_PATH) {
+			bits <<= 1;
+		}
+		bloom = calloc(bits / 64, sizeof(uint64_t));
+		watched = calloc(WATCHED_BUCKETS, sizeof(WatchedDir*));
+		if ((bloom == NULL) || (watched == NULL)) {
+			return false;
+		}
+		bloomMask = bits - 1;
+		watchedBuckets = WATCHED_BUCKETS;
+	}
+	if ((server.negative_cache_ttl > 0) || (bloom != NULL)) {
+		addContentListener(contentChanged);
+	}
+	return true;
+}
+
+/**
+ * Returns true if a path is known to be missing: it was
+ * missing within the configured time, or it is not in the
+ * filter of the paths of the content tree.
+ *
+ * @param filePath the file path
+ * @param stamp the stamp for addMissingPath() if missing
+ *   when looked up
+ * @return true if the path is known to be missing
+ */
+bool isKnownMissing(const char *filePath, unsigned long *stamp) {
+	*stamp = __atomic_load_n(&changes, __ATOMIC_SEQ_CST);
+	size_t len = contentPathLen(filePath);
+	if (len == 0) {
+		return false;
+	}
+	if ((bloom != NULL) && isMissingFromTree(filePath, len)) {
+		return true;
+	}
+	if ((server.negative_cache_ttl == 0) || (len >= NEG_CACHE_PATH_SIZE)) {
+		return false;
+	}
+	uint64_t hash = strhash(filePath, len, false);
+	size_t slot = hash % NEG_CACHE_SLOTS;
+	pthread_mutex_t *mutex = stripeMutex(stripes, NEG_CACHE_STRIPES, slot);
+	pthread_mutex_lock(mutex);
+	bool missing =    (slots[slot].hash == hash)
+				   && (slots[slot].stamp >= __atomic_load_n(&flushed, __ATOMIC_SEQ_CST))
+				   && (slots[slot].expires > nowMillis())
+				   && (strncmp(slots[slot].path, filePath, len) == 0)
+				   && (slots[slot].path[len] == '\0');
+	pthread_mutex_unlock(mutex);
+	return missing;
+}
+
+/**
+ * Remember a path found missing. It is not remembered if
+ * a path was created since isKnownMissing() returned the
+ * stamp, since it may be this path.
+ *
+ * @param filePath the file path
+ * @param stamp the stamp from isKnownMissing()
+ */
+void addMissingPath(const char *filePath, unsigned long stamp) {
+	size_t len = contentPathLen(filePath);
+	if ((server.negative_cache_ttl == 0) || (len == 0) || (len >= NEG_CACHE_PATH_SIZE)) {
+		return;
+	}
+	uint64_t hash = strhash(filePath, len, false);
+	size_t slot = hash % NEG_CACHE_SLOTS;
+	pthread_mutex_t *mutex = stripeMutex(stripes, NEG_CACHE_STRIPES, slot);
+	pthread_mutex_lock(mutex);
+	if (__atomic_load_n(&changes, __ATOMIC_SEQ_CST) == stamp) {
+		slots[slot].hash = hash;
+		slots[slot].stamp = stamp;
+		slots[slot].expires = nowMillis() + server.negative_cache_ttl;
+		memcpy(slots[slot].path, filePath, len);
+		slots[slot].path[len] = '\0';
+	}
+	pthread_mutex_unlock(mutex);
+}
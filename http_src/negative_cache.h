@@ -0,0 +1,54 @@
+/*
+ * negative_cache.h
+ *
+ * Functions that answer requests for paths missing from
+ * the content tree without looking them up again.
+ *
+ *  @since 2026-10-18
+ */
+
+#ifndef NEGATIVE_CACHE_H_
+#define NEGATIVE_CACHE_H_
+
+#include <stdbool.h>
+
+/** number of paths remembered as missing */
+#define NEG_CACHE_SLOTS 4096
+
+/** longest path remembered as missing, including the NUL */
+#define NEG_CACHE_PATH_SIZE 256
+
+/** number of locks of the remembered paths */
+#define NEG_CACHE_STRIPES 64
+
+/**
+ * Start remembering missing paths as configured, and
+ * listening for paths created in the content tree.
+ *
+ * @return true if successful, false with errno set if error
+ */
+bool initNegativeCache(void);
+
+/**
+ * Returns true if a path is known to be missing: it was
+ * missing within the configured time, or it is not in the
+ * filter of the paths of the content tree.
+ *
+ * @param filePath the file path
+ * @param stamp the stamp for addMissingPath() if missing
+ *   when looked up
+ * @return true if the path is known to be missing
+ */
+bool isKnownMissing(const char *filePath, unsigned long *stamp);
+
+/**
+ * Remember a path found missing. It is not remembered if
+ * a path was created since isKnownMissing() returned the
+ * stamp, since it may be this path.
+ *
+ * @param filePath the file path
+ * @param stamp the stamp from isKnownMissing()
+ */
+void addMissingPath(const char *filePath, unsigned long stamp);
+
+#endif /* NEGATIVE_CACHE_H_ */
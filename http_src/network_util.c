@@ -96,6 +96,21 @@ int get_listener_socket(int port) {
 	return listen_sock_fd;
 }
 
+/**
+ * Keep writes to a socket closed by the peer from raising
+ * SIGPIPE on systems without MSG_NOSIGNAL.
+ *
+ * @param sock_fd the socket
+ */
+void set_socket_nosigpipe(int sock_fd) {
+#if defined(SO_NOSIGPIPE)
+	int optval = 1;
+	setsockopt(sock_fd, SOL_SOCKET, SO_NOSIGPIPE, &optval, sizeof(optval));
+#else
+	(void)sock_fd;
+#endif
+}
+
 /**
  * Accept new peer connection on a listen socket.
  *
@@ -108,6 +123,7 @@ int accept_peer_connection(int listen_sock_fd) {
 		socklen_t peer_size = sizeof(peer_addr);
 		int peer_sock_fd = accept(listen_sock_fd, (struct sockaddr *)&peer_addr, &peer_size);
 		if (peer_sock_fd > 0) {
+			set_socket_nosigpipe(peer_sock_fd);
 			return peer_sock_fd;
 		}
 		perror("accept");
@@ -155,4 +171,19 @@ int get_peer_host_and_port(int sock_fd, char *host, int *port) {
     return status;
 }
 
+/**
+ * Get the peer IPv4 address of a socket as a number,
+ * for use as a key for the client.
+ *
+ * @param sock_fd the socket
+ * @return the address in host byte order, or 0 if unavailable
+ */
+unsigned long get_peer_address(int sock_fd) {
+	struct sockaddr_in addr;
+	socklen_t size = sizeof(addr);
 
+	if (getpeername(sock_fd, (struct sockaddr *)&addr, &size) != 0) {
+		return 0;
+	}
+	return ntohl(addr.sin_addr.s_addr);
+}
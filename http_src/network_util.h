@@ -12,10 +12,16 @@
 
 #include <stdbool.h>
 #include <limits.h>
+#include <sys/socket.h>
 #ifndef HOST_NAME_MAX
 #define HOST_NAME_MAX 256  // POSIX definition
 #endif
 
+// MacOS has no MSG_NOSIGNAL, so sockets are set SO_NOSIGPIPE
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
 // min and max IANA registered ports
 #define MIN_REG_PORT 1024
 #define MAX_REG_PORT 49151
@@ -83,6 +89,14 @@ int get_listener_socket(int port) ;
  */
 int accept_peer_connection(int listen_sock_fd);
 
+/**
+ * Keep writes to a socket closed by the peer from raising
+ * SIGPIPE on systems without MSG_NOSIGNAL.
+ *
+ * @param sock_fd the socket
+ */
+void set_socket_nosigpipe(int sock_fd);
+
 /**
  * Get the local host and port for a socket.
  *
@@ -103,4 +117,13 @@ int get_local_host_and_port(int sock_fd, char *addr_str, int *port);
  */
 int get_peer_host_and_port(int sock_fd, char *addr_str, int *port);
 
+/**
+ * Get the peer IPv4 address of a socket as a number,
+ * for use as a key for the client.
+ *
+ * @param sock_fd the socket
+ * @return the address in host byte order, or 0 if unavailable
+ */
+unsigned long get_peer_address(int sock_fd);
+
 #endif /* NETWORK_UTIL_H_ */
@@ -0,0 +1,96 @@
+/*
+ * path_lock.c
+ *
+ * Functions that give writers of a file path exclusive
+ * use of it, from a table of locks striped by path hash.
+ *
+ * Readers do not lock: they open the file and serve it
+ * from the descriptor, and writers only ever replace a
+ * file by rename or remove it by unlink, so an open file
+ * stays whole. Writers lock to check and change a path
+ * as one step, so a conditional update or delete cannot
+ * interleave with another on the same path.
+ *
+ *  @since 2026-10-18
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include "path_lock.h"
+#include "string_util.h"
+
+/** the lock table */
+static StripeLock stripes[PATH_LOCK_STRIPES];
+
+/** guards creating the locks */
+static pthread_once_t stripesOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Create the locks of the table.
+ */
+static void initStripes(void) {
+	initStripeLocks(stripes, PATH_LOCK_STRIPES);
+}
+
+/**
+ * Create the locks of a striped table.
+ *
+ * @param stripes the locks
+ * @param count the number of locks
+ */
+void initStripeLocks(StripeLock *stripes, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		pthread_mutex_init(&stripes[i].mutex, NULL);
+	}
+}
+
+/**
+ * Returns the lock of a striped table for a hash.
+ *
+ * @param stripes the locks
+ * @param count the number of locks
+ * @param hash the hash of what is locked
+ * @return the lock
+ */
+pthread_mutex_t *stripeMutex(StripeLock *stripes, size_t count, uint64_t hash) {
+	return &stripes[hash % count].mutex;
+}
+
+/**
+ * Returns the lock of a file path from its FNV-1a hash.
+ * A trailing '/' is not hashed, so the path locks the
+ * entry openParentBeneath() changes: its directory and
+ * last component.
+ * @param filePath the file path
+ * @return the lock
+ */
+static pthread_mutex_t *pathMutex(const char *filePath) {
+	size_t len = strlen(filePath);
+	while ((len > 1) && (filePath[len-1] == '/')) {
+		len--;
+	}
+	pthread_once(&stripesOnce, initStripes);
+	return stripeMutex(stripes, PATH_LOCK_STRIPES, strhash(filePath, len, false));
+}
+
+/**
+ * Lock a file path for a change to it. Paths are locked
+ * only briefly around the change, not while waiting for
+ * I/O, and only one path at a time, since paths that
+ * share a lock would otherwise deadlock.
+ *
+ * @param filePath the file path
+ */
+void lockPath(const char *filePath) {
+	pthread_mutex_lock(pathMutex(filePath));
+}
+
+/**
+ * Unlock a file path locked by lockPath().
+ *
+ * @param filePath the file path
+ */
+void unlockPath(const char *filePath) {
+	pthread_mutex_unlock(pathMutex(filePath));
+}
@@ -0,0 +1,61 @@
+/*
+ * path_lock.h
+ *
+ * Functions that give writers of a file path exclusive
+ * use of it, from a table of locks striped by path hash.
+ *
+ *  @since 2026-10-18
+ */
+
+#ifndef PATH_LOCK_H_
+#define PATH_LOCK_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** number of locks in the table; paths share locks by hash */
+#define PATH_LOCK_STRIPES 256
+
+/** A lock of a striped table, on its own cache line */
+typedef struct StripeLock {
+	pthread_mutex_t mutex;
+	char pad[64 - sizeof(pthread_mutex_t) % 64];
+} StripeLock;
+
+/**
+ * Create the locks of a striped table.
+ *
+ * @param stripes the locks
+ * @param count the number of locks
+ */
+void initStripeLocks(StripeLock *stripes, size_t count);
+
+/**
+ * Returns the lock of a striped table for a hash.
+ *
+ * @param stripes the locks
+ * @param count the number of locks
+ * @param hash the hash of what is locked
+ * @return the lock
+ */
+pthread_mutex_t *stripeMutex(StripeLock *stripes, size_t count, uint64_t hash);
+
+/**
+ * Lock a file path for a change to it. Paths are locked
+ * only briefly around the change, not while waiting for
+ * I/O, and only one path at a time, since paths that
+ * share a lock would otherwise deadlock.
+ *
+ * @param filePath the file path
+ */
+void lockPath(const char *filePath);
+
+/**
+ * Unlock a file path locked by lockPath().
+ *
+ * @param filePath the file path
+ */
+void unlockPath(const char *filePath);
+
+#endif /* PATH_LOCK_H_ */
@@ -0,0 +1,167 @@
+/*
+ * pool.c
+ *
+ * Functions that implement pools of fixed-size objects
+ * allocated from slabs, with a cache of free objects
+ * for each thread.
+ *
+ * Threads allocate and free objects through their own
+ * cache without locking. A cache that grows past
+ * POOL_CACHE_MAX returns half its objects to a list
+ * shared by all threads, and an empty cache refills
+ * from that list before allocating a new slab. Memory
+ * in each pool is therefore bounded by its peak use.
+ *
+ *  @since 2026-10-18
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "pool.h"
+
+/** maximum number of pools */
+#define POOL_MAX_POOLS 8
+
+/** maximum free objects in the cache of a thread */
+#define POOL_CACHE_MAX 64
+
+/** alignment of pool objects */
+#define POOL_ALIGN 64
+
+/** Definition of a free object */
+typedef struct PoolObject {
+	struct PoolObject *next;	/** next free object */
+} PoolObject;
+
+/** Definition of a pool */
+struct Pool {
+	size_t objSize;				/** size of objects */
+	size_t slabObjects;			/** objects per slab */
+	int id;						/** index of thread caches */
+	pthread_mutex_t lock;		/** guards shared list */
+	PoolObject *shared;			/** free objects shared by threads */
+	size_t nshared;				/** number of shared objects */
+};
+
+/** Definition of the cache of free objects of a thread */
+typedef struct PoolCache {
+	PoolObject *free;			/** free objects */
+	size_t count;				/** number of free objects */
+} PoolCache;
+
+/** caches of this thread by pool */
+static __thread PoolCache poolCaches[POOL_MAX_POOLS];
+
+/** number of pools created */
+static int npools = 0;
+
+/**
+ * Create a new pool of objects. Pools live until the
+ * process exits, and at most POOL_MAX_POOLS can exist.
+ *
+ * @param objSize the size of objects
+ * @param slabObjects the number of objects per slab
+ * @return the new pool or NULL if no space
+ */
+Pool *newPool(size_t objSize, size_t slabObjects) {
+	int id = __atomic_fetch_add(&npools, 1, __ATOMIC_RELAXED);
+	if (id >= POOL_MAX_POOLS) {
+		return NULL;
+	}
+	Pool *pool = malloc(sizeof(Pool));
+	if (pool == NULL) {
+		return NULL;
+	}
+	if (objSize < sizeof(PoolObject)) {
+		objSize = sizeof(PoolObject);
+	}
+	*pool = (Pool){.objSize = (objSize + POOL_ALIGN-1) & ~(size_t)(POOL_ALIGN-1),
+				   .slabObjects = (slabObjects == 0) ? 1 : slabObjects, .id = id};
+	pthread_mutex_init(&pool->lock, NULL);
+	return pool;
+}
+
+/**
+ * Refill the cache of this thread from the shared list,
+ * or from a new slab if none are shared.
+ *
+ * @param pool the pool
+ * @param cache the cache of this thread
+ */
+static void refillCache(Pool *pool, PoolCache *cache) {
+	pthread_mutex_lock(&pool->lock);
+	while ((pool->shared != NULL) && (cache->count < POOL_CACHE_MAX/2)) {
+		PoolObject *obj = pool->shared;
+		pool->shared = obj->next;
+		pool->nshared--;
+		obj->next = cache->free;
+		cache->free = obj;
+		cache->count++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (cache->free == NULL) {
+		char *slab = aligned_alloc(POOL_ALIGN, pool->objSize * pool->slabObjects);
+		if (slab == NULL) {
+			return;
+		}
+		for (size_t i = pool->slabObjects; i-- > 0; ) {
+			PoolObject *obj = (PoolObject*)(slab + i*pool->objSize);
+			obj->next = cache->free;
+			cache->free = obj;
+			cache->count++;
+		}
+	}
+}
+
+/**
+ * Allocate an object from a pool, first from the cache
+ * of this thread, then from objects shared by all threads,
+ * then from a new slab.
+ *
+ * @param pool the pool
+ * @return the object or NULL if no space
+ */
+void *allocPool(Pool *pool) {
+	PoolCache *cache = &poolCaches[pool->id];
+	if (cache->free == NULL) {
+		refillCache(pool, cache);
+		if (cache->free == NULL) {
+			return NULL;
+		}
+	}
+	PoolObject *obj = cache->free;
+	cache->free = obj->next;
+	cache->count--;
+	return obj;
+}
+
+/**
+ * Return an object to a pool. Objects can be returned
+ * by any thread.
+ *
+ * @param pool the pool
+ * @param obj the object
+ */
+void freePool(Pool *pool, void *obj) {
+	PoolCache *cache = &poolCaches[pool->id];
+	PoolObject *pobj = obj;
+	pobj->next = cache->free;
+	cache->free = pobj;
+	cache->count++;
+
+	// return half of a full cache to the shared list
+	if (cache->count > POOL_CACHE_MAX) {
+		pthread_mutex_lock(&pool->lock);
+		while (cache->count > POOL_CACHE_MAX/2) {
+			pobj = cache->free;
+			cache->free = pobj->next;
+			cache->count--;
+			pobj->next = pool->shared;
+			pool->shared = pobj;
+			pool->nshared++;
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
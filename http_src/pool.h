@@ -0,0 +1,48 @@
+/*
+ * pool.h
+ *
+ * Functions that implement pools of fixed-size objects
+ * allocated from slabs, with a cache of free objects
+ * for each thread.
+ *
+ *  @since 2026-10-18
+ */
+
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stddef.h>
+
+/** Declaration of Pool as opaque type */
+typedef struct Pool Pool;
+
+/**
+ * Create a new pool of objects. Pools live until the
+ * process exits, and at most POOL_MAX_POOLS can exist.
+ *
+ * @param objSize the size of objects
+ * @param slabObjects the number of objects per slab
+ * @return the new pool or NULL if no space
+ */
+Pool *newPool(size_t objSize, size_t slabObjects);
+
+/**
+ * Allocate an object from a pool, first from the cache
+ * of this thread, then from objects shared by all threads,
+ * then from a new slab.
+ *
+ * @param pool the pool
+ * @return the object or NULL if no space
+ */
+void *allocPool(Pool *pool);
+
+/**
+ * Return an object to a pool. Objects can be returned
+ * by any thread.
+ *
+ * @param pool the pool
+ * @param obj the object
+ */
+void freePool(Pool *pool, void *obj);
+
+#endif /* POOL_H_ */
@@ -8,30 +8,246 @@
  */
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
+#include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "file_util.h"
 #include "string_util.h"
 #include "http_server.h"
 #include "properties.h"
 #include "varray.h"
+#include "arena.h"
+
+/** number of properties at which a list is indexed */
+#define PROP_INDEX_THRESHOLD 8
 
 /** Definition of an entry in a property list */
 typedef struct Property {
-	char* name; /** name of property */
-	char* val;  /** value of property */
+	char* name; 	/** name of property */
+	char* val;  	/** value of property */
+	size_t nameLen;	/** length of name */
+	size_t valLen;	/** length of value */
+	uint32_t hash;	/** case-folded hash of name */
+	size_t next;	/** index of next property with same name or SIZE_MAX */
 } Property;
 
+/** Definition of an index slot for one property name */
+typedef struct PropSlot {
+	uint32_t hash;	/** case-folded hash of name */
+	size_t first;	/** index of first property with name or SIZE_MAX if empty */
+	size_t last;	/** index of last property with name */
+} PropSlot;
+
+/** snapshot file magic and format version */
+#define PROP_SNAP_MAGIC "PROPSNAP"
+#define PROP_SNAP_VERSION 2
+
+/**
+ * Definition of the header of a properties snapshot file. The
+ * header is followed by the property array, the index slots,
+ * and the pool of null-terminated name and value strings.
+ */
+typedef struct PropSnapHeader {
+	char magic[8];			/** PROP_SNAP_MAGIC */
+	uint32_t version;		/** PROP_SNAP_VERSION */
+	uint32_t nprops;		/** number of properties */
+	uint32_t indexSize;		/** number of index slots, a power of 2 */
+	uint32_t poolSize;		/** size of string pool */
+	int64_t srcSize;		/** size of source file */
+	int64_t srcMtimeSec;	/** modification time of source file */
+	int64_t srcMtimeNsec;
+} PropSnapHeader;
+
+/** Definition of a property in a snapshot */
+typedef struct SnapProperty {
+	uint32_t name;			/** pool offset of name */
+	uint32_t nameLen;		/** length of name */
+	uint32_t val;			/** pool offset of value */
+	uint32_t valLen;		/** length of value */
+	uint32_t hash;			/** case-folded hash of name */
+	uint32_t next;			/** index of next property with same name or UINT32_MAX */
+} SnapProperty;
+
+/** Definition of an index slot in a snapshot */
+typedef struct SnapSlot {
+	uint32_t hash;			/** case-folded hash of name */
+	uint32_t first;			/** index of first property with name or UINT32_MAX if empty */
+} SnapSlot;
+
 /** Definition of a property list */
 typedef struct Properties {
-	VArray* props;  			/** VArray of properties */
+	VArray* props;  			/** VArray of properties or NULL if mapped */
+	PropSlot* index;			/** open-addressing index by name or NULL */
+	size_t indexSize;			/** number of index slots, a power of 2 */
+	size_t nnames;				/** number of names in index */
+	const PropSnapHeader* snap;	/** mapped read-only snapshot or NULL */
+	size_t snapLen;				/** length of mapped snapshot */
+	Arena* arena;				/** arena for storage or NULL for heap */
 } Properties;
 
+/**
+ * Returns the property array of a snapshot.
+ *
+ * @param snap the snapshot
+ * @return the property array
+ */
+static const SnapProperty* snapProperties(const PropSnapHeader* snap) {
+	return (const SnapProperty*)(snap + 1);
+}
+
+/**
+ * Returns the index slots of a snapshot.
+ *
+ * @param snap the snapshot
+ * @return the index slots
+ */
+static const SnapSlot* snapSlots(const PropSnapHeader* snap) {
+	return (const SnapSlot*)(snapProperties(snap) + snap->nprops);
+}
+
+/**
+ * Returns the string pool of a snapshot.
+ *
+ * @param snap the snapshot
+ * @return the string pool
+ */
+static const char* snapPool(const PropSnapHeader* snap) {
+	return (const char*)(snapSlots(snap) + snap->indexSize);
+}
+
+/**
+ * Returns a view of the name and value of a property.
+ *
+ * @param props the properties
+ * @param propIndex the property index, less than nProperties()
+ * @param ref set to the property name and value
+ */
+static void propertyAt(const Properties* props, size_t propIndex, PropertyRef* ref) {
+	if (props->snap != NULL) {
+		const SnapProperty* prop = &snapProperties(props->snap)[propIndex];
+		*ref = (PropertyRef){snapPool(props->snap) + prop->name, prop->nameLen,
+							 snapPool(props->snap) + prop->val, prop->valLen};
+	} else {
+		const Property* prop = elementAtVArray(props->props, propIndex);
+		*ref = (PropertyRef){prop->name, prop->nameLen, prop->val, prop->valLen};
+	}
+}
+
+/**
+ * Returns the FNV-1a hash of a property name,
+ * folded to lower case.
+ *
+ * @param name the property name
+ * @return the hash of the name
+ */
+static uint32_t hashName(const char* name) {
+	return (uint32_t)strhash(name, SIZE_MAX, true);
+}
+
+/**
+ * Returns the index slot for a property name: the slot
+ * with the name, or the empty slot where it belongs.
+ *
+ * @param props the properties
+ * @param name the property name
+ * @param hash the hash of the name
+ * @return the index slot
+ */
+static PropSlot* findSlot(Properties* props, const char* name, uint32_t hash) {
+	size_t mask = props->indexSize - 1;
+	for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+		PropSlot* slot = &props->index[i];
+		if (slot->first == SIZE_MAX) {
+			return slot;
+		}
+		if (slot->hash == hash) {
+			Property* prop = elementAtVArray(props->props, slot->first);
+			if (strcasecmp(name, prop->name) == 0) {
+				return slot;
+			}
+		}
+	}
+}
+
+/**
+ * Add a property to the index, linking it after the
+ * last property with the same name.
+ *
+ * @param props the properties
+ * @param propIndex the index of the property
+ */
+static void indexProperty(Properties* props, size_t propIndex) {
+	Property* prop = elementAtVArray(props->props, propIndex);
+	PropSlot* slot = findSlot(props, prop->name, prop->hash);
+	if (slot->first == SIZE_MAX) {
+		slot->hash = prop->hash;
+		slot->first = propIndex;
+		props->nnames++;
+	} else {
+		Property* last = elementAtVArray(props->props, slot->last);
+		last->next = propIndex;
+	}
+	slot->last = propIndex;
+}
+
+/**
+ * Rebuild the index with enough slots to keep it at
+ * most half full, relinking properties with the same
+ * name in insertion order.
+ *
+ * @param props the properties
+ * @param nprops the number of properties to index
+ */
+static void rebuildIndex(Properties* props, size_t nprops) {
+	size_t indexSize = 2*PROP_INDEX_THRESHOLD;
+	while (indexSize < 2*nprops) {
+		indexSize *= 2;
+	}
+	if (props->arena != NULL) {
+		props->index = allocArena(props->arena, indexSize * sizeof(PropSlot));
+	} else {
+		free(props->index);
+		props->index = malloc(indexSize * sizeof(PropSlot));
+	}
+	props->indexSize = indexSize;
+	props->nnames = 0;
+	for (size_t i = 0; i < indexSize; i++) {
+		props->index[i].first = SIZE_MAX;
+	}
+	for (size_t i = 0; i < nprops; i++) {
+		Property* prop = elementAtVArray(props->props, i);
+		prop->next = SIZE_MAX;
+		indexProperty(props, i);
+	}
+}
+
 /**
  * Create a new properties.
  * @return a new properties
  */
 Properties* newProperties() {
     Properties* props = malloc(sizeof(Properties));
-	props->props = newVArray(sizeof(Property), 4);
+	*props = (Properties){.props = newVArray(sizeof(Property), 4)};
+	return props;
+}
+
+/**
+ * Create a new properties whose storage, including
+ * names and values, is allocated from an arena.
+ * Deleting the properties is optional; storage
+ * lives until the arena is reset.
+ *
+ * @param arena the arena
+ * @return a new properties
+ */
+Properties* newArenaProperties(Arena* arena) {
+	Properties* props = allocArena(arena, sizeof(Properties));
+	*props = (Properties){.props = newArenaVArray(arena, sizeof(Property), 16), .arena = arena};
 	return props;
 }
 
@@ -40,6 +256,16 @@ Properties* newProperties() {
  * @param a properties
  */
 void deleteProperties(Properties* props) {
+	if (props->snap != NULL) {
+		// unmaps snapshot and frees struct
+		munmap((void*)props->snap, props->snapLen);
+		free(props);
+		return;
+	}
+	if (props->arena != NULL) {
+		// storage is released with arena
+		return;
+	}
 
 	// frees property names and value strings
 	size_t nprops = sizeVArray(props->props);
@@ -51,26 +277,55 @@ void deleteProperties(Properties* props) {
 
 	deleteVArray(props->props);  // frees varray
 	props->props = NULL;  // reset varray field
+	free(props->index);  // frees index
+	props->index = NULL;
 
 	// frees struct
 	free(props);
 }
 
 /**
- * Put a property to the properties.
+ * Put a property to the properties. Once the properties
+ * grow past a threshold, they are indexed by name here,
+ * so lookups never modify the properties.
+ *
  * @param a properties
  * @param name a property name
  * @param val a property value
- * @return true if property added
+ * @return true if property added, false if mapped
  */
 bool putProperty(Properties* props, const char* name, const char* val) {
+	if (props->snap != NULL) {
+		return false;
+	}
 	size_t nprops = nProperties(props);
 	Property* prop = elementAtVArray(props->props, nprops);
 	if (prop == NULL) {
 		return false;
 	}
-	prop->name = strdup(name);
-	prop->val = strdup(val);
+	if (props->arena != NULL) {
+		prop->name = strdupArena(props->arena, name);
+		prop->val = strdupArena(props->arena, val);
+	} else {
+		prop->name = strdup(name);
+		prop->val = strdup(val);
+	}
+	prop->nameLen = strlen(name);
+	prop->valLen = strlen(val);
+	prop->hash = hashName(name);
+	prop->next = SIZE_MAX;
+
+	// index all properties at threshold, then grow
+	// index before it becomes more than half full
+	if (props->index != NULL) {
+		if (2*(props->nnames + 1) > props->indexSize) {
+			rebuildIndex(props, nprops + 1);
+		} else {
+			indexProperty(props, nprops);
+		}
+	} else if (nprops + 1 >= PROP_INDEX_THRESHOLD) {
+		rebuildIndex(props, nprops + 1);
+	}
 
 	return true;
 }
@@ -92,17 +347,122 @@ bool getProperty(Properties* props, size_t propIndex, char* name, char* val) {
 		return false;
 	}
 
-	Property* prop = elementAtVArray(props->props, propIndex);
+	PropertyRef prop;
+	propertyAt(props, propIndex, &prop);
 
 	// return name property truncated to MAX_PROP_NAME bytes
-	strlcpy(name, prop->name, MAX_PROP_NAME);
+	strlcpy(name, prop.name, MAX_PROP_NAME);
 
 	// return value property truncated to MAX_PROP_VAL-1 length
-	strlcpy(val, prop->val, MAX_PROP_VAL);
+	strlcpy(val, prop.val, MAX_PROP_VAL);
 
 	return true;
 }
 
+/**
+ * Get name and value for the specified property index
+ * without copying or truncating. The strings are valid
+ * until the properties are deleted.
+ *
+ * @param props a properties
+ * @param propIndex the property index
+ * @param ref set to the property name and value
+ * @return true if property at specified index is available
+ */
+bool getPropertyRef(Properties* props, size_t propIndex, PropertyRef* ref) {
+	if (propIndex >= nProperties(props)) {
+		return false;
+	}
+	propertyAt(props, propIndex, ref);
+	return true;
+}
+
+/**
+ * Find the index of a property by name in a snapshot.
+ *
+ * @param snap the snapshot
+ * @param propIndex the starting property index
+ * @param name prop name
+ * @param hash the hash of the name
+ * @return the index of the property or SIZE_MAX if not found
+ */
+static size_t findSnapProperty(const PropSnapHeader* snap, size_t propIndex, const char* name, uint32_t hash) {
+	const SnapProperty* snapProps = snapProperties(snap);
+	const char* pool = snapPool(snap);
+
+	// continue after a previous match with the same name
+	const SnapProperty* prev = (propIndex > 0) ? &snapProps[propIndex-1] : NULL;
+	if ((prev != NULL) && (prev->hash == hash) && (strcasecmp(name, pool + prev->name) == 0)) {
+		return (prev->next == UINT32_MAX) ? SIZE_MAX : prev->next;
+	}
+
+	// else follow properties with the name from the index slot
+	const SnapSlot* slots = snapSlots(snap);
+	uint32_t mask = snap->indexSize - 1;
+	for (uint32_t i = hash & mask; slots[i].first != UINT32_MAX; i = (i + 1) & mask) {
+		if ((slots[i].hash == hash) && (strcasecmp(name, pool + snapProps[slots[i].first].name) == 0)) {
+			uint32_t next = slots[i].first;
+			while ((next != UINT32_MAX) && (next < propIndex)) {
+				next = snapProps[next].next;
+			}
+			return (next == UINT32_MAX) ? SIZE_MAX : next;
+		}
+	}
+	return SIZE_MAX;
+}
+
+/**
+ * Find a property by name, starting with specified property index,
+ * without copying or truncating. Property comparison is
+ * case-independent. Larger properties are indexed by name, and
+ * continuing after a previous result is constant time.
+ *
+ * @param props the properties
+ * @param propIndex the starting property index
+ * @param name prop name
+ * @param ref set to the property name and value
+ * @return the index of the property found or SIZE_MAX if not found
+ */
+size_t findPropertyRef(Properties* props, size_t propIndex, const char* name, PropertyRef* ref) {
+	size_t nprops = nProperties(props);
+	if (propIndex >= nprops) {
+		return SIZE_MAX;
+	}
+	uint32_t hash = hashName(name);
+
+	if (props->snap != NULL) {
+		propIndex = findSnapProperty(props->snap, propIndex, name, hash);
+	} else if (props->index == NULL) {
+		// search small properties in order
+		for ( ; propIndex < nprops; propIndex++) {
+			Property* prop = elementAtVArray(props->props, propIndex);
+			if ((prop->hash == hash) && (strcasecmp(name, prop->name) == 0)) {
+				break;
+			}
+		}
+	} else {
+		// continue after a previous match with the same name, else
+		// follow properties with the name from the index slot
+		Property* prev = (propIndex > 0) ? elementAtVArray(props->props, propIndex-1) : NULL;
+		size_t i;
+		if ((prev != NULL) && (prev->hash == hash) && (strcasecmp(name, prev->name) == 0)) {
+			i = prev->next;
+		} else {
+			i = findSlot(props, name, hash)->first;
+			while (i < propIndex) {
+				i = ((Property*)elementAtVArray(props->props, i))->next;
+			}
+		}
+		propIndex = i;
+	}
+
+	if (propIndex >= nprops) {
+		return SIZE_MAX;
+	}
+	propertyAt(props, propIndex, ref);
+	return propIndex;
+}
+
 /**
  * Find a property by name, starting with specified property index.
  * Name is trucated to MAX_PROP_NAME-1 characters, and value is
@@ -116,17 +476,38 @@ bool getProperty(Properties* props, size_t propIndex, char* name, char* val) {
  * @return the index of the value found or SIZE_MAX if not found
  */
 size_t findProperty(Properties* props, size_t propIndex, const char* name, char* val) {
-	size_t nprops = nProperties(props);
-	while (propIndex < nprops) {
-		Property* prop = elementAtVArray(props->props, propIndex);
-		if (strcasecmp(name, prop->name) == 0) {
-			// return value property truncated to MAX_PROP_VAL-1 length
-			strlcpy(val, prop->val, MAX_PROP_VAL);
-			return propIndex;
-		}
-		propIndex++;
+	PropertyRef prop;
+	propIndex = findPropertyRef(props, propIndex, name, &prop);
+	if (propIndex != SIZE_MAX) {
+		// return value property truncated to MAX_PROP_VAL-1 length
+		strlcpy(val, prop.val, MAX_PROP_VAL);
 	}
-	return SIZE_MAX;
+	return propIndex;
+}
+
+/**
+ * Find an integer property by name. The value is left
+ * unchanged if the property is not present.
+ *
+ * @param props the properties
+ * @param name prop name
+ * @param min the minimum valid value
+ * @param val storage for the value
+ * @return true if not present or valid, false if not an
+ *   integer or less than min
+ */
+bool findIntProperty(Properties* props, const char* name, long min, long* val) {
+	PropertyRef prop;
+	if (findPropertyRef(props, 0, name, &prop) == SIZE_MAX) {
+		return true;
+	}
+	long value;
+	if ((sscanf(prop.val, "%ld", &value) != 1) || (value < min)) {
+		fprintf(stderr, "Invalid %s %s\n", name, prop.val);
+		return false;
+	}
+	*val = value;
+	return true;
 }
 
 /**
@@ -135,7 +516,7 @@ size_t findProperty(Properties* props, size_t propIndex, const char* name, char*
  * @return number of properties;
  */
 size_t nProperties(const Properties* props) {
-	return sizeVArray(props->props);
+	return (props->snap != NULL) ? props->snap->nprops : sizeVArray(props->props);
 }
 
 /**
@@ -158,8 +539,9 @@ bool storeProperties(const char *propFile, Properties* props) {
 
 	// output properties
 	for (int i = 0; i < nprops; i++) {
-		Property* prop = elementAtVArray(props->props, i);
-		fprintf(propStream, "%s=%s\n", prop->name, prop->val);
+		PropertyRef prop;
+		propertyAt(props, i, &prop);
+		fprintf(propStream, "%s=%s\n", prop.name, prop.val);
 	}
 
 	// close properties file
@@ -205,6 +587,230 @@ int loadProperties(const char *propFile, Properties* props) {
 	return nprops;
 }
 
+/**
+ * Write properties to a snapshot of a source file. The
+ * snapshot is written to a temporary file and renamed, so
+ * other processes never map a partial snapshot.
+ *
+ * @param snapFile the snapshot file
+ * @param props the properties
+ * @param srcStat status of the source file
+ * @return true if successful, false if cannot create file
+ */
+static bool writeSnapshot(const char* snapFile, Properties* props, const struct stat* srcStat) {
+	size_t nprops = nProperties(props);
+	size_t indexSize = 2;
+	while (indexSize < 2*nprops) {
+		indexSize *= 2;
+	}
+	size_t poolSize = 0;
+	for (size_t i = 0; i < nprops; i++) {
+		PropertyRef prop;
+		propertyAt(props, i, &prop);
+		poolSize += prop.nameLen + prop.valLen + 2;
+	}
+	if ((indexSize > UINT32_MAX) || (poolSize > UINT32_MAX)) {
+		return false;
+	}
+
+	size_t snapLen = sizeof(PropSnapHeader) + nprops*sizeof(SnapProperty)
+				   + indexSize*sizeof(SnapSlot) + poolSize;
+	PropSnapHeader* snap = calloc(1, snapLen);
+	uint32_t* last = malloc(indexSize*sizeof(uint32_t));
+	if ((snap == NULL) || (last == NULL)) {
+		free(snap);
+		free(last);
+		return false;
+	}
+	memcpy(snap->magic, PROP_SNAP_MAGIC, sizeof(snap->magic));
+	snap->version = PROP_SNAP_VERSION;
+	snap->nprops = nprops;
+	snap->indexSize = indexSize;
+	snap->poolSize = poolSize;
+	snap->srcSize = srcStat->st_size;
+	snap->srcMtimeSec = srcStat->st_mtim.tv_sec;
+	snap->srcMtimeNsec = srcStat->st_mtim.tv_nsec;
+
+	SnapProperty* snapProps = (SnapProperty*)snapProperties(snap);
+	SnapSlot* slots = (SnapSlot*)snapSlots(snap);
+	char* pool = (char*)snapPool(snap);
+	for (size_t i = 0; i < indexSize; i++) {
+		slots[i].first = UINT32_MAX;
+	}
+
+	// copy strings to pool and link properties into index
+	uint32_t mask = indexSize - 1;
+	for (uint32_t i = 0, off = 0; i < nprops; i++) {
+		PropertyRef ref;
+		propertyAt(props, i, &ref);
+		const char* name = ref.name;
+		SnapProperty* prop = &snapProps[i];
+		prop->name = off;
+		prop->nameLen = ref.nameLen;
+		memcpy(pool + off, ref.name, ref.nameLen + 1);
+		off += ref.nameLen + 1;
+		prop->val = off;
+		prop->valLen = ref.valLen;
+		memcpy(pool + off, ref.val, ref.valLen + 1);
+		off += ref.valLen + 1;
+		prop->hash = hashName(name);
+		prop->next = UINT32_MAX;
+
+		uint32_t j = prop->hash & mask;
+		while ((slots[j].first != UINT32_MAX)
+			   && ((slots[j].hash != prop->hash)
+				   || (strcasecmp(name, pool + snapProps[slots[j].first].name) != 0))) {
+			j = (j + 1) & mask;
+		}
+		if (slots[j].first == UINT32_MAX) {
+			slots[j].hash = prop->hash;
+			slots[j].first = i;
+		} else {
+			snapProps[last[j]].next = i;
+		}
+		last[j] = i;
+	}
+	free(last);
+
+	// write snapshot to temporary file and rename
+	char tmpFile[PATH_MAX];
+	snprintf(tmpFile, PATH_MAX, "%s.XXXXXX", snapFile);
+	int fd = mkstemp(tmpFile);
+	bool status = (fd >= 0);
+	for (size_t off = 0; status && (off < snapLen); ) {
+		ssize_t n = write(fd, (char*)snap + off, snapLen - off);
+		if (n <= 0) {
+			status = false;
+		} else {
+			off += n;
+		}
+	}
+	if (fd >= 0) {
+		status = (fchmod(fd, 0644) == 0) && (close(fd) == 0) && status
+				 && (rename(tmpFile, snapFile) == 0);
+		if (!status) {
+			unlink(tmpFile);
+		}
+	}
+	free(snap);
+	return status;
+}
+
+/**
+ * Returns true if a mapped snapshot is complete and current
+ * for its source file. Offsets, indexes, and chains are
+ * checked, so a corrupt snapshot cannot be read out of bounds.
+ *
+ * @param snap the snapshot
+ * @param snapLen the length of the snapshot
+ * @param srcStat status of the source file
+ * @return true if valid
+ */
+static bool validSnapshot(const PropSnapHeader* snap, size_t snapLen, const struct stat* srcStat) {
+	if ((memcmp(snap->magic, PROP_SNAP_MAGIC, sizeof(snap->magic)) != 0)
+		|| (snap->version != PROP_SNAP_VERSION)
+		|| (snap->srcSize != srcStat->st_size)
+		|| (snap->srcMtimeSec != srcStat->st_mtim.tv_sec)
+		|| (snap->srcMtimeNsec != srcStat->st_mtim.tv_nsec)
+		|| (snap->indexSize < 2) || ((snap->indexSize & (snap->indexSize - 1)) != 0)
+		|| (snap->indexSize < 2*(uint64_t)snap->nprops)) {
+		return false;
+	}
+	if (snapLen != sizeof(PropSnapHeader) + (uint64_t)snap->nprops*sizeof(SnapProperty)
+				   + (uint64_t)snap->indexSize*sizeof(SnapSlot) + snap->poolSize) {
+		return false;
+	}
+
+	const SnapProperty* snapProps = snapProperties(snap);
+	const char* pool = snapPool(snap);
+	for (uint32_t i = 0; i < snap->nprops; i++) {
+		const SnapProperty* prop = &snapProps[i];
+		if (((uint64_t)prop->name + prop->nameLen >= snap->poolSize)
+			|| (pool[prop->name + prop->nameLen] != '\0')
+			|| ((uint64_t)prop->val + prop->valLen >= snap->poolSize)
+			|| (pool[prop->val + prop->valLen] != '\0')
+			|| ((prop->next != UINT32_MAX) && ((prop->next <= i) || (prop->next >= snap->nprops)))) {
+			return false;
+		}
+	}
+	const SnapSlot* slots = snapSlots(snap);
+	for (uint32_t i = 0; i < snap->indexSize; i++) {
+		if ((slots[i].first != UINT32_MAX) && (slots[i].first >= snap->nprops)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Map a snapshot read-only if it is valid for its source file.
+ *
+ * @param snapFile the snapshot file
+ * @param srcStat status of the source file
+ * @return the mapped properties or NULL if not valid
+ */
+static Properties* openSnapshot(const char* snapFile, const struct stat* srcStat) {
+	int fd = open(snapFile, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat sb;
+	void* map = MAP_FAILED;
+	if ((fstat(fd, &sb) == 0) && ((size_t)sb.st_size >= sizeof(PropSnapHeader))) {
+		map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+	if (!validSnapshot(map, sb.st_size, srcStat)) {
+		munmap(map, sb.st_size);
+		return NULL;
+	}
+
+	Properties* props = malloc(sizeof(Properties));
+	*props = (Properties){.snap = map, .snapLen = sb.st_size};
+	return props;
+}
+
+/**
+ * Load properties from a source file through a binary snapshot
+ * in the file with a ".snap" suffix. The snapshot is mapped
+ * read-only, so its pages are shared by all threads and by all
+ * processes that map it. It is regenerated with the load function
+ * when the source file size or modification time changes. If the
+ * snapshot cannot be written, the loaded properties are returned.
+ * Mapped properties cannot be changed by putProperty().
+ *
+ * @param propFile the source file
+ * @param load function that loads properties from the source file
+ * @return the properties or NULL if no properties loaded
+ */
+Properties* mapProperties(const char* propFile, int (*load)(const char*, Properties*)) {
+	struct stat sb;
+	if (stat(propFile, &sb) != 0) {
+		return NULL;
+	}
+	char snapFile[PATH_MAX];
+	snprintf(snapFile, PATH_MAX, "%s.snap", propFile);
+	Properties* props = openSnapshot(snapFile, &sb);
+	if (props != NULL) {
+		return props;
+	}
+
+	// regenerate snapshot from source file
+	Properties* loaded = newProperties();
+	if (load(propFile, loaded) == 0) {
+		deleteProperties(loaded);
+		return NULL;
+	}
+	if (writeSnapshot(snapFile, loaded, &sb) && ((props = openSnapshot(snapFile, &sb)) != NULL)) {
+		deleteProperties(loaded);
+		return props;
+	}
+	return loaded;
+}
+
 /**
  * Convert properties to null-terminated array
  * of property name/value strings.
@@ -216,11 +822,11 @@ int loadProperties(const char *propFile, Properties* props) {
 char **toPropertiesArray(Properties* props) {
 	size_t nprops = nProperties(props);
 	char** propsArray = malloc((nprops+1)*sizeof(char*));
-	char key[MAXBUF], value[MAXBUF];
 	for (int i = 0; i < nprops; i++) {
-		getProperty(props, i, key, value);
-		propsArray[i] = malloc(strlen(key) + strlen(value) + 2);
-		sprintf(propsArray[i], "%s=%s", key, value);
+		PropertyRef prop;
+		propertyAt(props, i, &prop);
+		propsArray[i] = malloc(prop.nameLen + prop.valLen + 2);
+		sprintf(propsArray[i], "%s=%s", prop.name, prop.val);
 	}
 	propsArray[nprops] = NULL;
 
@@ -11,6 +11,7 @@
 #define PROPERTIES_H_
 #include <stdbool.h>
 #include <stdint.h>
+#include "arena.h"
 
 #define MAX_PROP_NAME 128
 #define MAX_PROP_VAL 2048
@@ -18,12 +19,35 @@
 /** Declaration of Properties as opaque type */
 typedef struct Properties Properties;
 
+/**
+ * Borrowed view of a property name and value. The strings
+ * are null-terminated and valid until the properties are
+ * deleted.
+ */
+typedef struct PropertyRef {
+	const char* name;	/** property name */
+	size_t nameLen;		/** length of name */
+	const char* val;	/** property value */
+	size_t valLen;		/** length of value */
+} PropertyRef;
+
 /**
  * Create a new properties.
  * @return a new properties
  */
 Properties* newProperties();
 
+/**
+ * Create a new properties whose storage, including
+ * names and values, is allocated from an arena.
+ * Deleting the properties is optional; storage
+ * lives until the arena is reset.
+ *
+ * @param arena the arena
+ * @return a new properties
+ */
+Properties* newArenaProperties(Arena* arena);
+
 /**
  * Delete a properties
  * @param a properties
@@ -35,7 +59,7 @@ void deleteProperties(Properties* props);
  * @param a properties
  * @param name a property name
  * @param val a property value
- * @return true if property added
+ * @return true if property added, false if mapped
  */
 bool putProperty(Properties* props, const char* name, const char* val);
 
@@ -52,11 +76,38 @@ bool putProperty(Properties* props, const char* name, const char* val);
  */
 bool getProperty(Properties* props, size_t propIndex, char* name, char* val);
 
+/**
+ * Get name and value for the specified property index
+ * without copying or truncating. The strings are valid
+ * until the properties are deleted.
+ *
+ * @param props a properties
+ * @param propIndex the property index
+ * @param ref set to the property name and value
+ * @return true if property at specified index is available
+ */
+bool getPropertyRef(Properties* props, size_t propIndex, PropertyRef* ref);
+
+/**
+ * Find a property by name, starting with specified property index,
+ * without copying or truncating. Property comparison is
+ * case-independent. Larger properties are indexed by name, and
+ * continuing after a previous result is constant time.
+ *
+ * @param props the properties
+ * @param propIndex the starting property index
+ * @param name prop name
+ * @param ref set to the property name and value
+ * @return the index of the property found or SIZE_MAX if not found
+ */
+size_t findPropertyRef(Properties* props, size_t propIndex, const char* name, PropertyRef* ref);
+
 /**
  * Find a property by name, starting with specified property index.
  * Name is trucated to MAX_PROP_NAME-1 characters, and value is
  * truncated to MAX_PROP_VAL-1 charcters. Property comparison is
- * case-independent.
+ * case-independent. Larger properties are indexed by name, and
+ * continuing after a previous result is constant time.
  *
  * @param props the properties
  * @param propIndex the starting property index
@@ -66,6 +117,19 @@ bool getProperty(Properties* props, size_t propIndex, char* name, char* val);
  */
 size_t findProperty(Properties* props, size_t propIndex, const char* name, char* val);
 
+/**
+ * Find an integer property by name. The value is left
+ * unchanged if the property is not present.
+ *
+ * @param props the properties
+ * @param name prop name
+ * @param min the minimum valid value
+ * @param val storage for the value
+ * @return true if not present or valid, false if not an
+ *   integer or less than min
+ */
+bool findIntProperty(Properties* props, const char* name, long min, long* val);
+
 /**
  * Return number of properties.
  * @param props the properties
@@ -90,6 +154,21 @@ bool storeProperties(const char* propFile, Properties* props);
  * @return number of properties read
  */
 int loadProperties(const char* propFile, Properties* props);
+
+/**
+ * Load properties from a source file through a binary snapshot
+ * in the file with a ".snap" suffix. The snapshot is mapped
+ * read-only, so its pages are shared by all threads and by all
+ * processes that map it. It is regenerated with the load function
+ * when the source file size or modification time changes. If the
+ * snapshot cannot be written, the loaded properties are returned.
+ * Mapped properties cannot be changed by putProperty().
+ *
+ * @param propFile the source file
+ * @param load function that loads properties from the source file
+ * @return the properties or NULL if no properties loaded
+ */
+Properties* mapProperties(const char* propFile, int (*load)(const char*, Properties*));
 /**
  * Convert properties to null-terminated array
  * of property name/value strings.
@@ -0,0 +1,359 @@
+/*
+ * request_body.c
+ *
+ * Functions that read request bodies from a connection,
+ * decoding Content-Length and chunked framing.
+ *
+ * Bodies are pulled by the method that handles them, a
+ * slice at a time, so no more than a slice is held in
+ * memory however large the body is.
+ *
+ *  @since 2026-10-18
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include "request_body.h"
+#include "http_codes.h"
+#include "http_server.h"
+#include "string_util.h"
+#include "coroutine.h"
+
+/** bytes moved through the pipe per splice() */
+#define BODY_SPLICE_SIZE (1024*1024)
+
+/**
+ * Start reading the body of a request from its headers.
+ * A body that declares a length over the limit is refused
+ * before any of it is read.
+ *
+ * @param body the body to initialize
+ * @param conn the connection
+ * @param requestHeaders the request headers
+ * @param limit maximum body size, or 0 for none
+ * @return 0 if successful, or the status of an error response
+ */
+int openRequestBody(RequestBody *body, Connection *conn, Properties *requestHeaders, size_t limit) {
+	*body = (RequestBody){.conn = conn, .limit = limit, .done = true};
+
+	// transfer coding takes precedence over a content length
+	PropertyRef prop;
+	if (findPropertyRef(requestHeaders, 0, "Transfer-Encoding", &prop) != SIZE_MAX) {
+		if ((prop.valLen != 7) || (strncasecmp(prop.val, "chunked", 7) != 0)) {
+			return Http_NotImplemented;
+		}
+		body->present = body->chunked = true;
+		body->done = false;
+		return 0;
+	}
+
+	if (findPropertyRef(requestHeaders, 0, "Content-Length", &prop) != SIZE_MAX) {
+		size_t length;
+		if ((prop.valLen == 0) || (parseSize(prop.val, prop.valLen, 10, &length) != prop.valLen)) {
+			return Http_BadRequest;
+		}
+		if ((limit > 0) && (length > limit)) {
+			return Http_PayloadTooLarge;
+		}
+		body->present = true;
+		body->remaining = length;
+		body->done = (length == 0);
+	}
+	return 0;
+}
+
+/**
+ * Read a line of chunked framing, without its CRLF.
+ * @param body the body
+ * @param line buffer of MAXBUF characters
+ * @return true if read, false if error
+ */
+static bool readChunkLine(RequestBody *body, char *line) {
+	if (   (fgets(line, MAXBUF, body->conn->stream) == NULL)
+		|| (strchr(line, '\n') == NULL)) {
+		body->status = Http_BadRequest;
+		return false;
+	}
+	trim_newline(line);
+	return true;
+}
+
+/**
+ * Read the framing before the next chunk of a body.
+ * After the last chunk, the trailers are skipped.
+ * @param body the body
+ * @return true if successful, false if error
+ */
+static bool nextChunk(RequestBody *body) {
+	char line[MAXBUF];
+	if (body->chunkData) {
+		// CRLF that ends the data of the previous chunk
+		if (!readChunkLine(body, line)) {
+			return false;
+		}
+		if (*line != '\0') {
+			body->status = Http_BadRequest;
+			return false;
+		}
+		body->chunkData = false;
+	}
+
+	// chunk size in hex, then optional extensions
+	if (!readChunkLine(body, line)) {
+		return false;
+	}
+	size_t size;
+	size_t n = parseSize(line, strlen(line), 16, &size);
+	if ((n == 0) || ((line[n] != '\0') && (line[n] != ';') && (line[n] != ' ') && (line[n] != '\t'))) {
+		body->status = Http_BadRequest;
+		return false;
+	}
+	if ((body->limit > 0) && (size > body->limit - body->length)) {
+		body->status = Http_PayloadTooLarge;
+		return false;
+	}
+
+	if (size == 0) {
+		// skip trailer fields up to the empty line
+		do {
+			if (!readChunkLine(body, line)) {
+				return false;
+			}
+		} while (*line != '\0');
+		body->done = true;
+	} else {
+		body->remaining = size;
+		body->chunkData = true;
+	}
+	return true;
+}
+
+/**
+ * Prepare to read the next slice of a body, reading
+ * the framing of the next chunk if needed.
+ * @param body the body
+ * @return true if successful, false if error
+ */
+static bool startSlice(RequestBody *body) {
+	if (body->status != 0) {
+		return false;
+	}
+	if ((body->remaining == 0) && !body->done) {
+		return nextChunk(body);
+	}
+	return true;
+}
+
+/**
+ * Account for a slice of a body that was read.
+ * @param body the body
+ * @param n the number of bytes read
+ */
+static void endSlice(RequestBody *body, size_t n) {
+	body->remaining -= n;
+	body->length += n;
+	if (!body->chunked && (body->remaining == 0)) {
+		body->done = true;
+	}
+}
+
+/**
+ * Read the next slice of a request body, waiting until
+ * some is available. Slices of a chunked body do not
+ * span chunks.
+ *
+ * @param body the body
+ * @param buf the buffer
+ * @param size the buffer size
+ * @return number of bytes read, 0 at end of body, or -1 if
+ *   error with the status of an error response in body->status
+ */
+ssize_t readRequestBody(RequestBody *body, void *buf, size_t size) {
+	if (!startSlice(body)) {
+		return -1;
+	}
+	if (body->done) {
+		return 0;
+	}
+
+	if (size > body->remaining) {
+		size = body->remaining;
+	}
+	ssize_t nread = receiveConnection(body->conn, buf, size);
+	if (nread <= 0) {
+		// client closed or failed before sending the whole body
+		body->status = Http_BadRequest;
+		return -1;
+	}
+	endSlice(body, nread);
+	return nread;
+}
+
+/**
+ * Write all bytes to a file descriptor.
+ * @param fd the file descriptor
+ * @param buf the bytes
+ * @param size the number of bytes
+ * @return 0 if successful, or the status of an error response
+ */
+static int writeAll(int fd, const char *buf, size_t size) {
+	while (size > 0) {
+		ssize_t n = write(fd, buf, size);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (errno == ENOSPC) ? Http_InsufficientStorage : Http_InternalServerError;
+		}
+		buf += n;
+		size -= n;
+	}
+	return 0;
+}
+
+/**
+ * Copy the rest of a request body to a file descriptor
+ * in slices of BODY_SLICE_SIZE.
+ *
+ * @param body the body
+ * @param fd the file descriptor
+ * @return 0 if successful, or the status of an error response
+ */
+int copyRequestBody(RequestBody *body, int fd) {
+	char *buf = malloc(BODY_SLICE_SIZE);
+	if (buf == NULL) {
+		return Http_InternalServerError;
+	}
+	int status = 0;
+	ssize_t nread;
+	while ((nread = readRequestBody(body, buf, BODY_SLICE_SIZE)) > 0) {
+		if ((status = writeAll(fd, buf, nread)) != 0) {
+			break;
+		}
+	}
+	if (nread < 0) {
+		status = body->status;
+	}
+	free(buf);
+	return status;
+}
+
+#if defined(__linux__)
+/**
+ * Move bytes of a body from the socket to a file through
+ * a pipe, waiting while the socket would block.
+ * @param body the body
+ * @param pipefd the pipe
+ * @param fd the file descriptor
+ * @param size the maximum number of bytes
+ * @return number of bytes moved, 0 if splice is not supported
+ *   before any were, or -1 if error with the status in body->status
+ */
+static ssize_t spliceSlice(RequestBody *body, int pipefd[2], int fd, size_t size) {
+	int sock_fd = body->conn->sock_fd;
+	ssize_t nread;
+	for (;;) {
+		nread = splice(sock_fd, NULL, pipefd[1], NULL, size, SPLICE_F_MOVE|SPLICE_F_MORE);
+		if (nread > 0) {
+			break;
+		}
+		if (nread == 0) {
+			body->status = Http_BadRequest;
+			return -1;
+		}
+		if (errno == EINVAL) {
+			return 0;
+		}
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+			if (!coWaitFd(sock_fd, POLLIN)) {
+				body->status = Http_BadRequest;
+				return -1;
+			}
+		} else if (errno != EINTR) {
+			body->status = Http_BadRequest;
+			return -1;
+		}
+	}
+
+	// the pipe holds what was read, so drain it to the file
+	for (ssize_t nleft = nread; nleft > 0; ) {
+		ssize_t n = splice(pipefd[0], NULL, fd, NULL, nleft, SPLICE_F_MOVE);
+		if (n <= 0) {
+			if ((n < 0) && (errno == EINTR)) {
+				continue;
+			}
+			body->status = ((n < 0) && (errno == ENOSPC))
+						 ? Http_InsufficientStorage : Http_InternalServerError;
+			return -1;
+		}
+		nleft -= n;
+	}
+	return nread;
+}
+#endif
+
+/**
+ * Move the rest of a request body to a file descriptor
+ * without copying it through user space where possible.
+ * Bytes already received by the connection are written
+ * first, then the socket is spliced to the file through
+ * a pipe. Falls back to copyRequestBody() where splice
+ * is not available.
+ *
+ * @param body the body
+ * @param fd the file descriptor
+ * @return 0 if successful, or the status of an error response
+ */
+int spliceRequestBody(RequestBody *body, int fd) {
+#if defined(__linux__)
+	int pipefd[2];
+	if (pipe2(pipefd, O_CLOEXEC) != 0) {
+		return copyRequestBody(body, fd);
+	}
+	fcntl(pipefd[1], F_SETPIPE_SZ, BODY_SPLICE_SIZE);
+
+	Connection *conn = body->conn;
+	int status = 0;
+	while (startSlice(body) && !body->done) {
+		// bytes already received are not in the socket
+		size_t nbuffered = conn->rlen - conn->rpos;
+		if (nbuffered > 0) {
+			size_t n = (nbuffered < body->remaining) ? nbuffered : body->remaining;
+			if ((status = writeAll(fd, conn->rbuf + conn->rpos, n)) != 0) {
+				break;
+			}
+			conn->rpos += n;
+			endSlice(body, n);
+			continue;
+		}
+
+		size_t size = (body->remaining < BODY_SPLICE_SIZE) ? body->remaining : BODY_SPLICE_SIZE;
+		ssize_t n = spliceSlice(body, pipefd, fd, size);
+		if (n == 0) {
+			break;  // socket cannot be spliced
+		}
+		if (n < 0) {
+			break;
+		}
+		endSlice(body, n);
+	}
+	close(pipefd[0]);
+	close(pipefd[1]);
+
+	if (status != 0) {
+		return status;
+	}
+	if (body->status != 0) {
+		return body->status;
+	}
+	return body->done ? 0 : copyRequestBody(body, fd);
+#else
+	return copyRequestBody(body, fd);
+#endif
+}
@@ -0,0 +1,85 @@
+/*
+ * request_body.h
+ *
+ * Functions that read request bodies from a connection,
+ * decoding Content-Length and chunked framing.
+ *
+ *  @since 2026-10-18
+ */
+
+#ifndef REQUEST_BODY_H_
+#define REQUEST_BODY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "connection.h"
+#include "properties.h"
+
+/** size of the slices in which bodies are copied */
+#define BODY_SLICE_SIZE (64*1024)
+
+/** A request body being read from a connection */
+typedef struct RequestBody {
+	Connection *conn;            /** the connection */
+	bool present;                /** request has a body, possibly empty */
+	bool chunked;                /** body has chunked transfer coding */
+	bool chunkData;              /** chunk data was read, so its CRLF is next */
+	bool done;                   /** all of the body has been read */
+	size_t remaining;            /** bytes left in the body or current chunk */
+	size_t length;               /** bytes of the body read so far */
+	size_t limit;                /** maximum body size, or 0 for none */
+	int status;                  /** response status for a body error, or 0 */
+} RequestBody;
+
+/**
+ * Start reading the body of a request from its headers.
+ * A body that declares a length over the limit is refused
+ * before any of it is read.
+ *
+ * @param body the body to initialize
+ * @param conn the connection
+ * @param requestHeaders the request headers
+ * @param limit maximum body size, or 0 for none
+ * @return 0 if successful, or the status of an error response
+ */
+int openRequestBody(RequestBody *body, Connection *conn, Properties *requestHeaders, size_t limit);
+
+/**
+ * Read the next slice of a request body, waiting until
+ * some is available. Slices of a chunked body do not
+ * span chunks.
+ *
+ * @param body the body
+ * @param buf the buffer
+ * @param size the buffer size
+ * @return number of bytes read, 0 at end of body, or -1 if
+ *   error with the status of an error response in body->status
+ */
+ssize_t readRequestBody(RequestBody *body, void *buf, size_t size);
+
+/**
+ * Copy the rest of a request body to a file descriptor
+ * in slices of BODY_SLICE_SIZE.
+ *
+ * @param body the body
+ * @param fd the file descriptor
+ * @return 0 if successful, or the status of an error response
+ */
+int copyRequestBody(RequestBody *body, int fd);
+
+/**
+ * Move the rest of a request body to a file descriptor
+ * without copying it through user space where possible.
+ * Bytes already received by the connection are written
+ * first, then the socket is spliced to the file through
+ * a pipe. Falls back to copyRequestBody() where splice
+ * is not available.
+ *
+ * @param body the body
+ * @param fd the file descriptor
+ * @return 0 if successful, or the status of an error response
+ */
+int spliceRequestBody(RequestBody *body, int fd);
+
+#endif /* REQUEST_BODY_H_ */
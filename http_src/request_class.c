@@ -0,0 +1,158 @@
+/*
+ * request_class.c
+ *
+ * Functions that assign requests to scheduling classes.
+ *
+ *  @since 2026-10-18
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include "request_class.h"
+#include "content_index.h"
+#include "negative_cache.h"
+#include "http_server.h"
+
+/** methods whose requests are bulk (e.g. "PUT,POST") */
+static char bulkMethods[MAX_PROP_VAL] = "PUT,POST";
+
+/** URI prefixes whose requests are bulk */
+static Properties *bulkPathPrefixes = NULL;
+
+/** minimum size of files whose GET requests are bulk (0 for none) */
+static off_t bulkMinSize = 1024*1024;
+
+/** round robin weights of the interactive and bulk classes */
+static int interactiveWeight = 4;
+static int bulkWeight = 1;
+
+/** maximum threads running bulk requests (-1 for pool size - 2) */
+static int bulkThreads = -1;
+
+/**
+ * Read request class rules from the server configuration.
+ * Requests are bulk if their method is in "BulkMethods", if
+ * their URI starts with a "BulkPathPrefix", or if they GET a
+ * file of at least "BulkMinSize" bytes. A weight of 0 gives
+ * a class strict priority, which only interactive requests
+ * may have.
+ *
+ * @param httpConfig the server configuration
+ * @return true if successful, false if a rule is invalid
+ */
+bool readRequestClasses(Properties *httpConfig) {
+	findProperty(httpConfig, 0, "BulkMethods", bulkMethods);
+
+	// path prefixes may be repeated
+	if (bulkPathPrefixes == NULL) {
+		bulkPathPrefixes = newProperties();
+	}
+	char prefix[MAX_PROP_VAL];
+	for (size_t i = 0; (i = findProperty(httpConfig, i, "BulkPathPrefix", prefix)) != SIZE_MAX; i++) {
+		putProperty(bulkPathPrefixes, "BulkPathPrefix", prefix);
+	}
+
+	long minSize = bulkMinSize, iweight = interactiveWeight, bweight = bulkWeight, bthreads = bulkThreads;
+	if (   !findIntProperty(httpConfig, "BulkMinSize", 0, &minSize)
+		|| !findIntProperty(httpConfig, "InteractiveWeight", 0, &iweight)
+		|| !findIntProperty(httpConfig, "BulkWeight", 1, &bweight)  // 0 is strict priority
+		|| !findIntProperty(httpConfig, "BulkThreads", 0, &bthreads)) {
+		return false;
+	}
+	bulkMinSize = minSize;
+	interactiveWeight = iweight;
+	bulkWeight = bweight;
+	bulkThreads = bthreads;
+	return true;
+}
+
+/**
+ * Configure thread pool scheduling of request classes.
+ *
+ * @param pool the request thread pool
+ * @param nthreads the number of threads in the pool
+ */
+void initRequestClasses(threadpool pool, int nthreads) {
+	int maxBulk = bulkThreads;
+	if (maxBulk < 0) {  // leave two threads for interactive requests
+		maxBulk = (nthreads > 2) ? nthreads-2 : 1;
+	}
+	thpool_set_class(pool, Request_Interactive, interactiveWeight, 0);
+	thpool_set_class(pool, Request_Bulk, bulkWeight, maxBulk);
+	if (server.debug) {
+		fprintf(stderr, "Request classes: interactive weight %d, bulk weight %d on %d threads\n",
+				interactiveWeight, bulkWeight, maxBulk);
+	}
+}
+
+/**
+ * Returns true if method is in a comma or space separated list.
+ *
+ * @param method the method
+ * @param methods the list of methods
+ * @return true if method is in the list
+ */
+static bool isMethodInList(const char *method, const char *methods) {
+	size_t len = strlen(method);
+	for (const char *p = methods; *p != '\0'; ) {
+		p += strspn(p, ", ");
+		size_t toklen = strcspn(p, ", ");
+		if ((toklen == len) && (strncasecmp(p, method, len) == 0)) {
+			return true;
+		}
+		p += toklen;
+	}
+	return false;
+}
+
+/**
+ * Returns the scheduling class of a request.
+ *
+ * @param method the request method
+ * @param uri the request URI
+ * @param filePath the file system path of the URI
+ * @return the request class
+ */
+enum RequestClass classifyRequest(const char *method, const char *uri, const char *filePath) {
+	if (isMethodInList(method, bulkMethods)) {
+		return Request_Bulk;
+	}
+
+	if (bulkPathPrefixes != NULL) {
+		PropertyRef prefix;
+		for (size_t i = 0; getPropertyRef(bulkPathPrefixes, i, &prefix); i++) {
+			if (strncmp(uri, prefix.val, prefix.valLen) == 0) {
+				return Request_Bulk;
+			}
+		}
+	}
+
+	// large downloads are bulk; the size of an indexed file
+	// is known without resolving its path, and a path known
+	// to be missing is not resolved either
+	if ((bulkMinSize > 0) && (strcasecmp(method, "GET") == 0)) {
+		ContentInfo info;
+		struct stat sb;
+		unsigned long stamp;
+		switch (lookupContent(filePath, &info)) {
+		case ContentLookup_Found:
+			sb.st_mode = info.mode;
+			sb.st_size = info.size;
+			break;
+		case ContentLookup_Missing:
+			return Request_Interactive;
+		default:
+			if (isKnownMissing(filePath, &stamp) || (stat(filePath, &sb) != 0)) {
+				return Request_Interactive;
+			}
+			break;
+		}
+		if (S_ISREG(sb.st_mode) && (sb.st_size >= bulkMinSize)) {
+			return Request_Bulk;
+		}
+	}
+	return Request_Interactive;
+}
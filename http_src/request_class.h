@@ -0,0 +1,53 @@
+/*
+ * request_class.h
+ *
+ * Functions that assign requests to scheduling classes.
+ *
+ *  @since 2026-10-18
+ */
+
+#ifndef REQUEST_CLASS_H_
+#define REQUEST_CLASS_H_
+
+#include <stdbool.h>
+#include "properties.h"
+#include "thpool.h"
+
+/** Scheduling classes of requests, in thread pool job class order */
+enum RequestClass {
+	Request_Interactive = 0,  //!< small requests that need low latency
+	Request_Bulk        = 1   //!< large downloads and uploads
+};
+
+/**
+ * Read request class rules from the server configuration.
+ * Requests are bulk if their method is in "BulkMethods", if
+ * their URI starts with a "BulkPathPrefix", or if they GET a
+ * file of at least "BulkMinSize" bytes. A weight of 0 gives
+ * a class strict priority, which only interactive requests
+ * may have.
+ *
+ * @param httpConfig the server configuration
+ * @return true if successful, false if a rule is invalid
+ */
+bool readRequestClasses(Properties *httpConfig);
+
+/**
+ * Configure thread pool scheduling of request classes.
+ *
+ * @param pool the request thread pool
+ * @param nthreads the number of threads in the pool
+ */
+void initRequestClasses(threadpool pool, int nthreads);
+
+/**
+ * Returns the scheduling class of a request.
+ *
+ * @param method the request method
+ * @param uri the request URI
+ * @param filePath the file system path of the URI
+ * @return the request class
+ */
+enum RequestClass classifyRequest(const char *method, const char *uri, const char *filePath);
+
+#endif /* REQUEST_CLASS_H_ */
@@ -9,6 +9,7 @@
 
 #include <stdbool.h>
 #include <ctype.h>
+#include <stdint.h>
 #include <string.h>
 #include "string_util.h"
 
@@ -75,4 +76,50 @@ char * trim_trailing_tabs(char *src) {
         src++;
     }
     return src;
-}
\ No newline at end of file
+}
+
+/**
+ * Parse a decimal or hexadecimal size.
+ * @param s the digits
+ * @param len the number of characters
+ * @param base 10 or 16
+ * @param size the parsed size
+ * @return number of characters parsed, or 0 if no digits or overflow
+ */
+size_t parseSize(const char *s, size_t len, int base, size_t *size) {
+	size_t val = 0;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		int digit;
+		if ((s[i] >= '0') && (s[i] <= '9')) {
+			digit = s[i] - '0';
+		} else if ((base == 16) && ((s[i]|0x20) >= 'a') && ((s[i]|0x20) <= 'f')) {
+			digit = (s[i]|0x20) - 'a' + 10;
+		} else {
+			break;
+		}
+		if (val > (SIZE_MAX - digit) / base) {
+			return 0;
+		}
+		val = val*base + digit;
+	}
+	*size = val;
+	return i;
+}
+
+/**
+ * Returns the FNV-1a hash of a string up to a length or
+ * its NUL, optionally folded to lower case.
+ * @param s the string
+ * @param len the most characters, or SIZE_MAX for all
+ * @param foldCase true to hash the lower-case string
+ * @return the hash
+ */
+uint64_t strhash(const char *s, size_t len, bool foldCase) {
+	uint64_t hash = 14695981039346656037ull;
+	for (const unsigned char *p = (const unsigned char*)s; (len > 0) && (*p != '\0'); p++, len--) {
+		hash ^= foldCase ? tolower(*p) : *p;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
@@ -11,6 +11,8 @@
 #define STRING_UTIL_H_
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /**
  * Write the lower-case version of the source
@@ -39,4 +41,24 @@ bool strendswith(const char *src, const char *endswith);
  */
 bool trim_newline(char *src);
 char * trim_trailing_tabs(char *src);
+
+/**
+ * Parse a decimal or hexadecimal size.
+ * @param s the digits
+ * @param len the number of characters
+ * @param base 10 or 16
+ * @param size the parsed size
+ * @return number of characters parsed, or 0 if no digits or overflow
+ */
+size_t parseSize(const char *s, size_t len, int base, size_t *size);
+
+/**
+ * Returns the FNV-1a hash of a string up to a length or
+ * its NUL, optionally folded to lower case.
+ * @param s the string
+ * @param len the most characters, or SIZE_MAX for all
+ * @param foldCase true to hash the lower-case string
+ * @return the hash
+ */
+uint64_t strhash(const char *s, size_t len, bool foldCase);
 #endif /* STRING_UTIL_H_ */
@@ -0,0 +1,361 @@
+/*
+ * upload.c
+ *
+ * Functions that assemble a file from byte ranges uploaded
+ * separately by PUT requests with Content-Range headers.
+ *
+ * The ranges are written to a staging file ".name.upload"
+ * beside the file, so several may arrive at once over
+ * separate connections, and the ranges committed so far
+ * are recorded in ".name.ranges". A range is recorded only
+ * once all of it is written, so an interrupted upload
+ * resumes from the recorded ranges. The staging file is
+ * renamed over the file once the ranges cover it.
+ *
+ * The ranges also record the device and inode of the
+ * staging file, so a range written to a staging file that
+ * an upload ended meanwhile, and another began again, is
+ * not recorded as written to the new one.
+ *
+ * The files are opened relative to the directory of the
+ * file, which must be in the content tree.
+ *
+ *  @since 2026-10-18
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include "upload.h"
+#include "file_util.h"
+#include "http_server.h"
+#include "http_util.h"
+#include "properties.h"
+#include "string_util.h"
+
+/** suffix of the staging file of an upload */
+#define UPLOAD_STAGE_SUFFIX ".upload"
+
+/** suffix of the committed ranges of an upload */
+#define UPLOAD_RANGES_SUFFIX ".ranges"
+
+/**
+ * Open the directory of a file path in the content tree
+ * and make the names of the hidden files of its upload.
+ *
+ * @param filePath the file path
+ * @param name buffer of NAME_MAX+1 for the file name
+ * @param stageName buffer of NAME_MAX+1 for the staging file name
+ * @param rangesName buffer of NAME_MAX+1 for the ranges name
+ * @return the directory descriptor, or -1 with errno set if error
+ */
+static int openUploadDir(const char *filePath, char *name, char *stageName, char *rangesName) {
+	int dirFd = openParentBeneath(filePath, name);
+	if (dirFd < 0) {
+		return -1;
+	}
+	if (   (snprintf(stageName, NAME_MAX+1, ".%s%s", name, UPLOAD_STAGE_SUFFIX) > NAME_MAX)
+		|| (snprintf(rangesName, NAME_MAX+1, ".%s%s", name, UPLOAD_RANGES_SUFFIX) > NAME_MAX)) {
+		close(dirFd);
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return dirFd;
+}
+
+/**
+ * Parse a size followed by a separator.
+ * @param p pointer to the digits, advanced past the separator
+ * @param sep the separator, or '\0' for the end of the string
+ * @param size the parsed size
+ * @return true if successful
+ */
+static bool parseField(const char **p, char sep, size_t *size) {
+	size_t len = strlen(*p);
+	size_t n = parseSize(*p, len, 10, size);
+	if ((n == 0) || ((*p)[n] != sep)) {
+		return false;
+	}
+	*p += (sep == '\0') ? n : n+1;
+	return true;
+}
+
+/**
+ * Parse a Content-Range header value of the form
+ * "bytes first-last/total".
+ *
+ * @param val the header value
+ * @param first the first byte of the range
+ * @param last the last byte of the range
+ * @param total the size of the complete file
+ * @return true if a valid range within the file
+ */
+bool parseContentRange(const char *val, size_t *first, size_t *last, size_t *total) {
+	static const char unit[] = "bytes ";
+	if (strncmp(val, unit, sizeof(unit)-1) != 0) {
+		return false;
+	}
+	const char *p = val + sizeof(unit)-1;
+	return    parseField(&p, '-', first)
+		   && parseField(&p, '/', last)
+		   && parseField(&p, '\0', total)
+		   && (*first <= *last) && (*last < *total);
+}
+
+/**
+ * Returns true if a file path is the staging file or the
+ * ranges of an upload, which requests may not name.
+ *
+ * @param filePath the file path
+ * @return true if the path is of an upload
+ */
+bool isUploadPath(const char *filePath) {
+	const char *name = strrchr(filePath, '/');
+	name = (name == NULL) ? filePath : name+1;
+	return    (name[0] == '.')
+		   && (strendswith(name+1, UPLOAD_STAGE_SUFFIX) || strendswith(name+1, UPLOAD_RANGES_SUFFIX));
+}
+
+/**
+ * Make the path of the staging file of an upload to a
+ * file path, to look it up without opening it.
+ *
+ * @param filePath the file path
+ * @param stagePath buffer of MAXPATHLEN for the path
+ * @return the staging file path, or NULL if too long
+ */
+char *makeUploadStagePath(const char *filePath, char *stagePath) {
+	const char *name = strrchr(filePath, '/');
+	name = (name == NULL) ? filePath : name+1;
+	int len = snprintf(stagePath, MAXPATHLEN, "%.*s.%s%s",
+					   (int)(name-filePath), filePath, name, UPLOAD_STAGE_SUFFIX);
+	return (len < MAXPATHLEN) ? stagePath : NULL;
+}
+
+/**
+ * Open the staging file of an upload to a file path,
+ * creating it if this is the first range. Each request
+ * writes its range through its own descriptor. The path
+ * must be locked.
+ *
+ * @param filePath the file path
+ * @return the file descriptor, or -1 with errno set if error
+ */
+int openUpload(const char *filePath) {
+	char name[NAME_MAX+1], stageName[NAME_MAX+1], rangesName[NAME_MAX+1];
+	int dirFd = openUploadDir(filePath, name, stageName, rangesName);
+	if (dirFd < 0) {
+		return -1;
+	}
+	int fd = openat(dirFd, stageName, O_RDWR|O_CREAT|O_NOFOLLOW|O_CLOEXEC, 0644);
+	int err = errno;
+	close(dirFd);
+	errno = err;
+	return fd;
+}
+
+/**
+ * Read the committed ranges of an upload to a file path.
+ * The path must be locked.
+ *
+ * @param filePath the file path
+ * @param ranges the ranges
+ * @return true if an upload is in progress
+ */
+bool readUploadRanges(const char *filePath, UploadRanges *ranges) {
+	ranges->total = ranges->count = 0;
+	char name[NAME_MAX+1], stageName[NAME_MAX+1], rangesName[NAME_MAX+1];
+	int dirFd = openUploadDir(filePath, name, stageName, rangesName);
+	if (dirFd < 0) {
+		return false;
+	}
+	int fd = openat(dirFd, rangesName, O_RDONLY|O_NOFOLLOW|O_CLOEXEC);
+	close(dirFd);
+	FILE *stream = (fd < 0) ? NULL : fdopen(fd, "r");
+	if (stream == NULL) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		return false;
+	}
+	uintmax_t dev, ino;
+	bool valid = (fscanf(stream, "%zu %ju %ju\n", &ranges->total, &dev, &ino) == 3);
+	ranges->dev = (dev_t)dev;
+	ranges->ino = (ino_t)ino;
+	size_t first, last;
+	while (valid && (fscanf(stream, "%zu-%zu\n", &first, &last) == 2)) {
+		valid = (first <= last) && (last < ranges->total) && addUploadRange(ranges, first, last);
+	}
+	fclose(stream);
+	if (!valid) {
+		ranges->total = ranges->count = 0;
+	}
+	return valid;
+}
+
+/**
+ * Add a committed range to the ranges of an upload,
+ * merging it with ranges it overlaps or adjoins.
+ *
+ * @param ranges the ranges
+ * @param first the first byte of the range
+ * @param last the last byte of the range
+ * @return true if added, false if too many separate ranges
+ */
+bool addUploadRange(UploadRanges *ranges, size_t first, size_t last) {
+	// skip ranges that end before this one starts
+	size_t i = 0;
+	while ((i < ranges->count) && (ranges->last[i] + 1 < first)) {
+		i++;
+	}
+	// absorb ranges that overlap or adjoin this one
+	size_t j = i;
+	while ((j < ranges->count) && (ranges->first[j] <= last + 1)) {
+		first = MIN(first, ranges->first[j]);
+		last = MAX(last, ranges->last[j]);
+		j++;
+	}
+	// replace ranges i to j-1 with the merged range
+	if (i == j) {
+		if (ranges->count == UPLOAD_MAX_RANGES) {
+			return false;
+		}
+	}
+	size_t tail = ranges->count - j;
+	size_t to = i+1;
+	memmove(&ranges->first[to], &ranges->first[j], tail*sizeof(size_t));
+	memmove(&ranges->last[to], &ranges->last[j], tail*sizeof(size_t));
+	ranges->first[i] = first;
+	ranges->last[i] = last;
+	ranges->count = to + tail;
+	return true;
+}
+
+/**
+ * Returns true if the ranges of an upload cover the file.
+ *
+ * @param ranges the ranges
+ * @return true if the upload is complete
+ */
+bool isUploadComplete(const UploadRanges *ranges) {
+	return    (ranges->count == 1) && (ranges->first[0] == 0)
+		   && (ranges->last[0] + 1 == ranges->total);
+}
+
+/**
+ * Record the committed ranges of an upload to a file path,
+ * replacing the previous record as one step. The path must
+ * be locked.
+ *
+ * @param filePath the file path
+ * @param ranges the ranges
+ * @return 0 if successful, -1 with errno set if error
+ */
+int writeUploadRanges(const char *filePath, const UploadRanges *ranges) {
+	char name[NAME_MAX+1], stageName[NAME_MAX+1], rangesName[NAME_MAX+1], tmpName[NAME_MAX+1];
+	int dirFd = openUploadDir(filePath, name, stageName, rangesName);
+	if (dirFd < 0) {
+		return -1;
+	}
+	int fd = makeTempFileAt(dirFd, rangesName, tmpName);
+	if (fd < 0) {
+		close(dirFd);
+		return -1;
+	}
+	FILE *stream = fdopen(fd, "w");
+	if (stream == NULL) {
+		close(fd);
+		unlinkat(dirFd, tmpName, 0);
+		close(dirFd);
+		return -1;
+	}
+	fprintf(stream, "%zu %ju %ju\n", ranges->total, (uintmax_t)ranges->dev, (uintmax_t)ranges->ino);
+	for (size_t i = 0; i < ranges->count; i++) {
+		fprintf(stream, "%zu-%zu\n", ranges->first[i], ranges->last[i]);
+	}
+	// the path is locked, so the record is synced here only if each
+	// request syncs; a batch is waited for once the path is unlocked
+	int status = (fflush(stream) == 0) ? 0 : -1;
+	if ((status == 0) && (server.durability == Durability_Request)) {
+		status = fsync(fd);
+	}
+	if ((fclose(stream) != 0) || (status != 0) || (renameat(dirFd, tmpName, dirFd, rangesName) != 0)) {
+		status = -1;
+		unlinkat(dirFd, tmpName, 0);
+	}
+	close(dirFd);
+	return status;
+}
+
+/**
+ * Replace the file at a path by its complete staging file
+ * and end the upload. The path must be locked.
+ *
+ * @param filePath the file path
+ * @param total the size of the complete file
+ * @return 0 if successful, -1 with errno set if error
+ */
+int promoteUpload(const char *filePath, size_t total) {
+	char name[NAME_MAX+1], stageName[NAME_MAX+1], rangesName[NAME_MAX+1];
+	int dirFd = openUploadDir(filePath, name, stageName, rangesName);
+	if (dirFd < 0) {
+		return -1;
+	}
+	// a staging file left by an earlier upload may be longer
+	int status = -1;
+	int fd = openat(dirFd, stageName, O_WRONLY|O_NOFOLLOW|O_CLOEXEC);
+	if (fd >= 0) {
+		if (   (ftruncate(fd, (off_t)total) == 0)
+			&& (renameat(dirFd, stageName, dirFd, name) == 0)) {
+			unlinkat(dirFd, rangesName, 0);
+			status = 0;
+		}
+		close(fd);
+	}
+	close(dirFd);
+	return status;
+}
+
+/**
+ * End an upload to a file path, removing its staging file
+ * and ranges. The path must be locked.
+ *
+ * @param filePath the file path
+ * @return true if an upload was removed
+ */
+bool removeUpload(const char *filePath) {
+	char name[NAME_MAX+1], stageName[NAME_MAX+1], rangesName[NAME_MAX+1];
+	int dirFd = openUploadDir(filePath, name, stageName, rangesName);
+	if (dirFd < 0) {
+		return false;
+	}
+	bool removed = (unlinkat(dirFd, rangesName, 0) == 0);
+	removed = (unlinkat(dirFd, stageName, 0) == 0) || removed;
+	close(dirFd);
+	return removed;
+}
+
+/**
+ * Format the ranges of an upload for an Upload-Ranges
+ * header, as "bytes first-last,.../total".
+ *
+ * @param ranges the ranges
+ * @param buf buffer of MAX_PROP_VAL characters
+ * @return the formatted ranges
+ */
+char *formatUploadRanges(const UploadRanges *ranges, char *buf) {
+	size_t len = snprintf(buf, MAX_PROP_VAL, "bytes ");
+	for (size_t i = 0; (i < ranges->count) && (len < MAX_PROP_VAL); i++) {
+		len += snprintf(buf+len, MAX_PROP_VAL-len, "%s%zu-%zu",
+						(i == 0) ? "" : ",", ranges->first[i], ranges->last[i]);
+	}
+	if (len < MAX_PROP_VAL) {
+		snprintf(buf+len, MAX_PROP_VAL-len, "%s/%zu", (ranges->count == 0) ? "*" : "", ranges->total);
+	}
+	return buf;
+}
@@ -0,0 +1,141 @@
+/*
+ * upload.h
+ *
+ * Functions that assemble a file from byte ranges uploaded
+ * separately by PUT requests with Content-Range headers.
+ *
+ *  @since 2026-10-18
+ */
+
+#ifndef UPLOAD_H_
+#define UPLOAD_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/** maximum number of separate ranges of an upload */
+#define UPLOAD_MAX_RANGES 32
+
+/** The byte ranges of a file committed so far, in order */
+typedef struct UploadRanges {
+	size_t total;                       /** size of the complete file */
+	dev_t dev;                          /** device of the staging file */
+	ino_t ino;                          /** inode of the staging file */
+	size_t count;                       /** number of separate ranges */
+	size_t first[UPLOAD_MAX_RANGES];    /** first byte of each range */
+	size_t last[UPLOAD_MAX_RANGES];     /** last byte of each range */
+} UploadRanges;
+
+/**
+ * Parse a Content-Range header value of the form
+ * "bytes first-last/total".
+ *
+ * @param val the header value
+ * @param first the first byte of the range
+ * @param last the last byte of the range
+ * @param total the size of the complete file
+ * @return true if a valid range within the file
+ */
+bool parseContentRange(const char *val, size_t *first, size_t *last, size_t *total);
+
+/**
+ * Returns true if a file path is the staging file or the
+ * ranges of an upload, which requests may not name.
+ *
+ * @param filePath the file path
+ * @return true if the path is of an upload
+ */
+bool isUploadPath(const char *filePath);
+
+/**
+ * Make the path of the staging file of an upload to a
+ * file path, to look it up without opening it.
+ *
+ * @param filePath the file path
+ * @param stagePath buffer of MAXPATHLEN for the path
+ * @return the staging file path, or NULL if too long
+ */
+char *makeUploadStagePath(const char *filePath, char *stagePath);
+
+/**
+ * Open the staging file of an upload to a file path,
+ * creating it if this is the first range. Each request
+ * writes its range through its own descriptor. The path
+ * must be locked.
+ *
+ * @param filePath the file path
+ * @return the file descriptor, or -1 with errno set if error
+ */
+int openUpload(const char *filePath);
+
+/**
+ * Read the committed ranges of an upload to a file path.
+ * The path must be locked.
+ *
+ * @param filePath the file path
+ * @param ranges the ranges
+ * @return true if an upload is in progress
+ */
+bool readUploadRanges(const char *filePath, UploadRanges *ranges);
+
+/**
+ * Add a committed range to the ranges of an upload,
+ * merging it with ranges it overlaps or adjoins.
+ *
+ * @param ranges the ranges
+ * @param first the first byte of the range
+ * @param last the last byte of the range
+ * @return true if added, false if too many separate ranges
+ */
+bool addUploadRange(UploadRanges *ranges, size_t first, size_t last);
+
+/**
+ * Returns true if the ranges of an upload cover the file.
+ *
+ * @param ranges the ranges
+ * @return true if the upload is complete
+ */
+bool isUploadComplete(const UploadRanges *ranges);
+
+/**
+ * Record the committed ranges of an upload to a file path,
+ * replacing the previous record as one step. The path must
+ * be locked.
+ *
+ * @param filePath the file path
+ * @param ranges the ranges
+ * @return 0 if successful, -1 with errno set if error
+ */
+int writeUploadRanges(const char *filePath, const UploadRanges *ranges);
+
+/**
+ * Replace the file at a path by its complete staging file
+ * and end the upload. The path must be locked.
+ *
+ * @param filePath the file path
+ * @param total the size of the complete file
+ * @return 0 if successful, -1 with errno set if error
+ */
+int promoteUpload(const char *filePath, size_t total);
+
+/**
+ * End an upload to a file path, removing its staging file
+ * and ranges. The path must be locked.
+ *
+ * @param filePath the file path
+ * @return true if an upload was removed
+ */
+bool removeUpload(const char *filePath);
+
+/**
+ * Format the ranges of an upload for an Upload-Ranges
+ * header, as "bytes first-last,.../total".
+ *
+ * @param ranges the ranges
+ * @param buf buffer of MAX_PROP_VAL characters
+ * @return the formatted ranges
+ */
+char *formatUploadRanges(const UploadRanges *ranges, char *buf);
+
+#endif /* UPLOAD_H_ */
@@ -9,16 +9,37 @@
 #include "varray.h"
 
 #include <strings.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include "arena.h"
 
-/** Generic variable length array */
+/**
+ * Generic variable length array. The initial capacity is
+ * allocated inline with the varray, and elements only
+ * move to separate storage if the varray grows past it.
+ */
 struct VArray {
-	void* bytes;  		/** array bytes */
-	size_t size;		/** number of array elements */
-	size_t width;		/** width of array element */
-	size_t capacity;	/** capacity of array */
+	void* bytes;  			/** array bytes, inline or separate */
+	size_t size;			/** number of array elements */
+	size_t width;			/** width of array element */
+	size_t capacity;		/** capacity of array */
+	size_t inlineCapacity;	/** capacity of inline storage */
+	Arena* arena;			/** arena for storage or NULL for heap */
+	_Alignas(max_align_t) char inlineBytes[];	/** inline storage */
 };
 
+/**
+ * Returns true if varray elements are in inline storage.
+ *
+ * @param varray the varray
+ * @return true if inline
+ */
+static bool isInline(const VArray* varray) {
+	return varray->bytes == varray->inlineBytes;
+}
+
 /**
  * Ensure varray has required capacity. If not, expand
  * varray to closest power of 2 for specified capacity.
@@ -32,8 +53,21 @@ static bool ensureCapacity(VArray* varray, size_t capacity) {
 		// ensure capacity is the power of 2 greater or equal to specified capacity
 		capacity = (capacity == 0) ? 1 : 1 << flsl(capacity-1);
 
-		// realloc bytes for capacity elements of element width
-		void* bytes = realloc(varray->bytes, capacity*varray->width);
+		// move inline elements out, or realloc bytes for capacity elements of element width
+		void* bytes;
+		if (isInline(varray)) {
+			bytes = (varray->arena != NULL)
+				? allocArena(varray->arena, capacity*varray->width)
+				: malloc(capacity*varray->width);
+			if (bytes != NULL) {
+				memcpy(bytes, varray->bytes, varray->size*varray->width);
+			}
+		} else if (varray->arena != NULL) {
+			bytes = reallocArena(varray->arena, varray->bytes,
+								 varray->capacity*varray->width, capacity*varray->width);
+		} else {
+			bytes = realloc(varray->bytes, capacity*varray->width);
+		}
 		if (bytes == NULL) {  // out of memory
 			return false;
 		}
@@ -46,6 +80,31 @@ static bool ensureCapacity(VArray* varray, size_t capacity) {
 	return true;
 }
 
+/**
+ * Initialize a varray with inline storage for capacity elements.
+ *
+ * @param varray the varray
+ * @param width width of element
+ * @param capacity capacity of inline storage
+ * @param arena the arena for storage or NULL for heap
+ */
+static void initVArray(VArray* varray, size_t width, size_t capacity, Arena* arena) {
+	*varray = (VArray){.width = width, .capacity = capacity,
+					   .inlineCapacity = capacity, .arena = arena};
+	varray->bytes = varray->inlineBytes;
+}
+
+/**
+ * Returns the inline capacity for a requested initial
+ * capacity: a power of 2, and at least 4.
+ *
+ * @param capacity the initial capacity
+ * @return the inline capacity
+ */
+static size_t inlineCapacity(size_t capacity) {
+	return (capacity <= 4) ? 4 : 1 << flsl(capacity-1);
+}
+
 /**
  * Create VArray with elements of width and initial capacity.
  *
@@ -54,22 +113,35 @@ static bool ensureCapacity(VArray* varray, size_t capacity) {
  * @return the new instance or NULL if no space
  */
 void* newVArray(size_t width, size_t capacity) {
-	// allocate instance
-	VArray* varray = malloc(sizeof(VArray));
+	// allocate instance with initial capacity a power of 2, and at least 4
+	capacity = inlineCapacity(capacity);
+	VArray* varray = malloc(sizeof(VArray) + capacity*width);
 	if (varray == NULL) {
 		return NULL;
 	}
+	initVArray(varray, width, capacity, NULL);
+	return varray;
+}
 
-	// initialize with element width (other fields 0/NULL)
-	*varray = (VArray){.width = width};
-
-	// ensure initial capacity is a power of 2, and at least 4
-	if (!ensureCapacity(varray, (capacity < 4) ? 4 : capacity)) {
-		// out of space
-		deleteVArray(varray);
+/**
+ * Create VArray with elements of width and initial capacity
+ * whose storage is allocated from an arena. Deleting the
+ * varray is optional; its storage lives until the arena
+ * is reset.
+ *
+ * @param arena the arena
+ * @param width width of element
+ * @param capacity intial capacity of array
+ * @return the new instance or NULL if no space
+ */
+void* newArenaVArray(Arena* arena, size_t width, size_t capacity) {
+	// allocate instance with initial capacity a power of 2, and at least 4
+	capacity = inlineCapacity(capacity);
+	VArray* varray = allocArena(arena, sizeof(VArray) + capacity*width);
+	if (varray == NULL) {
 		return NULL;
 	}
-
+	initVArray(varray, width, capacity, arena);
 	return varray;
 }
 
@@ -79,8 +151,15 @@ void* newVArray(size_t width, size_t capacity) {
  * @param varray the varray
  */
 void deleteVArray(VArray* varray) {
-	// free bytes of varray
-	free(varray->bytes);
+	if (varray->arena != NULL) {
+		// storage is released with arena
+		return;
+	}
+
+	// free bytes of varray if not inline
+	if (!isInline(varray)) {
+		free(varray->bytes);
+	}
 
 	// reset fields of varray
 	*varray = (VArray){};
@@ -131,3 +210,165 @@ size_t sizeVArray(VArray* varray) {
 size_t capacityVArray(VArray* varray) {
 	return varray->capacity;
 }
+
+/**
+ * Ensure varray can hold capacity elements without
+ * moving its elements.
+ *
+ * @param varray the varray
+ * @param capacity the required capacity
+ * @return true if successful, false if cannot expand varray
+ */
+bool reserveVArray(VArray* varray, size_t capacity) {
+	return ensureCapacity(varray, capacity);
+}
+
+/**
+ * Append an element to the end of the varray.
+ *
+ * @param varray the varray
+ * @param element the element to copy or NULL for zeros
+ * @return pointer to the new element or NULL if cannot expand varray
+ */
+void* appendVArray(VArray* varray, const void* element) {
+	return insertVArray(varray, varray->size, element);
+}
+
+/**
+ * Insert an element at an index, moving later elements up.
+ *
+ * @param varray the varray
+ * @param index the index, at most the size of the varray
+ * @param element the element to copy or NULL for zeros
+ * @return pointer to the new element or NULL if index
+ *   is out of range or cannot expand varray
+ */
+void* insertVArray(VArray* varray, size_t index, const void* element) {
+	if ((index > varray->size) || !ensureCapacity(varray, varray->size+1)) {
+		return NULL;
+	}
+	char* p = (char*)varray->bytes + index*varray->width;
+	memmove(p + varray->width, p, (varray->size - index)*varray->width);
+	if (element != NULL) {
+		memcpy(p, element, varray->width);
+	} else {
+		memset(p, 0, varray->width);
+	}
+	varray->size++;
+	return p;
+}
+
+/**
+ * Remove the element at an index, moving later elements down.
+ *
+ * @param varray the varray
+ * @param index the index
+ * @return true if removed, false if index is out of range
+ */
+bool removeVArray(VArray* varray, size_t index) {
+	if (index >= varray->size) {
+		return false;
+	}
+	char* p = (char*)varray->bytes + index*varray->width;
+	memmove(p, p + varray->width, (varray->size - index - 1)*varray->width);
+	varray->size--;
+	return true;
+}
+
+/**
+ * Remove all elements, keeping the capacity of the varray.
+ *
+ * @param varray the varray
+ */
+void clearVArray(VArray* varray) {
+	varray->size = 0;
+}
+
+/**
+ * Reduce the capacity of the varray to its size, moving
+ * the elements back inline if they fit. Arena storage is
+ * not released until the arena is reset.
+ *
+ * @param varray the varray
+ */
+void shrinkVArray(VArray* varray) {
+	if (isInline(varray)) {
+		return;
+	}
+	if (varray->size <= varray->inlineCapacity) {
+		memcpy(varray->inlineBytes, varray->bytes, varray->size*varray->width);
+		if (varray->arena == NULL) {
+			free(varray->bytes);
+		}
+		varray->bytes = varray->inlineBytes;
+		varray->capacity = varray->inlineCapacity;
+	} else if ((varray->arena == NULL) && (varray->size < varray->capacity)) {
+		void* bytes = realloc(varray->bytes, varray->size*varray->width);
+		if (bytes != NULL) {
+			varray->bytes = bytes;
+			varray->capacity = varray->size;
+		}
+	}
+}
+
+/**
+ * Returns the index of the first element not less than a key
+ * in a varray sorted by the comparison function.
+ *
+ * @param varray the sorted varray
+ * @param key the key
+ * @param compare compares the key to an element
+ * @return the index, or the size of the varray if none
+ */
+static size_t lowerBound(VArray* varray, const void* key, VArrayCompare compare) {
+	size_t lo = 0, hi = varray->size;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo)/2;
+		if (compare(key, (char*)varray->bytes + mid*varray->width) > 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/**
+ * Insert an element into a varray sorted by the comparison
+ * function, after any elements that compare equal to it.
+ *
+ * @param varray the sorted varray
+ * @param element the element to copy
+ * @param compare compares the element to another element
+ * @return pointer to the new element or NULL if cannot expand varray
+ */
+void* insertSortedVArray(VArray* varray, const void* element, VArrayCompare compare) {
+	size_t lo = 0, hi = varray->size;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo)/2;
+		if (compare(element, (char*)varray->bytes + mid*varray->width) >= 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return insertVArray(varray, lo, element);
+}
+
+/**
+ * Find the first element equal to a key in a varray
+ * sorted by the comparison function.
+ *
+ * @param varray the sorted varray
+ * @param key the key
+ * @param compare compares the key to an element
+ * @return the index of the element or SIZE_MAX if not found
+ */
+size_t searchSortedVArray(VArray* varray, const void* key, VArrayCompare compare) {
+	size_t index = lowerBound(varray, key, compare);
+	if ((index < varray->size)
+		&& (compare(key, (char*)varray->bytes + index*varray->width) == 0)) {
+		return index;
+	}
+	return SIZE_MAX;
+}
@@ -11,10 +11,18 @@
 #define VARRAY_H_
 #include <stdbool.h>
 #include <stdlib.h>
+#include "arena.h"
 
 /** Generic variable length array */
 typedef struct VArray VArray;
 
+/**
+ * Comparison function for sorted varrays. Returns a negative,
+ * zero, or positive value if the key is less than, equal to,
+ * or greater than the element.
+ */
+typedef int (*VArrayCompare)(const void* key, const void* element);
+
 /**
  * Create new VArray of elements of width and initial capacity.
  *
@@ -24,6 +32,19 @@ typedef struct VArray VArray;
  */
 void* newVArray(size_t width, size_t capacity);
 
+/**
+ * Create VArray with elements of width and initial capacity
+ * whose storage is allocated from an arena. Deleting the
+ * varray is optional; its storage lives until the arena
+ * is reset.
+ *
+ * @param arena the arena
+ * @param width width of element
+ * @param capacity intial capacity of array
+ * @return the new instance or NULL if no space
+ */
+void* newArenaVArray(Arena* arena, size_t width, size_t capacity);
+
 /**
  * Delete a VArray.
  *
@@ -57,4 +78,81 @@ size_t sizeVArray(VArray* varray);
  */
 size_t capacityVArray(VArray* varray);
 
+/**
+ * Ensure varray can hold capacity elements without
+ * moving its elements.
+ *
+ * @param varray the varray
+ * @param capacity the required capacity
+ * @return true if successful, false if cannot expand varray
+ */
+bool reserveVArray(VArray* varray, size_t capacity);
+
+/**
+ * Append an element to the end of the varray.
+ *
+ * @param varray the varray
+ * @param element the element to copy or NULL for zeros
+ * @return pointer to the new element or NULL if cannot expand varray
+ */
+void* appendVArray(VArray* varray, const void* element);
+
+/**
+ * Insert an element at an index, moving later elements up.
+ *
+ * @param varray the varray
+ * @param index the index, at most the size of the varray
+ * @param element the element to copy or NULL for zeros
+ * @return pointer to the new element or NULL if index
+ *   is out of range or cannot expand varray
+ */
+void* insertVArray(VArray* varray, size_t index, const void* element);
+
+/**
+ * Remove the element at an index, moving later elements down.
+ *
+ * @param varray the varray
+ * @param index the index
+ * @return true if removed, false if index is out of range
+ */
+bool removeVArray(VArray* varray, size_t index);
+
+/**
+ * Remove all elements, keeping the capacity of the varray.
+ *
+ * @param varray the varray
+ */
+void clearVArray(VArray* varray);
+
+/**
+ * Reduce the capacity of the varray to its size, moving
+ * the elements back inline if they fit. Arena storage is
+ * not released until the arena is reset.
+ *
+ * @param varray the varray
+ */
+void shrinkVArray(VArray* varray);
+
+/**
+ * Insert an element into a varray sorted by the comparison
+ * function, after any elements that compare equal to it.
+ *
+ * @param varray the sorted varray
+ * @param element the element to copy
+ * @param compare compares the element to another element
+ * @return pointer to the new element or NULL if cannot expand varray
+ */
+void* insertSortedVArray(VArray* varray, const void* element, VArrayCompare compare);
+
+/**
+ * Find the first element equal to a key in a varray
+ * sorted by the comparison function.
+ *
+ * @param varray the sorted varray
+ * @param key the key
+ * @param compare compares the key to an element
+ * @return the index of the element or SIZE_MAX if not found
+ */
+size_t searchSortedVArray(VArray* varray, const void* key, VArrayCompare compare);
+
 #endif /* VARRAY_H_ */
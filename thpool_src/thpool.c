@@ -18,9 +18,11 @@ int pthread_setname_np (pthread_t, const char *) __attribute__((__nonnull__(2)))
 #endif
 #include <pthread.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <time.h>
 #if defined(__linux__)
 #include <sys/prctl.h>
+#include <sys/eventfd.h>
 #endif
 #if defined(__APPLE__) && defined(__MACH__)
 // should be defined in pthread.h but is not
@@ -42,6 +44,9 @@ int	pthread_setname_np(const char*);
 #define err(str)
 #endif
 
+/* Hash buckets of the flow table of each job class */
+#define THPOOL_FLOW_BUCKETS 256
+
 static volatile int threads_keepalive;
 static volatile int threads_on_hold;
 
@@ -63,19 +68,82 @@ typedef struct job{
 	struct job*  prev;                   /* pointer to previous job   */
 	void   (*function)(void* arg);       /* function pointer          */
 	void*  arg;                          /* function's argument       */
+	int    job_class;                    /* class the job belongs to  */
+	unsigned long flow_key;              /* flow the job belongs to   */
+	struct flow* flow_p;                 /* flow while queued/running */
+	long long queued_us;                 /* time job was queued       */
 } job;
 
 
+/* Flow of jobs from one source within a job class */
+typedef struct flow{
+	unsigned long key;                   /* flow key, 0 for unkeyed   */
+	job  *front;                         /* pointer to front of queue */
+	job  *rear;                          /* pointer to rear  of queue */
+	int   len;                           /* number of jobs in queue   */
+	int   running;                       /* jobs of flow now running  */
+	struct flow* next;                   /* next flow in active ring  */
+	struct flow* prev;                   /* prev flow in active ring  */
+	struct flow* chain;                  /* next flow in hash bucket  */
+} flow;
+
+
+/* Queue of a single job class */
+typedef struct classqueue{
+	flow *buckets[THPOOL_FLOW_BUCKETS];  /* flows by key hash         */
+	flow *active;                        /* ring of flows with jobs   */
+	int   ready;                         /* flows that may run a job  */
+	int   max_flow_threads;              /* flow limit, 0=unlimited   */
+	int   len;                           /* number of jobs in queue   */
+	int   weight;                        /* jobs per round, 0=strict  */
+	int   max_threads;                   /* thread limit, 0=unlimited */
+	int   running;                       /* jobs of class now running */
+	int   max_len;                       /* offer limit, 0=unbounded  */
+	long long target_us;                 /* acceptable sojourn time   */
+	long long interval_us;               /* time sojourn may be high  */
+	long long first_above_us;            /* when sojourn stayed high  */
+	long long drop_next_us;              /* next time to shed offers  */
+	int   drop_count;                    /* offers shed in this spell */
+	int   dropping;                      /* shedding offered jobs     */
+} classqueue;
+
+
 /* Job queue */
 typedef struct jobqueue{
 	pthread_mutex_t rwmutex;             /* used for queue r/w access */
-	job  *front;                         /* pointer to front of queue */
-	job  *rear;                          /* pointer to rear  of queue */
+	classqueue classes[THPOOL_MAX_CLASSES]; /* per-class job queues  */
+	int   cursor;                        /* weighted class being run  */
+	int   credit;                        /* jobs left for cursor class*/
 	bsem *has_jobs;                      /* flag as binary semaphore  */
 	int   len;                           /* number of jobs in queue   */
 } jobqueue;
 
 
+/* Future result of a submitted job */
+typedef struct thpool_future_{
+	pthread_mutex_t mutex;               /* used for state access     */
+	pthread_cond_t  cond;                /* signals completion        */
+	void*  (*function)(void* arg);       /* function pointer          */
+	void*  arg;                          /* function's argument       */
+	void*  result;                       /* function's result         */
+	int    done;                         /* function has returned     */
+	int    refs;                         /* owners: caller and pool   */
+	struct thpool_reactor_* reactor_p;   /* reactor to call back in   */
+	void   (*callback)(void* result, void* arg); /* completion callback */
+	struct thpool_future_* next;         /* next completed in reactor */
+} thpool_future_;
+
+
+/* Reactor that runs completion callbacks on its own thread */
+typedef struct thpool_reactor_{
+	pthread_mutex_t mutex;               /* used for list access      */
+	thpool_future_* front;               /* first completed future    */
+	thpool_future_* rear;                /* last completed future     */
+	int    read_fd;                      /* readable when completed   */
+	int    write_fd;                     /* written on completion     */
+} thpool_reactor_;
+
+
 /* Thread */
 typedef struct thread{
 	int       id;                        /* friendly id               */
@@ -106,10 +174,17 @@ static void* thread_do(struct thread* thread_p);
 static void  thread_hold(int sig_id);
 static void  thread_destroy(struct thread* thread_p);
 
+static int   flow_ready(classqueue* class_p, flow* flow_p);
+
+static void  future_run(thpool_future_* future_p);
+static void  future_release(thpool_future_* future_p);
+
 static int   jobqueue_init(jobqueue* jobqueue_p);
 static void  jobqueue_clear(jobqueue* jobqueue_p);
-static void  jobqueue_push(jobqueue* jobqueue_p, struct job* newjob_p);
+static int   jobqueue_push(jobqueue* jobqueue_p, struct job* newjob_p);
+static int   jobqueue_offer(jobqueue* jobqueue_p, struct job* newjob_p);
 static struct job* jobqueue_pull(jobqueue* jobqueue_p);
+static void  jobqueue_done(jobqueue* jobqueue_p, struct job* job_p);
 static void  jobqueue_destroy(jobqueue* jobqueue_p);
 
 static void  bsem_init(struct bsem *bsem_p, int value);
@@ -182,25 +257,139 @@ struct thpool_* thpool_init(int num_threads){
 
 /* Add work to the thread pool */
 int thpool_add_work(thpool_* thpool_p, void (*function_p)(void*), void* arg_p){
+	return thpool_add_work_class(thpool_p, 0, function_p, arg_p);
+}
+
+
+/* Make a new job of a job class */
+static job* job_new(int job_class, unsigned long flow_key, void (*function_p)(void*), void* arg_p){
 	job* newjob;
 
+	if (job_class < 0 || job_class >= THPOOL_MAX_CLASSES){
+		err("thpool_add_work_class(): Invalid job class\n");
+		return NULL;
+	}
+
 	newjob=(struct job*)malloc(sizeof(struct job));
 	if (newjob==NULL){
 		err("thpool_add_work(): Could not allocate memory for new job\n");
-		return -1;
+		return NULL;
 	}
 
 	/* add function and argument */
 	newjob->function=function_p;
 	newjob->arg=arg_p;
+	newjob->job_class=job_class;
+	newjob->flow_key=flow_key;
+	newjob->flow_p=NULL;
+	return newjob;
+}
+
+
+/* Add work of a job class to the thread pool */
+int thpool_add_work_class(thpool_* thpool_p, int job_class, void (*function_p)(void*), void* arg_p){
+	return thpool_add_work_flow(thpool_p, job_class, 0, function_p, arg_p);
+}
+
+
+/* Add work of a flow of a job class to the thread pool */
+int thpool_add_work_flow(thpool_* thpool_p, int job_class, unsigned long flow_key, void (*function_p)(void*), void* arg_p){
+	job* newjob = job_new(job_class, flow_key, function_p, arg_p);
+	if (newjob==NULL){
+		return -1;
+	}
 
 	/* add job to queue */
-	jobqueue_push(&thpool_p->jobqueue, newjob);
+	if (jobqueue_push(&thpool_p->jobqueue, newjob) != 0){
+		free(newjob);
+		return -1;
+	}
 
 	return 0;
 }
 
 
+/* Offer work of a flow of a job class to the thread pool, which may refuse it */
+int thpool_offer_work(thpool_* thpool_p, int job_class, unsigned long flow_key, void (*function_p)(void*), void* arg_p){
+	job* newjob = job_new(job_class, flow_key, function_p, arg_p);
+	if (newjob==NULL){
+		return -1;
+	}
+
+	/* add job to queue unless overloaded */
+	int status = jobqueue_offer(&thpool_p->jobqueue, newjob);
+	if (status != 0){
+		free(newjob);
+	}
+
+	return status;
+}
+
+
+/* Set scheduling weight and thread limit of a job class */
+int thpool_set_class(thpool_* thpool_p, int job_class, int weight, int max_threads){
+	if (job_class < 0 || job_class >= THPOOL_MAX_CLASSES || weight < 0 || max_threads < 0){
+		err("thpool_set_class(): Invalid job class settings\n");
+		return -1;
+	}
+
+	jobqueue* jobqueue_p = &thpool_p->jobqueue;
+	pthread_mutex_lock(&jobqueue_p->rwmutex);
+	jobqueue_p->classes[job_class].weight      = weight;
+	jobqueue_p->classes[job_class].max_threads = max_threads;
+	if (jobqueue_p->cursor == job_class){
+		jobqueue_p->credit = weight;
+	}
+	pthread_mutex_unlock(&jobqueue_p->rwmutex);
+	return 0;
+}
+
+
+/* Limit the threads each flow of a job class may occupy */
+int thpool_set_flow_limit(thpool_* thpool_p, int job_class, int max_flow_threads){
+	if (job_class < 0 || job_class >= THPOOL_MAX_CLASSES || max_flow_threads < 0){
+		err("thpool_set_flow_limit(): Invalid job class flow limit\n");
+		return -1;
+	}
+
+	jobqueue* jobqueue_p = &thpool_p->jobqueue;
+	pthread_mutex_lock(&jobqueue_p->rwmutex);
+	classqueue* class_p = &jobqueue_p->classes[job_class];
+	class_p->max_flow_threads = max_flow_threads;
+
+	/* recount the flows that may run under the new limit */
+	class_p->ready = 0;
+	flow* flow_p = class_p->active;
+	int n;
+	for (n=0; flow_p != NULL && (n == 0 || flow_p != class_p->active); n++){
+		class_p->ready += flow_ready(class_p, flow_p);
+		flow_p = flow_p->next;
+	}
+	pthread_mutex_unlock(&jobqueue_p->rwmutex);
+	return 0;
+}
+
+
+/* Set queue limit and shedding policy of a job class */
+int thpool_set_limit(thpool_* thpool_p, int job_class, int max_len, int target_ms, int interval_ms){
+	if (job_class < 0 || job_class >= THPOOL_MAX_CLASSES || max_len < 0 || target_ms < 0 || interval_ms < 0){
+		err("thpool_set_limit(): Invalid job class limits\n");
+		return -1;
+	}
+
+	jobqueue* jobqueue_p = &thpool_p->jobqueue;
+	pthread_mutex_lock(&jobqueue_p->rwmutex);
+	classqueue* class_p = &jobqueue_p->classes[job_class];
+	class_p->max_len        = max_len;
+	class_p->target_us      = target_ms * 1000LL;
+	class_p->interval_us    = interval_ms * 1000LL;
+	class_p->first_above_us = 0;
+	class_p->dropping       = 0;
+	pthread_mutex_unlock(&jobqueue_p->rwmutex);
+	return 0;
+}
+
+
 /* Wait until all jobs have finished */
 void thpool_wait(thpool_* thpool_p){
 	pthread_mutex_lock(&thpool_p->thcount_lock);
@@ -278,6 +467,204 @@ int thpool_num_threads_working(thpool_* thpool_p){
 
 
 
+/* ============================= FUTURES ============================ */
+
+
+/* Submit work whose result is delivered through a future */
+struct thpool_future_* thpool_submit(thpool_* thpool_p, void* (*function_p)(void*), void* arg_p,
+                                     thpool_reactor_* reactor_p, void (*callback_p)(void*, void*)){
+	if ((reactor_p == NULL) != (callback_p == NULL)){
+		err("thpool_submit(): Reactor and callback must be given together\n");
+		return NULL;
+	}
+
+	thpool_future_* future_p = (struct thpool_future_*)calloc(1, sizeof(struct thpool_future_));
+	if (future_p == NULL){
+		err("thpool_submit(): Could not allocate memory for new future\n");
+		return NULL;
+	}
+	pthread_mutex_init(&future_p->mutex, NULL);
+	pthread_cond_init(&future_p->cond, NULL);
+	future_p->function  = function_p;
+	future_p->arg       = arg_p;
+	future_p->reactor_p = reactor_p;
+	future_p->callback  = callback_p;
+	future_p->refs      = 2;
+
+	if (thpool_add_work(thpool_p, (void (*)(void*))future_run, future_p) != 0){
+		pthread_mutex_destroy(&future_p->mutex);
+		pthread_cond_destroy(&future_p->cond);
+		free(future_p);
+		return NULL;
+	}
+	return future_p;
+}
+
+
+/* Whether the job of a future has finished */
+int thpool_future_done(thpool_future_* future_p){
+	pthread_mutex_lock(&future_p->mutex);
+	int done = future_p->done;
+	pthread_mutex_unlock(&future_p->mutex);
+	return done;
+}
+
+
+/* Wait for the job of a future to finish and return its result */
+void* thpool_future_wait(thpool_future_* future_p){
+	pthread_mutex_lock(&future_p->mutex);
+	while (!future_p->done){
+		pthread_cond_wait(&future_p->cond, &future_p->mutex);
+	}
+	void* result = future_p->result;
+	pthread_mutex_unlock(&future_p->mutex);
+	return result;
+}
+
+
+/* Release the caller's hold on a future */
+void thpool_future_free(thpool_future_* future_p){
+	if (future_p != NULL){
+		future_release(future_p);
+	}
+}
+
+
+/* Make a reactor to run completion callbacks */
+struct thpool_reactor_* thpool_reactor_init(void){
+	thpool_reactor_* reactor_p = (struct thpool_reactor_*)calloc(1, sizeof(struct thpool_reactor_));
+	if (reactor_p == NULL){
+		err("thpool_reactor_init(): Could not allocate memory for reactor\n");
+		return NULL;
+	}
+
+#if defined(__linux__)
+	reactor_p->read_fd = reactor_p->write_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (reactor_p->read_fd < 0){
+#else
+	int fds[2];
+	if (pipe(fds) != 0){
+#endif
+		err("thpool_reactor_init(): Could not create completion descriptor\n");
+		free(reactor_p);
+		return NULL;
+	}
+#if !defined(__linux__)
+	reactor_p->read_fd  = fds[0];
+	reactor_p->write_fd = fds[1];
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+#endif
+
+	pthread_mutex_init(&reactor_p->mutex, NULL);
+	return reactor_p;
+}
+
+
+/* Descriptor that is readable while a reactor has callbacks to run */
+int thpool_reactor_fd(thpool_reactor_* reactor_p){
+	return reactor_p->read_fd;
+}
+
+
+/* Run the callbacks of the futures completed for a reactor */
+int thpool_reactor_dispatch(thpool_reactor_* reactor_p){
+	/* drain the notification before taking the list so that a
+	 * completion racing with us leaves the descriptor readable */
+	char buf[64];
+	while (read(reactor_p->read_fd, buf, sizeof(buf)) > 0) {}
+
+	pthread_mutex_lock(&reactor_p->mutex);
+	thpool_future_* future_p = reactor_p->front;
+	reactor_p->front = reactor_p->rear = NULL;
+	pthread_mutex_unlock(&reactor_p->mutex);
+
+	int count = 0;
+	while (future_p != NULL){
+		thpool_future_* next_p = future_p->next;
+		future_p->callback(future_p->result, future_p->arg);
+		future_release(future_p);
+		future_p = next_p;
+		count++;
+	}
+	return count;
+}
+
+
+/* Destroy a reactor, dropping callbacks not yet run */
+void thpool_reactor_destroy(thpool_reactor_* reactor_p){
+	if (reactor_p == NULL) return;
+
+	thpool_future_* future_p = reactor_p->front;
+	while (future_p != NULL){
+		thpool_future_* next_p = future_p->next;
+		future_release(future_p);
+		future_p = next_p;
+	}
+	close(reactor_p->read_fd);
+	if (reactor_p->write_fd != reactor_p->read_fd){
+		close(reactor_p->write_fd);
+	}
+	pthread_mutex_destroy(&reactor_p->mutex);
+	free(reactor_p);
+}
+
+
+/* Run the job of a future and deliver its result (pool job) */
+static void future_run(thpool_future_* future_p){
+	void* result = future_p->function(future_p->arg);
+
+	pthread_mutex_lock(&future_p->mutex);
+	future_p->result = result;
+	future_p->done   = 1;
+	pthread_cond_broadcast(&future_p->cond);
+	pthread_mutex_unlock(&future_p->mutex);
+
+	thpool_reactor_* reactor_p = future_p->reactor_p;
+	if (reactor_p == NULL){
+		future_release(future_p);
+		return;
+	}
+
+	/* hand the pool's hold to the reactor, which runs the callback */
+	pthread_mutex_lock(&reactor_p->mutex);
+	future_p->next = NULL;
+	if (reactor_p->rear == NULL){
+		reactor_p->front = future_p;
+	} else {
+		reactor_p->rear->next = future_p;
+	}
+	reactor_p->rear = future_p;
+	pthread_mutex_unlock(&reactor_p->mutex);
+
+#if defined(__linux__)
+	uint64_t one = 1;
+#else
+	char one = 1;
+#endif
+	if (write(reactor_p->write_fd, &one, sizeof(one)) < 0 && errno != EAGAIN){
+		err("future_run(): Could not notify reactor\n");
+	}
+}
+
+
+/* Drop one hold on a future, freeing it with the last */
+static void future_release(thpool_future_* future_p){
+	pthread_mutex_lock(&future_p->mutex);
+	int refs = --future_p->refs;
+	pthread_mutex_unlock(&future_p->mutex);
+
+	if (refs == 0){
+		pthread_mutex_destroy(&future_p->mutex);
+		pthread_cond_destroy(&future_p->cond);
+		free(future_p);
+	}
+}
+
+
+
+
+
 /* ============================ THREAD ============================== */
 
 
@@ -374,6 +761,7 @@ static void* thread_do(struct thread* thread_p){
 				func_buff = job_p->function;
 				arg_buff  = job_p->arg;
 				func_buff(arg_buff);
+				jobqueue_done(&thpool_p->jobqueue, job_p);
 				free(job_p);
 			}
 
@@ -403,14 +791,200 @@ static void thread_destroy (thread* thread_p){
 
 
 
+/* ============================== FLOWS ============================= */
+
+
+/* Whether a flow has a job that may be started now
+ *
+ * Unkeyed jobs share flow 0, which is not subject to the flow limit.
+ */
+static int flow_ready(classqueue* class_p, flow* flow_p){
+	return flow_p->len > 0
+	    && (flow_p->key == 0 || class_p->max_flow_threads == 0
+	        || flow_p->running < class_p->max_flow_threads);
+}
+
+
+/* Find the flow of a key, optionally creating it
+ *
+ * Notice: Caller MUST hold the queue mutex
+ */
+static flow* flow_find(classqueue* class_p, unsigned long key, int create){
+	flow** bucket_p = &class_p->buckets[(key * 2654435761UL) % THPOOL_FLOW_BUCKETS];
+	flow* flow_p;
+	for (flow_p = *bucket_p; flow_p != NULL; flow_p = flow_p->chain){
+		if (flow_p->key == key) return flow_p;
+	}
+	if (!create){
+		return NULL;
+	}
+
+	flow_p = (struct flow*)calloc(1, sizeof(struct flow));
+	if (flow_p == NULL){
+		err("flow_find(): Could not allocate memory for new flow\n");
+		return NULL;
+	}
+	flow_p->key   = key;
+	flow_p->chain = *bucket_p;
+	*bucket_p = flow_p;
+	return flow_p;
+}
+
+
+/* Free a flow that has no queued or running jobs
+ *
+ * Notice: Caller MUST hold the queue mutex
+ */
+static void flow_release(classqueue* class_p, flow* flow_p){
+	if (flow_p->len > 0 || flow_p->running > 0){
+		return;
+	}
+	flow** bucket_p = &class_p->buckets[(flow_p->key * 2654435761UL) % THPOOL_FLOW_BUCKETS];
+	while (*bucket_p != flow_p){
+		bucket_p = &(*bucket_p)->chain;
+	}
+	*bucket_p = flow_p->chain;
+	free(flow_p);
+}
+
+
+/* Add a flow that has jobs at the back of the active ring
+ *
+ * Notice: Caller MUST hold the queue mutex
+ */
+static void flow_activate(classqueue* class_p, flow* flow_p){
+	if (class_p->active == NULL){
+		flow_p->next = flow_p->prev = flow_p;
+		class_p->active = flow_p;
+		return;
+	}
+	flow_p->next = class_p->active;
+	flow_p->prev = class_p->active->prev;
+	flow_p->prev->next = flow_p;
+	class_p->active->prev = flow_p;
+}
+
+
+/* Remove a flow without jobs from the active ring
+ *
+ * Notice: Caller MUST hold the queue mutex
+ */
+static void flow_deactivate(classqueue* class_p, flow* flow_p){
+	if (flow_p->next == flow_p){
+		class_p->active = NULL;
+	} else {
+		flow_p->prev->next = flow_p->next;
+		flow_p->next->prev = flow_p->prev;
+		if (class_p->active == flow_p){
+			class_p->active = flow_p->next;
+		}
+	}
+	flow_p->next = flow_p->prev = NULL;
+}
+
+
+/* Take the next job of a class, round robin between its flows
+ *
+ * This is deficit round robin with a quantum of one job: the active
+ * ring is walked from the flow after the one served last, and the
+ * first flow below its thread limit gives up its oldest job. A client
+ * with many queued jobs thus gets no more turns than one with a single
+ * job, and never more than max_flow_threads workers.
+ *
+ * Notice: Caller MUST hold the queue mutex, and the class MUST be ready
+ */
+static job* flow_pull(classqueue* class_p){
+	flow* flow_p = class_p->active;
+	while (!flow_ready(class_p, flow_p)){
+		flow_p = flow_p->next;
+	}
+
+	job* job_p = flow_p->front;
+	flow_p->front = job_p->prev;
+	if (flow_p->front == NULL){
+		flow_p->rear = NULL;
+	}
+	flow_p->len--;
+	flow_p->running++;
+	class_p->ready += flow_ready(class_p, flow_p) - 1;
+
+	/* next turn goes to the following flow */
+	class_p->active = flow_p->next;
+	if (flow_p->len == 0){
+		flow_deactivate(class_p, flow_p);
+	}
+	return job_p;
+}
+
+
+
+
+
 /* ============================ JOB QUEUE =========================== */
 
 
+/* Monotonic time in microseconds */
+static long long jobqueue_now_us(void){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+
+/* Integer square root, for the shedding control law */
+static long long jobqueue_isqrt(long long n){
+	long long x = n, y = (x + 1) / 2;
+	while (y < x){
+		x = y;
+		y = (x + n / x) / 2;
+	}
+	return x;
+}
+
+
+/* Track how long a class's jobs wait, CoDel style
+ *
+ * A class whose jobs have waited longer than its target for a whole
+ * interval has a standing queue: it starts shedding offered jobs. The
+ * first offer is shed at once and the following ones at intervals
+ * shrinking with the square root of the number shed, until a job is
+ * again pulled within the target time.
+ *
+ * Notice: Caller MUST hold the queue mutex
+ */
+static void jobqueue_sojourn(classqueue* class_p, long long sojourn_us, long long now_us){
+	if (class_p->target_us == 0){
+		return;
+	}
+
+	if (sojourn_us < class_p->target_us || class_p->len == 0){
+		/* queue drained or jobs served in time */
+		class_p->first_above_us = 0;
+		class_p->dropping = 0;
+	}
+	else if (class_p->first_above_us == 0){
+		class_p->first_above_us = now_us + class_p->interval_us;
+	}
+	else if (!class_p->dropping && now_us >= class_p->first_above_us){
+		class_p->dropping = 1;
+		/* resume near the previous rate if shedding stopped recently */
+		int recent = now_us - class_p->drop_next_us < 16 * class_p->interval_us;
+		class_p->drop_count = (recent && class_p->drop_count > 2) ? class_p->drop_count - 2 : 1;
+		class_p->drop_next_us = now_us;
+	}
+}
+
+
 /* Initialize queue */
 static int jobqueue_init(jobqueue* jobqueue_p){
 	jobqueue_p->len = 0;
-	jobqueue_p->front = NULL;
-	jobqueue_p->rear  = NULL;
+	jobqueue_p->cursor = 0;
+	jobqueue_p->credit = 1;
+
+	int n;
+	for (n=0; n<THPOOL_MAX_CLASSES; n++){
+		jobqueue_p->classes[n] = (classqueue){ .weight = 1 };
+	}
 
 	jobqueue_p->has_jobs = (struct bsem*)malloc(sizeof(struct bsem));
 	if (jobqueue_p->has_jobs == NULL){
@@ -427,73 +1001,188 @@ static int jobqueue_init(jobqueue* jobqueue_p){
 /* Clear the queue */
 static void jobqueue_clear(jobqueue* jobqueue_p){
 
-	while(jobqueue_p->len){
-		free(jobqueue_pull(jobqueue_p));
+	int n, bucket;
+	for (n=0; n<THPOOL_MAX_CLASSES; n++){
+		classqueue* class_p = &jobqueue_p->classes[n];
+		for (bucket=0; bucket<THPOOL_FLOW_BUCKETS; bucket++){
+			while (class_p->buckets[bucket]){
+				flow* flow_p = class_p->buckets[bucket];
+				class_p->buckets[bucket] = flow_p->chain;
+				while (flow_p->front){
+					job* job_p = flow_p->front;
+					flow_p->front = job_p->prev;
+					free(job_p);
+				}
+				free(flow_p);
+			}
+		}
+		class_p->active = NULL;
+		class_p->ready  = 0;
+		class_p->len    = 0;
 	}
 
-	jobqueue_p->front = NULL;
-	jobqueue_p->rear  = NULL;
 	bsem_reset(jobqueue_p->has_jobs);
 	jobqueue_p->len = 0;
 
 }
 
 
+/* Whether a job class has a job that may be started now
+ *
+ * Notice: Caller MUST hold the queue mutex
+ */
+static int jobqueue_class_ready(jobqueue* jobqueue_p, int job_class){
+	classqueue* class_p = &jobqueue_p->classes[job_class];
+	return class_p->ready > 0
+	    && (class_p->max_threads == 0 || class_p->running < class_p->max_threads);
+}
+
+
+/* Whether any job class has a job that may be started now
+ *
+ * Notice: Caller MUST hold the queue mutex
+ */
+static int jobqueue_ready(jobqueue* jobqueue_p){
+	int n;
+	for (n=0; n<THPOOL_MAX_CLASSES; n++){
+		if (jobqueue_class_ready(jobqueue_p, n)) return 1;
+	}
+	return 0;
+}
+
+
+/* Pick the class of the next job to run, or -1 if none may run
+ *
+ * Strict classes (weight 0) are served first in class order. The
+ * remaining classes share the workers by weighted round robin: the
+ * class at the cursor runs up to 'weight' jobs before the cursor
+ * moves on to the next class with runnable jobs.
+ *
+ * Notice: Caller MUST hold the queue mutex
+ */
+static int jobqueue_select(jobqueue* jobqueue_p){
+	int n;
+	for (n=0; n<THPOOL_MAX_CLASSES; n++){
+		if (jobqueue_p->classes[n].weight == 0 && jobqueue_class_ready(jobqueue_p, n)){
+			return n;
+		}
+	}
+
+	for (n=0; n<THPOOL_MAX_CLASSES; n++){
+		int job_class = (jobqueue_p->cursor + n) % THPOOL_MAX_CLASSES;
+		if (jobqueue_p->classes[job_class].weight == 0 || !jobqueue_class_ready(jobqueue_p, job_class)){
+			continue;
+		}
+		if (job_class != jobqueue_p->cursor){
+			jobqueue_p->cursor = job_class;
+			jobqueue_p->credit = jobqueue_p->classes[job_class].weight;
+		}
+		if (--jobqueue_p->credit <= 0){
+			jobqueue_p->cursor = (job_class + 1) % THPOOL_MAX_CLASSES;
+			jobqueue_p->credit = jobqueue_p->classes[jobqueue_p->cursor].weight;
+		}
+		return job_class;
+	}
+	return -1;
+}
+
+
 /* Add (allocated) job to queue
+ *
+ * @return 0 if queued, -1 if its flow could not be allocated
  */
-static void jobqueue_push(jobqueue* jobqueue_p, struct job* newjob){
+static int jobqueue_push(jobqueue* jobqueue_p, struct job* newjob){
 
 	pthread_mutex_lock(&jobqueue_p->rwmutex);
 	newjob->prev = NULL;
+	newjob->queued_us = jobqueue_now_us();
 
-	switch(jobqueue_p->len){
+	classqueue* class_p = &jobqueue_p->classes[newjob->job_class];
+	flow* flow_p = flow_find(class_p, newjob->flow_key, 1);
+	if (flow_p == NULL){
+		pthread_mutex_unlock(&jobqueue_p->rwmutex);
+		return -1;
+	}
+	newjob->flow_p = flow_p;
+	int was_ready = flow_ready(class_p, flow_p);
+
+	switch(flow_p->len){
 
 		case 0:  /* if no jobs in queue */
-					jobqueue_p->front = newjob;
-					jobqueue_p->rear  = newjob;
+					flow_p->front = newjob;
+					flow_p->rear  = newjob;
+					flow_activate(class_p, flow_p);
 					break;
 
 		default: /* if jobs in queue */
-					jobqueue_p->rear->prev = newjob;
-					jobqueue_p->rear = newjob;
+					flow_p->rear->prev = newjob;
+					flow_p->rear = newjob;
 
 	}
+	flow_p->len++;
+	class_p->ready += flow_ready(class_p, flow_p) - was_ready;
+	class_p->len++;
 	jobqueue_p->len++;
 
 	bsem_post(jobqueue_p->has_jobs);
 	pthread_mutex_unlock(&jobqueue_p->rwmutex);
+	return 0;
 }
 
 
-/* Get first job from queue(removes it from queue)
-<<<<<<< HEAD
+/* Add (allocated) job to queue unless its class is overloaded
  *
- * Notice: Caller MUST hold a mutex
-=======
->>>>>>> da2c0fe45e43ce0937f272c8cd2704bdc0afb490
+ * @return 0 if queued, THPOOL_SHED if the job was shed, -1 on error
  */
-static struct job* jobqueue_pull(jobqueue* jobqueue_p){
+static int jobqueue_offer(jobqueue* jobqueue_p, struct job* newjob){
 
 	pthread_mutex_lock(&jobqueue_p->rwmutex);
-	job* job_p = jobqueue_p->front;
+	classqueue* class_p = &jobqueue_p->classes[newjob->job_class];
+	long long now_us = jobqueue_now_us();
+
+	int shed = 0;
+	if (class_p->max_len > 0 && class_p->len >= class_p->max_len){
+		shed = 1;
+	}
+	else if (class_p->dropping && now_us >= class_p->drop_next_us){
+		shed = 1;
+		class_p->drop_count++;
+		class_p->drop_next_us = now_us + class_p->interval_us / jobqueue_isqrt(class_p->drop_count);
+	}
+	pthread_mutex_unlock(&jobqueue_p->rwmutex);
 
-	switch(jobqueue_p->len){
+	if (shed){
+		return THPOOL_SHED;
+	}
+	return jobqueue_push(jobqueue_p, newjob);
+}
 
-		case 0:  /* if no jobs in queue */
-		  			break;
 
-		case 1:  /* if one job in queue */
-					jobqueue_p->front = NULL;
-					jobqueue_p->rear  = NULL;
-					jobqueue_p->len = 0;
-					break;
+/* Get next job to run from queue (removes it from queue)
+ *
+ * Returns NULL if no job may be started now, either because the
+ * queue is empty or because every queued class or flow is at its limit.
+ */
+static struct job* jobqueue_pull(jobqueue* jobqueue_p){
 
-		default: /* if >1 jobs in queue */
-					jobqueue_p->front = job_p->prev;
-					jobqueue_p->len--;
-					/* more than one job in queue -> post it */
-					bsem_post(jobqueue_p->has_jobs);
+	pthread_mutex_lock(&jobqueue_p->rwmutex);
+	job* job_p = NULL;
+
+	int job_class = jobqueue_select(jobqueue_p);
+	if (job_class >= 0){
+		classqueue* class_p = &jobqueue_p->classes[job_class];
+		job_p = flow_pull(class_p);
+		class_p->len--;
+		class_p->running++;
+		jobqueue_p->len--;
+
+		long long now_us = jobqueue_now_us();
+		jobqueue_sojourn(class_p, now_us - job_p->queued_us, now_us);
+	}
 
+	/* more runnable jobs in queue -> post it */
+	if (jobqueue_ready(jobqueue_p)){
+		bsem_post(jobqueue_p->has_jobs);
 	}
 
 	pthread_mutex_unlock(&jobqueue_p->rwmutex);
@@ -501,6 +1190,26 @@ static struct job* jobqueue_pull(jobqueue* jobqueue_p){
 }
 
 
+/* Mark a pulled job as finished, releasing its class and flow thread slots */
+static void jobqueue_done(jobqueue* jobqueue_p, struct job* job_p){
+
+	pthread_mutex_lock(&jobqueue_p->rwmutex);
+	classqueue* class_p = &jobqueue_p->classes[job_p->job_class];
+	flow* flow_p = job_p->flow_p;
+	int was_ready = flow_ready(class_p, flow_p);
+	flow_p->running--;
+	class_p->ready += flow_ready(class_p, flow_p) - was_ready;
+	class_p->running--;
+	flow_release(class_p, flow_p);
+
+	/* a class or flow held back by its thread limit may run again */
+	if (jobqueue_ready(jobqueue_p)){
+		bsem_post(jobqueue_p->has_jobs);
+	}
+	pthread_mutex_unlock(&jobqueue_p->rwmutex);
+}
+
+
 /* Free all queue resources back to the system */
 static void jobqueue_destroy(jobqueue* jobqueue_p){
 	jobqueue_clear(jobqueue_p);
@@ -15,6 +15,15 @@ extern "C" {
 
 
 typedef struct thpool_* threadpool;
+typedef struct thpool_future_* thpool_future;
+typedef struct thpool_reactor_* thpool_reactor;
+
+
+/* Number of job classes a threadpool schedules between */
+#define THPOOL_MAX_CLASSES 4
+
+/* Result of thpool_offer_work() when the job was refused */
+#define THPOOL_SHED 1
 
 
 /**
@@ -67,6 +76,248 @@ threadpool thpool_init(int num_threads);
 int thpool_add_work(threadpool, void (*function_p)(void*), void* arg_p);
 
 
+/**
+ * @brief Add work of a job class to the job queue
+ *
+ * Works like thpool_add_work() but queues the job behind other jobs of
+ * the same class only. Each class has its own FIFO and the workers
+ * choose between classes as configured with thpool_set_class(), so a
+ * backlog of long jobs in one class does not delay jobs of another.
+ * thpool_add_work() queues to class 0.
+ *
+ * @example
+ *
+ *    thpool_set_class(thpool, 1, 1, 2);    // at most 2 threads on class 1
+ *    thpool_add_work_class(thpool, 1, (void*)copy_file, (void*)file);
+ *
+ * @param  threadpool    threadpool to which the work will be added
+ * @param  job_class     class of the job, 0 <= job_class < THPOOL_MAX_CLASSES
+ * @param  function_p    pointer to function to add as work
+ * @param  arg_p         pointer to an argument
+ * @return 0 on successs, -1 otherwise.
+ */
+int thpool_add_work_class(threadpool, int job_class, void (*function_p)(void*), void* arg_p);
+
+
+/**
+ * @brief Configure how workers share out between job classes
+ *
+ * Classes with weight 0 have strict priority: their jobs are always
+ * started before jobs of weighted classes, lower classes first. The
+ * weighted classes are served round robin, each running up to 'weight'
+ * jobs before the next class gets its turn. A class with a non-zero
+ * max_threads never occupies more than that many workers at once, which
+ * keeps the other workers free for the other classes.
+ *
+ * All classes start with weight 1 and no thread limit.
+ *
+ * @example
+ *
+ *    thpool_set_class(thpool, 0, 4, 0);    // 4 jobs of class 0 ...
+ *    thpool_set_class(thpool, 1, 1, 6);    // ... per job of class 1
+ *
+ * @param  threadpool    threadpool to configure
+ * @param  job_class     class to configure
+ * @param  weight        jobs per round robin turn, or 0 for strict priority
+ * @param  max_threads   maximum workers running the class, or 0 for no limit
+ * @return 0 on successs, -1 otherwise.
+ */
+int thpool_set_class(threadpool, int job_class, int weight, int max_threads);
+
+
+/**
+ * @brief Add work of a flow of a job class to the job queue
+ *
+ * Works like thpool_add_work_class() but queues the job behind other
+ * jobs of the same flow only, such as requests of the same client.
+ * Workers take jobs from the flows of a class in turn, so a flow with
+ * many queued jobs cannot crowd out flows with few. Unkeyed jobs use
+ * flow 0.
+ *
+ * @example
+ *
+ *    thpool_add_work_flow(thpool, 0, client_addr, (void*)serve, (void*)fd);
+ *
+ * @param  threadpool    threadpool to which the work will be added
+ * @param  job_class     class of the job, 0 <= job_class < THPOOL_MAX_CLASSES
+ * @param  flow_key      flow of the job, or 0 if none
+ * @param  function_p    pointer to function to add as work
+ * @param  arg_p         pointer to an argument
+ * @return 0 on successs, -1 otherwise.
+ */
+int thpool_add_work_flow(threadpool, int job_class, unsigned long flow_key, void (*function_p)(void*), void* arg_p);
+
+
+/**
+ * @brief Limit the workers each flow of a job class may occupy
+ *
+ * A flow already running 'max_flow_threads' jobs of the class is
+ * skipped until one of them finishes, keeping the other workers for
+ * other flows. Flow 0 is not limited.
+ *
+ * @example
+ *
+ *    thpool_set_flow_limit(thpool, 0, 2);   // 2 threads per client
+ *
+ * @param  threadpool        threadpool to configure
+ * @param  job_class         class to configure
+ * @param  max_flow_threads  maximum workers per flow, or 0 for no limit
+ * @return 0 on successs, -1 otherwise.
+ */
+int thpool_set_flow_limit(threadpool, int job_class, int max_flow_threads);
+
+
+/**
+ * @brief Offer work to a job class that may refuse it under overload
+ *
+ * Works like thpool_add_work_flow() but returns THPOOL_SHED without
+ * queueing the job if its class is overloaded as set by
+ * thpool_set_limit(). The caller still owns the argument and should
+ * turn the work away cheaply, without involving the pool.
+ *
+ * @example
+ *
+ *    if (thpool_offer_work(thpool, 0, client_addr, (void*)serve, (void*)fd) == THPOOL_SHED){
+ *       reject(fd);
+ *    }
+ *
+ * @param  threadpool    threadpool to which the work will be offered
+ * @param  job_class     class of the job, 0 <= job_class < THPOOL_MAX_CLASSES
+ * @param  flow_key      flow of the job, or 0 if none
+ * @param  function_p    pointer to function to add as work
+ * @param  arg_p         pointer to an argument
+ * @return 0 if queued, THPOOL_SHED if refused, -1 on error.
+ */
+int thpool_offer_work(threadpool, int job_class, unsigned long flow_key, void (*function_p)(void*), void* arg_p);
+
+
+/**
+ * @brief Bound the queue of a job class and shed offered work
+ *
+ * thpool_offer_work() refuses jobs while 'max_len' jobs of the class are
+ * queued. It also sheds jobs CoDel style: when jobs of the class have
+ * waited longer than 'target_ms' for 'interval_ms', offers are refused
+ * at a rate that grows until jobs are again started within the target.
+ * thpool_add_work_class() and thpool_add_work_flow() are never refused.
+ *
+ * @example
+ *
+ *    thpool_set_limit(thpool, 0, 1024, 5, 100);
+ *
+ * @param  threadpool    threadpool to configure
+ * @param  job_class     class to configure
+ * @param  max_len       maximum queued jobs, or 0 for no bound
+ * @param  target_ms     acceptable queueing time, or 0 for no shedding
+ * @param  interval_ms   time queueing may exceed the target before shedding
+ * @return 0 on successs, -1 otherwise.
+ */
+int thpool_set_limit(threadpool, int job_class, int max_len, int target_ms, int interval_ms);
+
+
+/**
+ * @brief Submit work whose result is delivered through a future
+ *
+ * Adds a job like thpool_add_work() but returns a handle to its result.
+ * The result can be waited for with thpool_future_wait(). Alternatively
+ * a callback can be given that is run on the thread of a reactor with
+ * the result and the argument, which lets an event loop hand blocking
+ * calls to the pool and continue when they complete.
+ *
+ * The caller must release the future with thpool_future_free() once
+ * done with it; the callback may still run after that.
+ *
+ * @example
+ *
+ *    void* stat_file(void* path){ ... }
+ *    void stat_done(void* result, void* path){ ... }
+ *
+ *    thpool_reactor reactor = thpool_reactor_init();
+ *    thpool_future_free(thpool_submit(thpool, stat_file, path, reactor, stat_done));
+ *    ..
+ *    // in the event loop, when thpool_reactor_fd(reactor) is readable
+ *    thpool_reactor_dispatch(reactor);
+ *
+ * @param  threadpool    threadpool to which the work will be added
+ * @param  function_p    pointer to function returning the result
+ * @param  arg_p         pointer to an argument
+ * @param  reactor       reactor to run the callback on, or NULL
+ * @param  callback_p    function called with result and argument, or NULL
+ * @return future of the result, NULL on error
+ */
+thpool_future thpool_submit(threadpool, void* (*function_p)(void*), void* arg_p,
+                            thpool_reactor reactor, void (*callback_p)(void* result, void* arg));
+
+
+/**
+ * @brief Check whether the job of a future has finished
+ *
+ * @param  future        the future
+ * @return 1 if finished, 0 otherwise
+ */
+int thpool_future_done(thpool_future);
+
+
+/**
+ * @brief Wait for the job of a future to finish
+ *
+ * @param  future        the future
+ * @return the result returned by the job's function
+ */
+void* thpool_future_wait(thpool_future);
+
+
+/**
+ * @brief Release a future returned by thpool_submit()
+ *
+ * @param  future        the future, or NULL
+ * @return nothing
+ */
+void thpool_future_free(thpool_future);
+
+
+/**
+ * @brief Create a reactor that runs completion callbacks
+ *
+ * Callbacks of futures completed for the reactor are run by whichever
+ * thread calls thpool_reactor_dispatch(), typically an event loop that
+ * polls the descriptor from thpool_reactor_fd() for readability. On
+ * Linux the descriptor is an eventfd, elsewhere a pipe.
+ *
+ * @return reactor on success, NULL on error
+ */
+thpool_reactor thpool_reactor_init(void);
+
+
+/**
+ * @brief Get the descriptor that is readable while callbacks are due
+ *
+ * @param  reactor       the reactor
+ * @return the descriptor
+ */
+int thpool_reactor_fd(thpool_reactor);
+
+
+/**
+ * @brief Run the callbacks of futures completed for a reactor
+ *
+ * @param  reactor       the reactor
+ * @return number of callbacks run
+ */
+int thpool_reactor_dispatch(thpool_reactor);
+
+
+/**
+ * @brief Destroy a reactor
+ *
+ * Callbacks of completed futures not yet dispatched are dropped. No
+ * job submitted with the reactor may still be running.
+ *
+ * @param  reactor       the reactor
+ * @return nothing
+ */
+void thpool_reactor_destroy(thpool_reactor);
+
+
 /**
  * @brief Wait for all queued jobs to finish
  *
@@ -0,0 +1,136 @@
+/*
+ * mime_gen.c
+ *
+ * Build tool that compiles a mime.types file into a C source
+ * file defining builtinMediaTypes, a minimal perfect hash table
+ * from file extension to media type.
+ *
+ * usage: mime_gen mime.types mime_table.c
+ *
+ *  @since 2026-10-18
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include "mph.h"
+
+/** maximum length of a mime.types line */
+#define MAXLINE 1024
+
+/** maximum number of extensions */
+#define MAXEXTS 8192
+
+/**
+ * Write a string as a C string literal.
+ *
+ * @param out the output stream
+ * @param s the string
+ */
+static void writeLiteral(FILE *out, const char *s) {
+	fputc('"', out);
+	for ( ; *s != '\0'; s++) {
+		if ((*s == '"') || (*s == '\\')) {
+			fputc('\\', out);
+		}
+		fputc(*s, out);
+	}
+	fputc('"', out);
+}
+
+/**
+ * Write an array of strings as a C array initializer.
+ *
+ * @param out the output stream
+ * @param name the array name
+ * @param strs the strings
+ * @param n the number of strings
+ */
+static void writeStrings(FILE *out, const char *name, const char *const strs[], size_t n) {
+	fprintf(out, "static const char *const %s[] = {\n", name);
+	for (size_t i = 0; i < n; i++) {
+		fputc('\t', out);
+		writeLiteral(out, strs[i]);
+		fputs(",\n", out);
+	}
+	fprintf(out, "\tNULL\n};\n\n");
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s mime.types mime_table.c\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	FILE *in = fopen(argv[1], "r");
+	if (in == NULL) {
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	// each line is a media type followed by its extensions
+	static const char *exts[MAXEXTS], *types[MAXEXTS];
+	size_t n = 0;
+	char buf[MAXLINE];
+	while (fgets(buf, MAXLINE, in) != NULL) {
+		if (buf[0] == '#') { // ignore comment
+			continue;
+		}
+		char *type = strtok(buf, " \t\r\n");
+		if (type == NULL) {
+			continue;
+		}
+		char *typeCopy = NULL;
+		for (char *ext; (ext = strtok(NULL, " \t\r\n")) != NULL; ) {
+			if (n == MAXEXTS) {
+				fprintf(stderr, "%s: more than %d extensions\n", argv[1], MAXEXTS);
+				return EXIT_FAILURE;
+			}
+			if (typeCopy == NULL) {
+				typeCopy = strdup(type);
+			}
+			exts[n] = strdup(ext);
+			types[n++] = typeCopy;
+		}
+	}
+	fclose(in);
+
+	MphTable table;
+	if (!buildMph(&table, exts, types, n)) {
+		fprintf(stderr, "%s: cannot build hash table\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	FILE *out = fopen(argv[2], "w");
+	if (out == NULL) {
+		perror(argv[2]);
+		return EXIT_FAILURE;
+	}
+	fprintf(out, "/*\n * mime_table.c\n *\n * Generated from mime.types by mime_gen. Do not edit.\n */\n\n");
+	fprintf(out, "#include \"mph.h\"\n\n");
+	fprintf(out, "static const uint32_t seeds[] = {\n");
+	for (uint32_t i = 0; i < table.nbuckets; i++) {
+		fprintf(out, "%s%u,%s", (i % 12 == 0) ? "\t" : " ", table.seeds[i],
+				(i % 12 == 11 || i == table.nbuckets - 1) ? "\n" : "");
+	}
+	fprintf(out, "};\n\n");
+	writeStrings(out, "keys", table.keys, table.nkeys);
+	writeStrings(out, "vals", table.vals, table.nkeys);
+	fprintf(out, "const MphTable builtinMediaTypes = { %u, %u, seeds, keys, vals };\n",
+			table.nkeys, table.nbuckets);
+	bool status = (fclose(out) == 0);
+	if (!status) {
+		perror(argv[2]);
+	}
+
+	// free table and strings; a type is shared by its line
+	freeMph(&table);
+	for (size_t i = 0; i < n; i++) {
+		free((void*)exts[i]);
+		if ((i + 1 == n) || (types[i+1] != types[i])) {
+			free((void*)types[i]);
+		}
+	}
+	return status ? EXIT_SUCCESS : EXIT_FAILURE;
+}